@@ -0,0 +1,44 @@
+// BVH.h - bounding volume hierarchy over mesh triangles, for ray picking and nearest-point queries
+
+#ifndef BVH_HDR
+#define BVH_HDR
+
+#include <float.h>
+#include <vector>
+#include "VecMat.h"
+
+// nodes have four children, whose boxes are tested against a ray (or point) together with SSE
+// leaves hold up to 15 triangles, stored in leaf order; rays are tested with Moller-Trumbore
+
+struct BVHHit {
+	int triangle = -1;						// index into triangles given to Build, or -1 if none
+	float t = FLT_MAX;						// ray: point = origin+t*direction; Closest: distance
+	float u = 0, v = 0;						// barycentric weights of triangle's second and third vertices
+	vec3 point;
+};
+
+class BVH {
+public:
+	void Build(const std::vector<vec3> &points, const std::vector<int3> &triangles);
+		// binned surface area heuristic; large subtrees built in parallel
+	void Clear();
+	bool Empty() const { return nodes.empty(); }
+	int NTriangles() const { return (int) ids.size(); }
+	BVHHit Nearest(vec3 origin, vec3 direction, float tMin = 0, float tMax = FLT_MAX) const;
+		// nearest triangle hit by origin+t*direction, tMin <= t <= tMax; triangles are two-sided
+	bool Any(vec3 origin, vec3 direction, float tMin = 0, float tMax = FLT_MAX) const;
+		// true if any triangle hit for tMin <= t <= tMax (eg, occlusion); stops at first found
+	BVHHit Closest(vec3 p, float maxDistance = FLT_MAX) const;
+		// point on surface nearest p, if within maxDistance; t is its distance
+private:
+	struct Node {
+		float minX[4], minY[4], minZ[4], maxX[4], maxY[4], maxZ[4];
+		int child[4];						// >= 0: node; else leaf ~(first << 4 | count), count 0 if unused
+	};
+	std::vector<Node> nodes;				// root is nodes[0]
+	std::vector<vec3> vertices;				// three per triangle, in leaf order
+	std::vector<int> ids;					// original triangle index, in leaf order
+	friend struct BVHBuilder;
+};
+
+#endif // BVH_HDR
@@ -0,0 +1,33 @@
+// Curves.h - cubic Bezier curves evaluated on the GPU, all drawn with one call
+
+#ifndef CURVES_HDR
+#define CURVES_HDR
+
+#include "glad.h"
+#include "VecMat.h"
+
+// control points and colors for all curves are stored in a buffer texture
+// the vertex shader evaluates curve gl_InstanceID at parameter gl_VertexID/res, where res,
+// the number of segments, adapts to the projected length of the curve's control polygon
+
+void BuildCurveShader();
+	// start compiling the curve shader without waiting (see BuildDrawShaders, Draw.h); else compiled on first use
+
+class BezierCurves {
+public:
+	BezierCurves() { }
+	~BezierCurves();
+	void Set(int nCurves, vec3 *ctrlPts, vec3 *colors = NULL, vec3 color = vec3(0, 0, 0));
+		// ctrlPts: four per curve; colors: one per curve, if null all curves use color
+	void Display(mat4 fullview, float width = 1, float opacity = 1, float pixelsPerSegment = 5, int maxRes = 64);
+		// draw curves with GL_LINE_STRIP, up to maxRes segments per curve
+		// if pixelsPerSegment <= 0, every curve is drawn with maxRes segments
+	int NCurves() { return nCurves; }
+private:
+	GLuint vao = 0, buffer = 0, texture = 0;
+	int nCurves = 0, capacity = 0;
+	BezierCurves(const BezierCurves &) = delete;
+	BezierCurves &operator=(const BezierCurves &) = delete;
+};
+
+#endif // CURVES_HDR
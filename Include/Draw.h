@@ -19,7 +19,7 @@ mat4 ScreenMode();
 bool IsVisible(vec3 p, mat4 fullview, vec2 *screen = NULL, int *w = NULL, int *h = NULL, float fudge = 0);
 	// if the depth test is enabled, is point p visible?
 	// if non-null, set screen location (in pixels) of transformed p
-	// **** this is slow when used during rendering!
+	// **** this is slow when used during rendering! (for many points, see VisibilityQuery in Visibility.h)
 bool DepthXY(int x, int y, float &depth);
 	// return false if depth-buffer disabled, else
 	// return true and set depth to z-value at pixel(x,y)
@@ -31,7 +31,7 @@ void ScreenRay(float xscreen, float yscreen, mat4 modelview, mat4 persp, vec3 &p
 void ScreenLine(float xscreen, float yscreen, mat4 modelview, mat4 persp, vec3 &p1, vec3 &p2);
 	// compute 3D world space line, given by p1 and p2, that transforms
 	// to a line perpendicular to the screen at pixel (xscreen, yscreen)
-	// uses current viewport
+	// uses current viewport; for many points, see Unprojector.h
 float ScreenDistSq(int x, int y, vec3 p, mat4 m, float *zscreen = NULL);
 float ScreenDistSq(double x, double y, vec3 p, mat4 m, float *zscreen = NULL);
 	// return distance squared, in pixels, between screen point (x, y) and point p xformed by view matrix
@@ -39,6 +39,10 @@ double ScreenZ(vec3 p, mat4 m);
 bool FrontFacing(vec3 base, vec3 vec, mat4 view);
 
 // 2D/3D drawing functions
+void BuildDrawShaders();
+	// start compiling the draw and triangle shaders without waiting (see LinkProgramDeferred, GLXtras.h)
+	// call before loading textures and meshes, so compilation overlaps loading; otherwise each
+	// is compiled on first use (as is the cylinder shader, which needs GL 4 tessellation)
 int UseDrawShader();
 	// invoke shader for Disk, Line, Quad, and Arrow, but do not change view transformation
 	// return previous shader ID
@@ -54,6 +58,7 @@ void Line(int x1, int y1, int x2, int y2, float width, vec3 col, float opacity =
 void LineDash(vec3 p1, vec3 p2, mat4 view, float width, vec3 col1, vec3 col2, float opacity = 1);
 void LineDot(vec3 p1, vec3 p2, mat4 view, float width, vec3 col, float opacity = 1);
 void LineStrip(int nPoints, vec3 *points, vec3 &color, float opacity, float width);
+	// unlike Line, does not call UseDrawShader: call UseDrawShader(viewMatrix) first
 void Quad(int x1, int y1, int x2, int y2, int x3, int y3, int x4, int y4, bool solid, vec3 color, float opacity = 1, float lineWidth = 1);
 void Quad(vec3 pnt1, vec3 pnt2, vec3 pnt3, vec3 pnt4, bool solid, vec3 color, float opacity = 1, float lineWidth = 1);
 void Sun(vec3 p, float size, vec3 color, mat4 fullview);
@@ -63,6 +68,9 @@ void ArrowV(vec3 base, vec3 v, mat4 modelview, mat4 persp, vec3 color, float lin
 	// as above but vector and base are 3D, transformed by m
 void Cylinder(vec3 p1, vec3 p2, float r1, float r2, mat4 modelview, mat4 persp, vec4 color);
 	// p1 and p2 specify x,y,z for cylinder endpoints, and w for radius
+	// modelview and persp are set in the Frame block (GLXtras.h)
+void Cylinder(vec3 p1, vec3 p2, float r1, float r2, vec4 color);
+	// as above, using the camera already set by UpdateFrameBlock
 
 // triangle operations
 void UseTriangleShader();
@@ -70,6 +78,12 @@ void UseTriangleShader(mat4 viewMatrix);
 void Triangle(vec3 p1, vec3 p2, vec3 p3, vec3 c1, vec3 c2, vec3 c3,
 			  float opacity = 1, bool outline = false,
 			  vec4 outlineCol = vec3(0,0,0), float outlineWidth = 1, float transition = 1);
+void Triangles(int nTriangles, vec3 *points, vec3 *colors,
+			   float opacity = 1, bool outline = false,
+			   vec4 outlineCol = vec3(0,0,0), float outlineWidth = 1, float transition = 1);
+	// draw unindexed triangle list (3*nTriangles points and per-vertex colors) in a single call
+	// outline computed in pixel shader from barycentrics derived from gl_VertexID (no geometry shader)
+	// outlineWidth and transition are in pixels
 
 void Box(vec3 a, vec3 b, float width, vec3 col);
 
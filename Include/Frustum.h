@@ -0,0 +1,28 @@
+// Frustum.h - view frustum planes, for culling bounding spheres and boxes
+
+#ifndef FRUSTUM_HDR
+#define FRUSTUM_HDR
+
+#include "VecMat.h"
+
+// planes are extracted from a perspective*modelview matrix (Gribb and Hartmann), so tests are in
+// the space the matrix transforms from: world space for persp*modelview, object space if *model
+// a bound is tested against four planes at once with SSE
+
+enum FrustumTest { FrustumOutside = 0, FrustumIntersects, FrustumInside };
+
+class Frustum {
+public:
+	Frustum() { }
+	Frustum(const mat4 &fullview) { Set(fullview); }
+	void Set(const mat4 &fullview);
+		// six planes, facing inward, normalized
+	FrustumTest TestSphere(vec3 center, float radius) const;
+	FrustumTest TestBox(vec3 min, vec3 max) const;
+		// axis-aligned box; as with a sphere, outside only if wholly behind one plane,
+		// so a bound near a frustum edge may be reported intersecting though outside
+private:
+	float x[8], y[8], z[8], w[8];			// planes ax+by+cz+d, in two groups of four; last two always pass
+};
+
+#endif // FRUSTUM_HDR
@@ -0,0 +1,46 @@
+// GLState.h - shadow copy of OpenGL state, filters redundant state changes
+
+#ifndef GL_STATE_HDR
+#define GL_STATE_HDR
+
+#include "glad.h"
+
+// InitGLState replaces glad entry points for the calls below with versions that
+// compare against a shadow copy of the state and skip the call if nothing changes:
+//   glUseProgram, glBindVertexArray, glBindBuffer (array, pixel pack/unpack, uniform),
+//   glBindBufferBase (uniform, first 16 indices; glBindBufferRange is counted, not filtered),
+//   glActiveTexture, glBindTexture (2D), glViewport, glDepthRange, glBlendFunc,
+//   glEnable/glDisable (blend, depth test, cull face)
+// all code that calls through glad (including the application) keeps the shadow current
+// the hooks are lost if gladLoadGLLoader is called again; call InitGLState afterwards
+
+bool InitGLState();
+	// call once, after gladLoadGLLoader; read current state from GL and install hooks
+	// return false if glad not yet loaded
+
+bool GLStateActive();
+	// true if hooks installed
+
+void SyncGLState();
+	// re-read shadow from GL (eg, after a third-party library changes state without glad)
+
+// Queries (answered from shadow if active, else from GL)
+
+void GetGLViewport(int vp[4]);
+GLuint GetGLProgram();
+bool GLEnabled(GLenum cap);
+	// for GL_BLEND, GL_DEPTH_TEST, GL_CULL_FACE; other caps passed to glIsEnabled
+void GetGLDepthRange(float range[2]);
+
+// Counts
+
+struct GLStateCounts {
+	int issued = 0, skipped = 0;			// state calls forwarded to GL, filtered as redundant
+	int skippedPrograms = 0, skippedBuffers = 0, skippedTextures = 0, skippedOther = 0;
+};
+
+GLStateCounts GetGLStateCounts(bool reset = false);
+	// if reset, zero counts after returning them
+void PrintGLStateCounts(const char *title = NULL);
+
+#endif // GL_STATE_HDR
@@ -4,6 +4,10 @@
 #define GL_XTRAS_HDR
 
 #include "glad.h"
+#include <initializer_list>
+#include <map>
+#include <string>
+#include <vector>
 #include "VecMat.h"
 
 // Print Info
@@ -14,6 +18,19 @@ void PrintProgramLog(int programID);
 void PrintProgramAttributes(int programID);
 void PrintProgramUniforms(int programID);
 
+// Debug Output
+bool InitGLDebug(bool synchronous = false);
+	// install a GL debug message callback (GL 4.3/KHR_debug), call after gladLoadGLLoader
+	// errors and performance/portability warnings are recorded in a ring, and PrintGLErrors
+	// then prints and empties the ring instead of calling glGetError (which stalls the CPU)
+	// if synchronous, messages are issued during the offending call (slower, easier to trace)
+	// requires a debug context (glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, true)): otherwise returns false,
+	// and PrintGLErrors continues to poll glGetError
+	// with NDEBUG, compiled out: returns false and PrintGLErrors polls glGetError
+bool GLDebugActive();
+void LabelObject(GLenum identifier, GLuint name, const char *label);
+	// name an object (eg, GL_PROGRAM, GL_BUFFER, GL_TEXTURE) in debug messages; no-op unless active
+
 // Shader Compilation
 GLuint CompileShaderViaFile(const char *filename, GLint type);
 GLuint CompileShaderViaCode(const char **code, GLint type);
@@ -31,6 +48,37 @@ GLuint LinkProgram(GLuint vshader, GLuint tcshader, GLuint teshader, GLuint gsha
 GLuint LinkProgramViaFile(const char *vertexShaderFile, const char *pixelShaderFile);
 GLuint LinkProgramViaFile(const char *computeShaderFile);
 
+// Deferred Linking
+GLuint LinkProgramDeferred(const char **vertexCode, const char **pixelCode);
+GLuint LinkProgramDeferred(const char **vertexCode,
+						   const char **tessellationControlCode,
+						   const char **tessellationEvalCode,
+						   const char **geometryCode,
+						   const char **pixelCode);
+	// as LinkProgramViaCode, but return without waiting for compilation or checking status
+	// with GL_KHR_parallel_shader_compile, the driver compiles while the application continues,
+	// on as many threads as it allows (glMaxShaderCompilerThreadsKHR is set to its maximum)
+	// (eg, loading textures and meshes); status is checked by FinishProgram, which is called
+	// by Program::Reflect and ShaderVariants::Get, and on first glUseProgram if GLState hooks
+	// are active (see GLState.h); otherwise call FinishProgram before using the program
+int NPendingPrograms();
+bool ProgramPending(GLuint program);
+	// true if linked with LinkProgramDeferred and not yet finished
+bool ProgramReady(GLuint program);
+	// true if finishing the program will not block (GL_COMPLETION_STATUS_KHR)
+bool FinishProgram(GLuint program);
+	// wait for compile and link, report errors; return true if linked
+int FinishPrograms(bool onlyReady = false);
+	// finish all pending programs (or only those ready); return # finished
+
+// Program Binary Cache
+void SetProgramCacheDirectory(const char *directory);
+	// LinkProgramViaCode and LinkProgramViaFile look for a program binary in directory (default
+	// "ShaderCache"), keyed by a hash of stage sources and GL vendor, renderer, and version strings
+	// on a miss, or if the driver rejects the binary, compile, link, and write the binary
+	// null or "" disables the cache
+const char *GetProgramCacheDirectory();
+
 // Miscellany
 int CurrentProgram();
 void DeleteProgram(int program);
@@ -38,6 +86,7 @@ void DeleteProgram(int program);
 // Binary Read/Write
 void WriteProgramBinary(GLuint program, const char *filename);
 bool ReadProgramBinary(GLuint program, const char *filename);
+	// return true if binary read and program linked
 GLuint ReadProgramBinary(const char *filename);
 
 // Uniform Access
@@ -59,6 +108,151 @@ bool SetUniform4v(int program, const char *name, int count, float *v, bool repor
 bool SetUniform(int program, const char *name, mat4 m, bool report = true);
 	// if no such named uniform and report, print error message
 
+// Frame Statistics
+//   counts GL calls that pass through glad, per frame; compiled only if GL_STATS is defined
+//   (otherwise all counts are zero and InitGLStats returns false)
+//   call InitGLStats after gladLoadGLLoader; if called before InitGLState (GLState.h),
+//   binds counted are those that reach the driver, if after, those the application makes
+
+struct GLFrameStats {
+	int draws = 0;
+	long long triangles = 0, vertices = 0;	// triangles excludes tessellated patches
+	int programBinds = 0, textureBinds = 0, bufferBinds = 0, vertexArrayBinds = 0;
+	int uploads = 0;						// glBufferData (with data), glBufferSubData
+	long long uploadBytes = 0;
+	int readPixels = 0;
+};
+
+bool InitGLStats();
+void GLStatsFrame();
+	// end frame (eg, after glfwSwapBuffers): save counts, zero for next frame
+GLFrameStats GetGLFrameStats(bool current = false);
+	// counts for last completed frame (or for frame in progress)
+void PrintGLFrameStats(const char *title = NULL);
+	// see also TextGLFrameStats (Text.h), an on-screen display
+
+// Per-frame Uniform Block
+
+// library shaders declare the Frame block (insert FRAME_BLOCK_GLSL after #version) and
+// read it as frame.modelview, etc; LinkProgram binds any program's Frame block to FrameBlockBinding
+// the block is row_major, so C++ matrices are uploaded as they are
+
+const int FrameBlockBinding = 0;
+const int MaxFrameLights = 8;				// must match lights[] in FRAME_BLOCK_GLSL
+
+#define FRAME_BLOCK_GLSL \
+	"layout (std140, row_major) uniform Frame {\n" \
+	"	mat4 modelview;		// world to eye\n" \
+	"	mat4 persp;			// eye to clip\n" \
+	"	mat4 fullview;		// persp*modelview\n" \
+	"	mat4 screenMode;	// pixels to clip\n" \
+	"	vec4 viewport;		// x, y, width, height\n" \
+	"	vec4 lights[8];		// eye space\n" \
+	"	int nLights;\n" \
+	"} frame;\n"
+
+struct FrameBlock {
+	mat4 modelview, persp, fullview, screenMode;
+	vec4 viewport;
+	vec4 lights[MaxFrameLights];
+	int nLights = 0, pad[3] = { 0, 0, 0 };
+};
+
+void UpdateFrameBlock(mat4 modelview, mat4 persp);
+	// set camera matrices and viewport (from GL), upload if changed
+	// call once per frame; calls with unchanged values (eg, from Mesh::Display) are skipped
+void UpdateFrameLights(int nLights, vec3 *lights, mat4 *modelview = NULL);
+	// set lights (at most MaxFrameLights), transformed to eye space by modelview if non-null
+	// upload if changed; if no lights, shaders light from the eye
+const FrameBlock &GetFrameBlock();
+void BindFrameBlock(GLuint program);
+	// bind program's Frame block, if any, to FrameBlockBinding
+
+// Program Reflection
+
+class Program {
+	// active uniforms and attributes of a linked program, queried once
+	// uniforms are set by handle (from Uniform()) via glProgramUniform*, so the program need not be in use
+	// a set is skipped if the value equals the last value set through this object
+	// (so, once a Program is used, do not also set its uniforms with SetUniform)
+public:
+	struct UniformInfo {
+		std::string name;			// arrays as base name, without "[0]"
+		GLint location = -1, size = 0;
+		GLenum type = 0;
+		int offset = 0, nBytes = 0;	// into value cache
+		bool known = false;			// cache holds value last set
+	};
+	struct AttributeInfo {
+		std::string name;
+		GLint location = -1, size = 0;
+		GLenum type = 0;
+	};
+	GLuint id = 0;
+	std::vector<UniformInfo> uniforms;
+	std::vector<AttributeInfo> attributes;
+	int nUploads = 0, nSkipped = 0;
+	Program() { }
+	Program(GLuint program) { Reflect(program); }
+	bool Reflect(GLuint program);
+		// query active uniforms and attributes; call after (re)linking; return false if program 0
+	int Uniform(const char *name, bool report = false);
+		// return handle, or -1 if no such active uniform (if report, print message)
+	int Attribute(const char *name, bool report = false);
+		// return location, or -1 if no such active attribute
+	void Forget();
+		// mark cached values unknown (eg, after uniforms set outside this object)
+	bool Set(int handle, bool v);
+	bool Set(int handle, int v);
+	bool Set(int handle, float v);
+	bool Set(int handle, vec2 v);
+	bool Set(int handle, vec3 v);
+	bool Set(int handle, vec4 v);
+	bool Set(int handle, mat4 m);
+	bool Setv(int handle, int count, const int *v);
+	bool Setv(int handle, int count, const float *v);
+	bool Set3v(int handle, int count, const float *v);
+	bool Set4v(int handle, int count, const float *v);
+		// return true if uploaded; false if handle < 0 or value unchanged
+	void VertexAttribPointer(int location, GLint ncomponents, GLsizei stride, const GLvoid *offset);
+		// enable attribute, set pointer with type = GL_FLOAT and normalize = GL_FALSE (location < 0 ignored)
+	void Print();
+private:
+	std::vector<char> cache;
+	bool Changed(int handle, const void *v, int nBytes);
+};
+
+// Shader Variants
+
+class ShaderVariants {
+	// one vertex/pixel shader pair, specialized at compile time by boolean features
+	// a feature is the name of a uniform bool; each variant has, after #version,
+	//     #define VARIANTS
+	//     #define <feature> true (or false)
+	// so the compiler folds branches on features away; the source should declare
+	// the feature uniforms inside #ifndef VARIANTS, so the generic program keeps them
+	// a variant is chosen by bitmask (bit i for feature i), compiled on first use, and cached
+public:
+	ShaderVariants(const char *vertexCode, const char *pixelCode, std::initializer_list<const char *> features);
+	unsigned Feature(const char *name);
+		// bit for named feature, 0 if none
+	GLuint Prepare(unsigned mask);
+		// start compiling variant without waiting (see LinkProgramDeferred); return program
+	Program &Get(unsigned mask);
+		// variant for mask, compiled and reflected if needed
+	Program &Use(unsigned mask);
+		// as Get, and make current
+	Program &Generic();
+		// program compiled without VARIANTS: features are ordinary uniforms
+	int NVariants() { return (int) variants.size(); }
+private:
+	struct Variant { GLuint id = 0; Program program; };
+	const char *vertexCode, *pixelCode;
+	std::vector<std::string> features;
+	std::map<unsigned, Variant> variants;	// map, so Program references remain valid
+	Program generic;
+};
+
 // Attribute Access
 int EnableVertexAttribute(int program, const char *name);
 	// find named attribute and enable
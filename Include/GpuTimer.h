@@ -0,0 +1,50 @@
+// GpuTimer.h - scoped GPU timers, results read frames later so nothing blocks
+
+#ifndef GPU_TIMER_HDR
+#define GPU_TIMER_HDR
+
+#include "glad.h"
+#include <vector>
+
+// a GpuTimer records a GL_TIMESTAMP query when constructed and another when destroyed:
+//     { GpuTimer t("mesh pass"); mesh.Display(camera); }
+// timestamps (rather than GL_TIME_ELAPSED) allow timers to nest and overlap
+// call GpuTimerFrame once per frame (eg, after glfwSwapBuffers); queries are kept for
+// GpuTimerLatency frames and read only once available, so the CPU never waits on the GPU
+// times with the same name in one frame are summed; statistics cover the last window frames
+// a timer still alive when GpuTimerFrame is called is discarded
+
+class GpuTimer {
+public:
+	GpuTimer(const char *name);
+		// name should be a string literal or otherwise outlive the timer statistics
+	~GpuTimer();
+private:
+	int frame, record;						// frame count when started, record within frame
+	GpuTimer(const GpuTimer &) = delete;
+	GpuTimer &operator=(const GpuTimer &) = delete;
+};
+
+const int GpuTimerLatency = 3;				// frames before results are read
+
+void GpuTimerFrame();
+	// end frame: collect available results of earlier frames, start recording a new frame
+
+struct GpuTimerStat {
+	const char *name = NULL;
+	int nFrames = 0;						// # frames in window (<= window size)
+	float lastMs = 0, minMs = 0, avgMs = 0, maxMs = 0;
+};
+
+void SetGpuTimerWindow(int nFrames = 60);
+	// # frames over which min/avg/max are found
+std::vector<GpuTimerStat> GpuTimerStats();
+	// one entry per timer name, in order first used
+bool GpuTimerStats(const char *name, GpuTimerStat &stat);
+	// return false if no results for name
+void PrintGpuTimers();
+	// print a line per timer: name, avg, min, max (ms)
+void ClearGpuTimers();
+	// discard results and free queries (eg, before context destroyed)
+
+#endif // GPU_TIMER_HDR
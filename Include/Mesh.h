@@ -5,8 +5,10 @@
 
 #include <glad.h>
 #include <stdio.h>
+#include <memory>
 #include <vector>
 #include "CameraArcball.h"
+#include "GLXtras.h"
 #include "VecMat.h"
 
 using std::string;
@@ -14,22 +16,91 @@ using std::vector;
 
 // Mesh Class and Operations
 
-GLuint GetMeshShader();
-GLuint UseMeshShader();
+enum MeshFeature { MeshLight = 1, MeshTexture = 2, MeshTint = 4, MeshDefaultColor = 8, MeshFwdFacing = 16 };
+
+void SetMeshFeatures(int features);
+int GetMeshFeatures();
+	// shading options for Mesh::Display, default MeshLight | MeshDefaultColor
+	// each combination used is compiled once into a specialized shader (see ShaderVariants, GLXtras.h)
+	// MeshTexture is set per mesh, according to whether it has a texture and uvs
+
+void SetMeshColor(vec3 color);
+vec3 GetMeshColor();
+	// color with MeshDefaultColor, or tint with MeshTint; default white
+void SetMeshOpacity(float opacity);
+float GetMeshOpacity();
+	// alpha of shaded pixels; default 1
+
+void SetMeshCache(bool enable);
+bool GetMeshCache();
+	// if enabled (the default), Mesh::Read writes the mesh it reads to <file>.mshb
+	// and later reads that instead, unless the source file (or a .mtl file it names) has been modified since
+	// a failure to write the cache (eg, in a read-only directory) is reported once
+
+void SetMeshOptimize(bool enable);
+bool GetMeshOptimize();
+	// if enabled, Mesh::Read calls Mesh::Optimize before buffering; default false
+	// the optimized order is what the mesh cache stores
+
+void SetMeshLODs(bool enable);
+bool GetMeshLODs();
+	// if enabled, Mesh::Read starts a background thread to build levels of detail; default false
+void SetMeshLODThreshold(float pixels);
+float GetMeshLODThreshold();
+	// Mesh::Display draws the coarsest level whose error projects to no more than this; default 1
+
+Program &GetMeshProgram(bool textured = false);
+GLuint GetMeshShader(bool textured = false);
+GLuint UseMeshShader(bool textured = false);
+	// the specialized shader Mesh::Display uses for the current features (with MeshTexture if textured)
+	// features are compiled in, so configure them with SetMeshFeatures, not the useLight, etc uniforms
+	// Display sets model, color and opacity uniforms on each draw
+
+enum MeshVertexFormat { MeshPlanar = 0, MeshPacked, MeshQuantized };
+	// GPU vertex layout chosen by Mesh::Buffer:
+	//   MeshPlanar:    separate float blocks of points, normals, uvs (32 bytes/vertex)
+	//   MeshPacked:    interleaved float points, 10-10-10-2 normals, half-float uvs (20 bytes/vertex)
+	//   MeshQuantized: as packed, but points as 16-bit fixed point within the bounding box (16 bytes/vertex)
+	// half-float uvs keep about 3 decimal digits over [0,1]; heavily tiled uvs may prefer MeshPlanar
+
+// Groups and Materials (from OBJ file)
+
+struct Group {
+	string name;
+	int startTriangle = 0, nTriangles = 0;
+	Group(int start = 0, string n = "") : startTriangle(start), name(n) { }
+};
+
+struct Mtl {
+	string name;
+	vec3 ka, kd, ks;
+	int startTriangle = 0, nTriangles = 0;
+	Mtl() {startTriangle = -1, nTriangles = 0; }
+	Mtl(int start, string n, vec3 a, vec3 d, vec3 s) : startTriangle(start), name(n), ka(a), kd(d), ks(s) { }
+};
+
+// Levels of Detail
+
+struct MeshLOD {
+	int firstIndex = 0, nIndices = 0;	// triangles, in element buffer after those of the full mesh
+	float error = 0;					// bound on distance from full mesh, object space
+};
+
+struct MeshLODJob;						// background build, see Mesh::BuildLODs
 
 class Frame {
 public:
 	Frame() { };
-	Frame(Quaternion q, vec3 o, float s) : orientation(q), origin(o), scale(s) { };
+	Frame(Quaternion q, vec3 p, float s) : orientation(q), position(p), scale(s) { };
 	Quaternion orientation;
-	vec3 origin;
+	vec3 position;
 	float scale = 1;
 };
 
 class Mesh {
 public:
 	Mesh() { };
-	~Mesh() { glDeleteBuffers(1, &vBufferId); };
+	~Mesh();
 	string objFilename, texFilename;
 	// vertices and facets
 	vector<vec3> points;
@@ -37,20 +108,83 @@ public:
 	vector<vec2> uvs;
 	vector<int3> triangles;
 	vector<int4> quads;
+	vector<Group> groups;
+	vector<Mtl> materials;
+	vec3 boundsMin, boundsMax;			// object space, set by Buffer and Read (see UpdateBounds)
+	vec3 sphereCenter = vec3(0, 0, 0);	// object space bounding sphere, radius < 0 if no points
+	float sphereRadius = -1;
 	// position/orientation
 	mat4 transform;						// object to world space, set during drag
 	Frame frameDown;					// reference frame on mouse down
 	// hierarchy
 	vector<Mesh *> children;
+	// world space bounds, cached by UpdateWorldBounds
+	vec3 worldMin, worldMax;			// box of this mesh
+	vec3 worldCenter;					// sphere of this mesh and its children
+	float worldRadius = -1;
+	mat4 boundsTransform;				// transform when world bounds computed
+	bool boundsDirty = true;			// set if object space bounds change
 	// GPU vertex buffer and texture
 	GLuint vao = 0;						// vertex array object
 	GLuint vBufferId = 0;
+	MeshVertexFormat vertexFormat = MeshPlanar;	// set before Buffer (or Read)
+	vec3 pointOffset = vec3(0, 0, 0), pointScale = vec3(1, 1, 1);	// dequantize points (MeshQuantized only)
+	// GPU index buffers: triangles (quads split in two), and unique edges (quad diagonals omitted)
+	GLuint indexBufferId = 0, edgeVao = 0, edgeBufferId = 0;
+	int nIndices = 0, nEdgeIndices = 0;
+	// simplified copies of triangles, coarser with each level; vertices shared with full mesh
+	vector<MeshLOD> lods;
+	std::shared_ptr<MeshLODJob> lodJob;	// pending, if built in background; owns its thread
 	GLuint textureName = 0, textureUnit = 0;
+	// per-instance matrices and colors, rewritten by each DisplayInstanced
+	GLuint instanceBufferId = 0;
+	// unindexed copy of vertices with barycentrics, for outlines (built on first use)
+	GLuint outlineVao = 0, outlineBufferId = 0;
+	int nOutlineVertices = 0;
 	// operations
 	void Buffer();
-	void Display(CameraAB camera, bool lines = false);
+	void Buffer(vector<vec3> &pts, vector<vec3> *nrms = NULL, vector<vec2> *tex = NULL);
+		// upload vertices, and triangle and edge indices from triangles and quads
+	void BufferIndices();
+		// upload triangle and edge indices only (eg, after changing triangles or quads)
+	void Optimize(bool report = true);
+		// reorder triangles within each group and material for vertex cache and overdraw, then
+		// renumber vertices (and normals, uvs) in order of use; see MeshOptimize.h
+		// if report, print the average cache miss ratio before and after; call Buffer afterwards
+	void Set(vector<vec3> &pts, vector<vec3> *nrms = NULL, vector<vec2> *tex = NULL, vector<int> *tris = NULL, vector<int> *quas = NULL);
+		// set triangles and quads from flat index arrays, buffer vertices
+	void BuildLODs(bool background = true);
+		// simplify to 50, 25, 12 and 6% of triangles (see MeshSimplify.h), stopping early if seams
+		// prevent reduction; if background, on its own thread; call after Buffer
+		// index buffer space for the levels is reserved here; SelectLOD uploads each once, when ready
+		// building or buffering triangles again, or destroying the mesh, cancels a build in progress
+		// (its thread is joined); builds still running at exit are cancelled and joined
+	int SelectLOD(const CameraAB &camera);
+		// return 0 for full mesh, or i for lods[i-1], the coarsest whose error, scaled by the
+		// projected radius of the bounding sphere, is within the LOD threshold (in pixels)
+	void UpdateBounds();
+		// set boundsMin, boundsMax and bounding sphere from points
+	bool UpdateWorldBounds();
+		// recompute world bounds of this mesh and its children where transform (eg, moved by
+		// MeshFramer) or object space bounds have changed; return true if any did
+	int DisplayCulled(const CameraAB &camera, bool lines = false);
+		// display this mesh and its children, skipping those whose world bounds are outside the view
+		// frustum; subtrees wholly outside (or inside) are not tested further; return # displayed
+	void Display(const CameraAB &camera, bool lines = false);
+		// camera set in Frame block (see GLXtras.h); per-draw uniform is transform only
+		// if lines, draw only triangle and quad edges (quad diagonals omitted), else level chosen by SelectLOD
+		// either way a single draw, indexed from GPU buffers built by Buffer
+	void DisplayInstanced(const CameraAB &camera, const vector<mat4> &instances, const vector<vec3> *colors = NULL, bool lines = false);
+		// draw a copy of the mesh for each instance, with transform*instances[i], in a single draw
+		// colors, if non-null, one per instance, shade the copies unless the mesh is textured;
+		// MeshDefaultColor (set by default) is ignored for this draw
+		// the full mesh is drawn (levels of detail are chosen per mesh, not per instance)
+	void DisplayOutline(const CameraAB &camera, vec4 outlineColor = vec4(0, 0, 0, 1), float outlineWidth = 1, float transition = 1);
+		// draw shaded mesh with edges overlaid in a single draw (no geometry shader)
+		// outlineWidth and transition are in pixels
 	bool Read(string objFile, mat4 *m = NULL, bool normalize = true);
 		// read in object file (with normals, uvs), initialize matrix, build vertex buffer
+		// objFile may be .obj or .stl; see SetMeshCache for the binary copy kept beside it
 	bool Read(string objFile, string texFile, int textureUnit, mat4 *m = NULL, bool normalize = true);
 		// read in object file (with normals, uvs) and texture file, initialize matrix, build vertex buffer
 		// textureUnit must be > 0
@@ -88,23 +222,18 @@ struct VertexSTL {
 };
 
 int ReadSTL(const char *filename, vector<VertexSTL> &vertices);
-	// read vertices from file, three per triangle; return # triangles
+	// read vertices from binary or ASCII file, three per triangle; return # triangles
+	// binary files are memory-mapped and decoded in parallel
 
-// Read OBJ Format
+int ReadSTL(const char *filename, vector<vec3> &points, vector<int3> &triangles, vector<vec3> *normals = NULL);
+	// read and weld vertices with identical positions; return # triangles
+	// normals, if non-null, are set from the surrounding triangles (see SetVertexNormals)
 
-struct Group {
-	string name;
-	int startTriangle = 0, nTriangles = 0;
-	Group(int start = 0, string n = "") : startTriangle(start), name(n) { }
-};
+void SetWeldSTL(bool weld);
+bool GetWeldSTL();
+	// if set, Mesh::Read welds STL vertices (smooth shaded); default false (three vertices, one normal, per facet)
 
-struct Mtl {
-	string name;
-	vec3 ka, kd, ks;
-	int startTriangle = 0, nTriangles = 0;
-	Mtl() {startTriangle = -1, nTriangles = 0; }
-	Mtl(int start, string n, vec3 a, vec3 d, vec3 s) : startTriangle(start), name(n), ka(a), kd(d), ks(s) { }
-};
+// Read OBJ Format
 
 bool ReadAsciiObj(const char    *filename,                  // must be ASCII file
 				  vector<vec3>  &points,                    // unique set of points determined by vertex/normal/uv triplets in file
@@ -117,6 +246,13 @@ bool ReadAsciiObj(const char    *filename,                  // must be ASCII fil
 				  vector<int2>  *segs = NULL);				// optional line segments
 	// set points and triangles; normals, textures, quads optional
 	// return true if successful
+	// memory-maps file and parses it in parallel; output matches ReadAsciiObjSerial
+	// normals and textures are filled only where the file provides them: they may be fewer than points
+
+bool ReadAsciiObjSerial(const char *filename, vector<vec3> &points, vector<int3> &triangles, vector<vec3> *normals = NULL,
+						vector<vec2> *textures = NULL, vector<Group> *triangleGroups = NULL, vector<Mtl> *triangleMtls = NULL,
+						vector<int4> *quads = NULL, vector<int2> *segs = NULL);
+	// line-at-a-time reader, used by ReadAsciiObj for files it can't parse exactly
 
 bool WriteAsciiObj(const char   *filename,
 				   vector<vec3> &points,
@@ -130,6 +266,9 @@ bool WriteAsciiObj(const char   *filename,
 
 // Bounding Box
 
+void MinMax(vector<vec3> &points, vec3 &min, vec3 &max);
+	// set min and max to the extent of points
+
 void Normalize(vector<vec3> &points, float scale = 1);
 	// translate and apply uniform scale so that vertices fit in -scale,+scale in X,Y,Z
 
@@ -147,15 +286,24 @@ struct TriInfo {
 	vec4 plane;
 	int majorPlane = 0; // 0: XY, 1: XZ, 2: YZ
 	vec2 p1, p2, p3;    // vertices projected to majorPlane
+	unsigned generation = 0; // BuildTriInfos call that set this, 0 if none
 	TriInfo() { };
 	TriInfo(vec3 p1, vec3 p2, vec3 p3);
 };
 
 void BuildTriInfos(vector<vec3> &points, vector<int3> &triangles, vector<TriInfo> &triInfos);
-	// for interactive selection
+	// for interactive selection; also builds a BVH (see BVH.h) over the triangles, used by IntersectWithLine
+	// (BVHs of the 16 most recent builds are kept); after changing points or triangles, build again
 
 int IntersectWithLine(vec3 p1, vec3 p2, vector<TriInfo> &triInfos, float &alpha);
 	// return triangle index of nearest intersected triangle, or -1 if none
-	// intersection = p1+alpha*(p2-p1)
+	// intersection = p1+alpha*(p2-p1), alpha of any sign (FLT_MAX if none)
+	// uses the BVH of the BuildTriInfos call that made triInfos, else tests every triangle
+
+class BVH;
+
+int IntersectWithLine(vec3 p1, vec3 p2, const BVH &bvh, float &alpha);
+	// as above, with bvh built from the mesh's points and triangles (see BVH.h)
+	// the caller rebuilds bvh when the mesh changes
 
 #endif
@@ -0,0 +1,33 @@
+// MeshOptimize.h - reorder triangles and vertices for the GPU vertex cache, overdraw and vertex fetch
+
+#ifndef MESH_OPTIMIZE_HDR
+#define MESH_OPTIMIZE_HDR
+
+#include <vector>
+#include "VecMat.h"
+
+// typical use, after reading a mesh: OptimizeVertexCache, then OptimizeOverdraw, then OptimizeVertexFetch
+// Mesh::Optimize (Mesh.h) does this per group/material and reports the cache miss ratio
+
+float ACMR(const std::vector<int3> &triangles, int cacheSize = 16);
+	// average cache miss ratio: vertex transforms per triangle for a FIFO post-transform cache
+	// of cacheSize; 3 is the worst, about .6 the best for a regular grid
+
+void OptimizeVertexCache(std::vector<int3> &triangles, int nVertices);
+	// reorder triangles so vertices are reused while still in the vertex cache
+	// after Forsyth, Linear-Speed Vertex Cache Optimisation (2006), for an LRU cache of 32
+
+void OptimizeOverdraw(const std::vector<vec3> &points, std::vector<int3> &triangles, float threshold = 1.05f);
+	// cut cache-optimized triangles into clusters and sort them so outward-facing clusters draw first
+	// clusters are cut where the cache miss ratio stays within threshold of the whole (threshold >= 1)
+	// after Sander, Nehab and Barczak, Fast Triangle Reordering for Vertex Locality and Reduced Overdraw (2007)
+
+void OptimizeVertexFetch(std::vector<int3> &triangles, std::vector<int4> &quads, int nVertices, std::vector<int> &remap);
+	// renumber vertices in order of first use by triangles, then quads; unused vertices follow in order
+	// remap[old vertex] is its new index (apply with RemapVertices)
+
+void RemapVertices(std::vector<vec3> &attribute, const std::vector<int> &remap);
+void RemapVertices(std::vector<vec2> &attribute, const std::vector<int> &remap);
+	// reorder per-vertex points, normals or uvs by remap; unchanged if not one per vertex
+
+#endif // MESH_OPTIMIZE_HDR
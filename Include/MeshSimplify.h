@@ -0,0 +1,24 @@
+// MeshSimplify.h - quadric error edge-collapse simplification, for levels of detail
+
+#ifndef MESH_SIMPLIFY_HDR
+#define MESH_SIMPLIFY_HDR
+
+#include <atomic>
+#include <float.h>
+#include <vector>
+#include "VecMat.h"
+
+// edges are collapsed cheapest first by quadric error (after Garland and Heckbert, Surface Simplification
+// Using Quadric Error Metrics, 1997), each into one of its vertices: no vertex is moved or added, so
+// the result indexes the same points (and normals, uvs) and levels of detail can share a vertex buffer
+
+float Simplify(const std::vector<vec3> &points, std::vector<int3> &triangles, int targetTriangles, float maxError = FLT_MAX,
+			   const std::atomic<bool> *cancel = NULL);
+	// collapse until no more than targetTriangles remain, or the next collapse would exceed maxError
+	// (or cancel, if non-null, is set: eg, by another thread discarding the result)
+	// return error of the result: an upper bound on distance from the input, in units of points
+	// seams (distinct vertices at one position, eg differing in normal or uv) collapse only along the seam,
+	// and open borders only along the border; so a mesh with a seam at every edge (eg, flat-shaded
+	// STL, three vertices per facet) is not reduced
+
+#endif // MESH_SIMPLIFY_HDR
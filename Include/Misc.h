@@ -17,6 +17,24 @@ std::string GetDirectory();
 time_t FileModified(const char *name);
 bool FileExists(const char *name);
 
+// Memory-mapped File
+
+class MappedFile {
+public:
+	const char *data = NULL;				// read-only view of whole file
+	size_t size = 0;
+	MappedFile() { }
+	MappedFile(const char *filename) { Open(filename); }
+	~MappedFile() { Close(); }
+	bool Open(const char *filename);
+		// map file; return false if can't open (an empty file opens with size 0)
+	void Close();
+private:
+	void *file = NULL, *mapping = NULL;
+	MappedFile(const MappedFile &);			// not copyable
+	MappedFile &operator=(const MappedFile &);
+};
+
 // Sphere
 
 int LineSphere(vec3 ln1, vec3 ln2, vec3 center, float radius, vec3 &p1, vec3 &p2);
@@ -6,12 +6,17 @@
 #include <glad.h>
 #include <time.h>
 #include <vector>
+#include "GLXtras.h"
 #include "VecMat.h"
 
 using namespace std;
 
 void BuildShader();
+	// start compiling sprite shader variants without waiting (call before loading textures)
+	// Sprite::Display uses a variant specialized for matte and channel count (see ShaderVariants, GLXtras.h)
 int GetSpriteShader();
+Program &GetSpriteProgram();
+	// generic sprite shader, with useMat and nTexChannels as uniforms
 
 // Sprite Class
 
@@ -47,6 +52,8 @@ public:
 	void SetPtTransform(mat4 m);
 	void SetUvTransform(mat4 m);
 	void Display(mat4 *view = NULL, int textureUnit = 0);
+	void DisplayTexture(GLuint texName, int textureUnit = 0, mat4 *view = NULL);
+		// display with given texture (eg, for subclasses with several costumes)
 	void Release();
 	void SetFrameDuration(float dt); // if animating
 	Sprite(vec2 p = vec2(), float s = 1) : position(p), scale(vec2(s, s)) { UpdateTransform(); }
@@ -46,7 +46,13 @@ void Text(vec3 p, mat4 m, vec3 color, float scale, const char *format, ...);
 float TextWidth(float scale, const char *format, ...);
     // width in pixels of text displayed with current font and given scale
 
+void BuildTextShader();
+    // start compiling the text shader without waiting (see BuildDrawShaders, Draw.h); else compiled on first use
+
 void RenderText(const char *text, float x, float y, vec3 color, float scale, mat4 view, bool vertical = false);
     // text with arbitrary orientation
 
+void TextGLFrameStats(int x, int y, vec3 color = vec3(0, 0, 0), float scale = 1);
+    // on-screen display of GetGLFrameStats (GLXtras.h), one line per category, top line at y
+
 #endif
@@ -0,0 +1,40 @@
+// Trace.h - scoped CPU trace zones, written as Chrome trace-event JSON
+
+#ifndef TRACE_HDR
+#define TRACE_HDR
+
+#include <stddef.h>
+
+// TRACE_ZONE("name") times the enclosing scope; zones from all threads are written, on exit
+// or by TraceWrite, as JSON readable by chrome://tracing, ui.perfetto.dev or speedscope
+// each thread records into its own buffer, grown in small blocks, so recording takes no lock
+// while tracing is off (the default), a zone costs one test of a flag
+// define NO_TRACE to compile zones out entirely
+
+void TraceStart(const char *filename = "trace.json");
+	// enable tracing; the trace is written to filename at exit (unless TraceWrite called first)
+void TraceStop();
+	// disable tracing (zones already recorded are kept)
+bool Tracing();
+bool TraceWrite(const char *filename = NULL);
+	// write events recorded so far (filename null: as given to TraceStart); return false on error
+
+class TraceZone {
+public:
+	TraceZone(const char *name);
+		// name should be a string literal or otherwise outlive the trace
+	~TraceZone();
+private:
+	const char *name;
+	long long start;
+};
+
+#ifdef NO_TRACE
+#define TRACE_ZONE(name)
+#else
+#define TRACE_CAT2(a, b) a##b
+#define TRACE_CAT(a, b) TRACE_CAT2(a, b)
+#define TRACE_ZONE(name) TraceZone TRACE_CAT(traceZone, __LINE__)(name)
+#endif
+
+#endif // TRACE_HDR
@@ -0,0 +1,46 @@
+// Unprojector.h - map screen points to 3D, replaces gluUnProject
+
+#ifndef UNPROJECTOR_HDR
+#define UNPROJECTOR_HDR
+
+#include "VecMat.h"
+
+// an Unprojector holds the inverse of persp*modelview (computed in double precision,
+// as gluUnProject) and the viewport; build it once per camera change, then unproject
+// single points or batches (batches use SSE, four points at a time, where available)
+// zWindow is window depth, 0 (near) to 1 (far), as for gluUnProject
+
+class Unprojector {
+public:
+	Unprojector() { }
+	Unprojector(mat4 modelview, mat4 persp, const int *viewport = NULL) { Set(modelview, persp, viewport); }
+	bool Set(mat4 modelview, mat4 persp, const int *viewport = NULL);
+		// if viewport null, use current GL viewport
+		// return false if persp*modelview is singular
+	bool Update(mat4 modelview, mat4 persp, const int *viewport = NULL);
+		// as Set, but only if matrices or viewport differ from those last set; return Valid()
+	bool Valid() { return valid; }
+	vec3 Origin() { return origin; }
+		// ray origin used by Ray and Rays, the translation of modelview (as ScreenRay)
+	// single points
+	vec3 Unproject(float xscreen, float yscreen, float zWindow) const;
+	void Line(float xscreen, float yscreen, vec3 &p1, vec3 &p2) const;
+		// as ScreenLine: p1, p2 unprojected at window depths .25 and .5
+	void Ray(float xscreen, float yscreen, vec3 &p, vec3 &v) const;
+		// as ScreenRay: p is Origin(), v is unit direction of Line
+	// batches
+	void Unproject(int n, const vec2 *screen, float zWindow, vec3 *points) const;
+	void Rays(int n, const vec2 *screen, vec3 *dirs) const;
+		// set n unit directions, as Ray
+	void GridRays(int x, int y, int nx, int ny, vec3 *dirs, int step = 1) const;
+		// set nx*ny unit directions for pixels (x+i*step, y+j*step), row-major (i varies fastest)
+private:
+	bool valid = false;
+	int vp[4] = { 0, 0, 1, 1 };
+	mat4 modelview, persp;					// as last set, to detect change
+	float inv[4][4];						// inverse(persp*modelview), rounded to float
+	double dinv[4][4];						// as above, for single-point unprojection
+	vec3 origin;
+};
+
+#endif // UNPROJECTOR_HDR
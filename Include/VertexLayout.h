@@ -0,0 +1,47 @@
+// VertexLayout.h - declarative vertex formats, built once into cached vertex array objects
+
+#ifndef VERTEX_LAYOUT_HDR
+#define VERTEX_LAYOUT_HDR
+
+#include "glad.h"
+#include <initializer_list>
+#include <vector>
+
+// VertexAttribPointer (GLXtras.h) looks up an attribute by name and respecifies it on
+// whatever vertex array is bound, on every call; a VertexLayout instead describes all
+// attributes once, and GetVertexArray turns a buffer/layout pair into a VAO, so a draw
+// needs only glBindVertexArray
+
+struct VertexAttrib {
+	const char *name = NULL;				// resolved against program if location < 0
+	int location = -1;
+	int components = 3;
+	GLenum type = GL_FLOAT;
+	bool normalized = false;
+	int offset = 0, stride = 0;				// in bytes
+	int divisor = 0;						// if non-zero, advance per divisor instances
+	VertexAttrib() { }
+	VertexAttrib(const char *name, int components, GLenum type, bool normalized, int offset, int stride, int divisor = 0)
+		: name(name), components(components), type(type), normalized(normalized), offset(offset), stride(stride), divisor(divisor) { }
+	VertexAttrib(int location, int components, GLenum type, bool normalized, int offset, int stride, int divisor = 0)
+		: location(location), components(components), type(type), normalized(normalized), offset(offset), stride(stride), divisor(divisor) { }
+};
+
+class VertexLayout {
+public:
+	std::vector<VertexAttrib> attribs;
+	VertexLayout() { }
+	VertexLayout(std::initializer_list<VertexAttrib> list) : attribs(list) { }
+	VertexLayout &Add(VertexAttrib a) { attribs.push_back(a); return *this; }
+	GLuint Build(GLuint buffer, GLuint program = 0, GLuint indexBuffer = 0) const;
+		// return new VAO with attributes sourced from buffer (and indexBuffer, if non-zero)
+		// named attributes are located in program; those not found (eg, optimized away) are skipped
+};
+
+GLuint GetVertexArray(GLuint buffer, const VertexLayout &layout, GLuint program = 0, GLuint indexBuffer = 0);
+	// return VAO for the buffer/layout/program/index buffer combination, built on first request
+	// cache is keyed by layout address, so layout should be static or outlive its VAOs
+void ForgetVertexArrays(GLuint buffer);
+	// delete cached VAOs that use buffer (call before deleting buffer)
+
+#endif // VERTEX_LAYOUT_HDR
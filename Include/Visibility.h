@@ -0,0 +1,57 @@
+// Visibility.h - batched, asynchronous point visibility via depth-buffer readback
+
+#ifndef VISIBILITY_HDR
+#define VISIBILITY_HDR
+
+#include "glad.h"
+#include <vector>
+#include "VecMat.h"
+
+using std::vector;
+
+// IsVisible and DepthXY (Draw.h) stall the pipeline with a synchronous glReadPixels per call
+// VisibilityQuery reads, for a batch of points, the depth buffer region spanning the points
+// into a pixel-pack buffer; results are collected a frame or two later, once a fence signals
+// visibility test is the same as IsVisible: z < zbuffer+fudge (both in +/-1 space)
+
+class VisibilityQuery {
+public:
+	VisibilityQuery(int nSlots = 3) : slots(nSlots < 1? 1 : nSlots) { }
+		// the destructor makes no GL calls (the context may be gone): call Clear while it is current
+	void Submit(vec3 *points, int nPoints, mat4 fullview, float fudge = 0);
+	void Submit(vector<vec3> &points, mat4 fullview, float fudge = 0);
+		// call after depth buffer is complete for the frame (eg, after scene drawn, before labels)
+		// if all slots are pending, the oldest submission is discarded
+	bool Update(bool wait = false);
+		// if the oldest submission is complete, compute its results and return true
+		// if wait, block until the oldest submission completes (if any are pending)
+	int NResults() { return (int) visible.size(); }
+		// # points in the most recently completed submission
+	int Latency() { return latency; }
+		// # Submit calls between the completed submission and the latest one
+	bool Visible(int i) { return i >= 0 && i < (int) visible.size() && visible[i] != 0; }
+	float Depth(int i) { return i >= 0 && i < (int) depths.size()? depths[i] : 1; }
+		// z-buffer value at point i, normalized for +/-1 space (1 if off-screen)
+	vec2 Screen(int i) { return i >= 0 && i < (int) screens.size()? screens[i] : vec2(); }
+		// pixel location of point i when submitted
+	void Clear();
+		// discard pending submissions and results, free GPU buffers and fences (eg, before context destroyed)
+private:
+	struct Slot {
+		GLuint pbo = 0;
+		GLsync fence = 0;
+		int bufferSize = 0, serial = 0;
+		int x = 0, y = 0, w = 0, h = 0;		// depth-buffer region read
+		float fudge = 0;
+		vector<vec3> points;				// x, y: pixel location; z: depth, +/-1
+		vector<char> onScreen;
+	};
+	vector<Slot> slots;
+	int next = 0, nPending = 0, serial = 0, latency = 0;
+	vector<char> visible;
+	vector<float> depths;
+	vector<vec2> screens;
+	void Resolve(Slot &s);
+};
+
+#endif // VISIBILITY_HDR
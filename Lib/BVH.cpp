@@ -0,0 +1,452 @@
+// BVH.cpp - bounding volume hierarchy over mesh triangles, for ray picking and nearest-point queries
+
+#include "BVH.h"
+#include "Trace.h"
+#include <algorithm>
+#include <assert.h>
+#include <math.h>
+#include <thread>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define BVH_SSE
+#endif
+
+using std::vector;
+
+namespace {
+
+const int LeafSize = 4;						// split no further
+const int MaxLeafSize = 15;					// split even if SAH prefers a leaf
+const int NBins = 16;
+const int ParallelDepth = 2;				// subtrees of nodes this shallow built on own thread
+const int ParallelMinTriangles = 1 << 15;
+const int MaxSAHDepth = 40;					// below this, split at median
+const int MaxDepth = MaxSAHDepth+8*sizeof(int);	// each median-split level at least halves a range
+const int EmptyChild = ~0;					// leaf with no triangles
+
+struct Box {
+	vec3 min = vec3(FLT_MAX, FLT_MAX, FLT_MAX), max = vec3(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	void Grow(const vec3 &p) {
+		min = vec3(std::min(min.x, p.x), std::min(min.y, p.y), std::min(min.z, p.z));
+		max = vec3(std::max(max.x, p.x), std::max(max.y, p.y), std::max(max.z, p.z));
+	}
+	void Grow(const Box &b) { Grow(b.min); Grow(b.max); }
+	float Area() const {
+		vec3 d = max-min;
+		return d.x < 0? 0 : 2*(d.x*d.y+d.y*d.z+d.z*d.x);
+	}
+};
+
+struct Range {
+	int begin, end;
+	Box bounds;
+	bool leaf = false;						// SAH found no better split
+	int Count() const { return end-begin; }
+};
+
+int LeafChild(int first, int count) { return ~((first << 4) | count); }
+
+vec3 ClosestOnTriangle(const vec3 &p, const vec3 &a, const vec3 &b, const vec3 &c, float &u, float &v) {
+	// after Ericson, Real-Time Collision Detection, 5.1.5; u, v weights of b, c
+	vec3 ab = b-a, ac = c-a, ap = p-a;
+	float d1 = dot(ab, ap), d2 = dot(ac, ap);
+	if (d1 <= 0 && d2 <= 0) { u = v = 0; return a; }
+	vec3 bp = p-b;
+	float d3 = dot(ab, bp), d4 = dot(ac, bp);
+	if (d3 >= 0 && d4 <= d3) { u = 1; v = 0; return b; }
+	float vc = d1*d4-d3*d2;
+	if (vc <= 0 && d1 >= 0 && d3 <= 0) { u = d1/(d1-d3); v = 0; return a+u*ab; }
+	vec3 cp = p-c;
+	float d5 = dot(ab, cp), d6 = dot(ac, cp);
+	if (d6 >= 0 && d5 <= d6) { u = 0; v = 1; return c; }
+	float vb = d5*d2-d1*d6;
+	if (vb <= 0 && d2 >= 0 && d6 <= 0) { u = 0; v = d2/(d2-d6); return a+v*ac; }
+	float va = d3*d6-d5*d4;
+	if (va <= 0 && d4-d3 >= 0 && d5-d6 >= 0) {
+		float w = (d4-d3)/((d4-d3)+(d5-d6));
+		u = 1-w; v = w;
+		return b+w*(c-b);
+	}
+	float denom = 1/(va+vb+vc);
+	u = vb*denom; v = vc*denom;
+	return a+u*ab+v*ac;
+}
+
+int RayBoxes(const float *box, const float *o, const float *inv, float tMin, float tMax, float *tNear) {
+	// box is the six arrays of four floats at the start of a node (minX..maxZ)
+	// return mask of boxes hit within [tMin, tMax], set entry distances
+#ifdef BVH_SSE
+	__m128 lo, hi, tn = _mm_set1_ps(tMin), tf = _mm_set1_ps(tMax);
+	for (int a = 0; a < 3; a++) {
+		__m128 origin = _mm_set1_ps(o[a]), scale = _mm_set1_ps(inv[a]);
+		lo = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(box+4*a), origin), scale);
+		hi = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(box+4*(a+3)), origin), scale);
+		tn = _mm_max_ps(tn, _mm_min_ps(lo, hi));
+		tf = _mm_min_ps(tf, _mm_max_ps(lo, hi));
+	}
+	_mm_storeu_ps(tNear, tn);
+	return _mm_movemask_ps(_mm_cmple_ps(tn, tf));
+#else
+	int mask = 0;
+	for (int i = 0; i < 4; i++) {
+		float tn = tMin, tf = tMax;
+		for (int a = 0; a < 3; a++) {
+			float lo = (box[4*a+i]-o[a])*inv[a], hi = (box[4*(a+3)+i]-o[a])*inv[a];
+			tn = std::max(tn, std::min(lo, hi));
+			tf = std::min(tf, std::max(lo, hi));
+		}
+		tNear[i] = tn;
+		mask |= tn <= tf? 1 << i : 0;
+	}
+	return mask;
+#endif
+}
+
+int PointBoxes(const float *box, const vec3 &p, float maxD2, float *d2) {
+	// return mask of boxes within sqrt(maxD2) of p, set squared distances
+#ifdef BVH_SSE
+	__m128 zero = _mm_setzero_ps(), sum = zero;
+	const float *pf = &p.x;
+	for (int a = 0; a < 3; a++) {
+		__m128 c = _mm_set1_ps(pf[a]);
+		__m128 d = _mm_max_ps(zero, _mm_max_ps(_mm_sub_ps(_mm_loadu_ps(box+4*a), c), _mm_sub_ps(c, _mm_loadu_ps(box+4*(a+3)))));
+		sum = _mm_add_ps(sum, _mm_mul_ps(d, d));
+	}
+	_mm_storeu_ps(d2, sum);
+	return _mm_movemask_ps(_mm_cmple_ps(sum, _mm_set1_ps(maxD2)));
+#else
+	int mask = 0;
+	const float *pf = &p.x;
+	for (int i = 0; i < 4; i++) {
+		float sum = 0;
+		for (int a = 0; a < 3; a++) {
+			float d = std::max(0.f, std::max(box[4*a+i]-pf[a], pf[a]-box[4*(a+3)+i]));
+			sum += d*d;
+		}
+		d2[i] = sum;
+		mask |= sum <= maxD2? 1 << i : 0;
+	}
+	return mask;
+#endif
+}
+
+struct StackEntry {
+	int node;
+	float distance;							// lower bound on t (ray) or squared distance (point)
+};
+
+const int StackSize = 3*MaxDepth+1;			// each level pops one entry, pushes up to four
+static_assert(StackSize >= 3*(MaxSAHDepth+8*(int) sizeof(int))+1, "traversal stack smaller than deepest tree needs");
+
+int PushChildren(StackEntry *stack, int n, const int *child, int mask, const float *distance) {
+	// push hit children, farthest first, so nearest is popped first
+	StackEntry hits[4];
+	int nHits = 0;
+	for (int i = 0; i < 4; i++)
+		if ((mask >> i) & 1 && child[i] != EmptyChild)
+			hits[nHits++] = { child[i], distance[i] };
+	std::sort(hits, hits+nHits, [](const StackEntry &a, const StackEntry &b) { return a.distance > b.distance; });
+	assert(n+nHits <= StackSize);
+	for (int i = 0; i < nHits; i++)
+		stack[n++] = hits[i];
+	return n;
+}
+
+} // end namespace
+
+// Build
+
+struct BVHBuilder {
+	BVH &bvh;
+	vector<Box> boxes;						// per triangle
+	vector<vec3> centers;
+	vector<int> order;						// triangle ids, partitioned into leaves
+	BVHBuilder(BVH &bvh) : bvh(bvh) { }
+	Box Bounds(int begin, int end) {
+		Box b;
+		for (int i = begin; i < end; i++)
+			b.Grow(boxes[order[i]]);
+		return b;
+	}
+	int Split(Range &r, bool sah) {
+		// return partition point of r by binned SAH, or -1 if a leaf is cheaper (forced split if too large)
+		// if !sah, split at median (halving r, so bounding tree depth)
+		int count = r.Count();
+		Box centerBounds;
+		for (int i = r.begin; i < r.end; i++)
+			centerBounds.Grow(centers[order[i]]);
+		float bestCost = FLT_MAX;
+		int bestAxis = -1, bestBin = 0;
+		for (int axis = 0; sah && axis < 3; axis++) {
+			float lo = (&centerBounds.min.x)[axis], extent = (&centerBounds.max.x)[axis]-lo;
+			if (extent <= 0)
+				continue;
+			Box bins[NBins];
+			int counts[NBins] = { 0 };
+			float scale = NBins/extent;
+			for (int i = r.begin; i < r.end; i++) {
+				int t = order[i], b = std::min(NBins-1, (int) (((&centers[t].x)[axis]-lo)*scale));
+				bins[b].Grow(boxes[t]);
+				counts[b]++;
+			}
+			// sweep from right for suffix areas, then from left
+			float rightArea[NBins];
+			int rightCount[NBins];
+			Box right;
+			for (int b = NBins-1, n = 0; b > 0; b--) {
+				right.Grow(bins[b]);
+				n += counts[b];
+				rightArea[b] = right.Area();
+				rightCount[b] = n;
+			}
+			Box left;
+			for (int b = 1, n = 0; b < NBins; b++) {
+				left.Grow(bins[b-1]);
+				n += counts[b-1];
+				float cost = left.Area()*n+rightArea[b]*rightCount[b];
+				if (n && rightCount[b] && cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestBin = b;
+				}
+			}
+		}
+		float leafCost = r.bounds.Area()*count;
+		if (bestAxis < 0 || bestCost >= leafCost) {
+			if (count <= MaxLeafSize)
+				return -1;
+			// centroids coincide or SAH prefers leaf, but too many triangles: split at median
+			vec3 d = r.bounds.max-r.bounds.min;
+			int axis = d.x > d.y? (d.x > d.z? 0 : 2) : (d.y > d.z? 1 : 2), mid = (r.begin+r.end)/2;
+			std::nth_element(order.begin()+r.begin, order.begin()+mid, order.begin()+r.end,
+				[this, axis](int a, int b) { return (&centers[a].x)[axis] < (&centers[b].x)[axis]; });
+			return mid;
+		}
+		float lo = (&centerBounds.min.x)[bestAxis], scale = NBins/((&centerBounds.max.x)[bestAxis]-lo);
+		int *mid = std::partition(order.data()+r.begin, order.data()+r.end, [&](int t) {
+			return std::min(NBins-1, (int) (((&centers[t].x)[bestAxis]-lo)*scale)) < bestBin; });
+		return (int) (mid-order.data());
+	}
+	int BuildNode(Range r, vector<BVH::Node> &nodes, int depth) {
+		// split r into up to four children, always dividing the child of largest area; return node index
+		vector<Range> children(1, r);
+		while (children.size() < 4) {
+			int pick = -1;
+			for (size_t i = 0; i < children.size(); i++)
+				if (!children[i].leaf && children[i].Count() > LeafSize &&
+					(pick < 0 || children[i].bounds.Area() > children[pick].bounds.Area()))
+					pick = (int) i;
+			if (pick < 0)
+				break;
+			Range &c = children[pick];
+			int mid = Split(c, depth < MaxSAHDepth);
+			if (mid < 0) {
+				c.leaf = true;
+				continue;
+			}
+			Range a = { c.begin, mid, Bounds(c.begin, mid), false }, b = { mid, c.end, Bounds(mid, c.end), false };
+			children[pick] = a;
+			children.push_back(b);
+		}
+		int index = (int) nodes.size();
+		nodes.push_back(BVH::Node());
+		vector<std::thread> threads;
+		vector<vector<BVH::Node>> subtrees(children.size());
+		for (int i = 0; i < 4; i++) {
+			BVH::Node &n = nodes[index];
+			Box b = i < (int) children.size()? children[i].bounds : Box();
+			n.minX[i] = b.min.x; n.minY[i] = b.min.y; n.minZ[i] = b.min.z;
+			n.maxX[i] = b.max.x; n.maxY[i] = b.max.y; n.maxZ[i] = b.max.z;
+			n.child[i] = EmptyChild;
+			if (i >= (int) children.size())
+				continue;
+			Range &c = children[i];
+			if (c.leaf || c.Count() <= LeafSize)
+				n.child[i] = LeafChild(c.begin, c.Count());
+			else if (depth < ParallelDepth && c.Count() >= ParallelMinTriangles)
+				threads.push_back(std::thread([this, c, depth, &subtrees, i]() { BuildNode(c, subtrees[i], depth+1); }));
+			else {
+				int child = BuildNode(c, nodes, depth+1);	// may reallocate nodes
+				nodes[index].child[i] = child;
+			}
+		}
+		for (std::thread &t : threads)
+			t.join();
+		// append subtrees built in parallel, offsetting their node indices
+		for (size_t i = 0; i < subtrees.size(); i++)
+			if (subtrees[i].size()) {
+				int offset = (int) nodes.size();
+				for (BVH::Node &n : subtrees[i]) {
+					for (int k = 0; k < 4; k++)
+						n.child[k] += n.child[k] >= 0? offset : 0;
+					nodes.push_back(n);
+				}
+				nodes[index].child[i] = offset;
+			}
+		return index;
+	}
+};
+
+void BVH::Clear() {
+	nodes.resize(0);
+	vertices.resize(0);
+	ids.resize(0);
+}
+
+void BVH::Build(const vector<vec3> &points, const vector<int3> &triangles) {
+	TRACE_ZONE("BVH::Build");
+	Clear();
+	int nTriangles = (int) triangles.size();
+	if (!nTriangles)
+		return;
+	BVHBuilder b(*this);
+	b.boxes.resize(nTriangles);
+	b.centers.resize(nTriangles);
+	b.order.resize(nTriangles);
+	for (int i = 0; i < nTriangles; i++) {
+		const int3 &t = triangles[i];
+		Box &box = b.boxes[i];
+		box.Grow(points[t.i1]);
+		box.Grow(points[t.i2]);
+		box.Grow(points[t.i3]);
+		b.centers[i] = .5f*(box.min+box.max);
+		b.order[i] = i;
+	}
+	Range root = { 0, nTriangles, b.Bounds(0, nTriangles), false };
+	b.BuildNode(root, nodes, 0);
+	// triangles in leaf order
+	vertices.resize(3*nTriangles);
+	ids = b.order;
+	for (int i = 0; i < nTriangles; i++) {
+		const int3 &t = triangles[ids[i]];
+		vertices[3*i] = points[t.i1];
+		vertices[3*i+1] = points[t.i2];
+		vertices[3*i+2] = points[t.i3];
+	}
+}
+
+// Queries
+
+BVHHit BVH::Nearest(vec3 o, vec3 d, float tMin, float tMax) const {
+	BVHHit hit;
+	if (nodes.empty())
+		return hit;
+	float inv[] = { 1/d.x, 1/d.y, 1/d.z }, tNear[4];
+	StackEntry stack[StackSize];
+	int n = 0;
+	stack[n++] = { 0, tMin };
+	while (n > 0) {
+		StackEntry e = stack[--n];
+		if (e.distance > tMax)
+			continue;						// nearer hit found since pushed
+		if (e.node >= 0) {
+			const Node &node = nodes[e.node];
+			int mask = RayBoxes(node.minX, &o.x, inv, tMin, tMax, tNear);
+			n = PushChildren(stack, n, node.child, mask, tNear);
+			continue;
+		}
+		int first = (~e.node) >> 4, count = (~e.node) & 15;
+		for (int i = first; i < first+count; i++) {
+			// Moller-Trumbore, two-sided
+			const vec3 &v0 = vertices[3*i], e1 = vertices[3*i+1]-v0, e2 = vertices[3*i+2]-v0;
+			vec3 p = cross(d, e2);
+			float det = dot(e1, p);
+			if (det == 0)
+				continue;
+			float invDet = 1/det;
+			vec3 s = o-v0;
+			float u = dot(s, p)*invDet;
+			if (u < 0 || u > 1)
+				continue;
+			vec3 q = cross(s, e1);
+			float v = dot(d, q)*invDet;
+			if (v < 0 || u+v > 1)
+				continue;
+			float t = dot(e2, q)*invDet;
+			if (t < tMin || t > tMax)
+				continue;
+			tMax = t;
+			hit.triangle = ids[i];
+			hit.t = t;
+			hit.u = u;
+			hit.v = v;
+		}
+	}
+	if (hit.triangle >= 0)
+		hit.point = o+hit.t*d;
+	return hit;
+}
+
+bool BVH::Any(vec3 o, vec3 d, float tMin, float tMax) const {
+	if (nodes.empty())
+		return false;
+	float inv[] = { 1/d.x, 1/d.y, 1/d.z }, tNear[4];
+	StackEntry stack[StackSize];
+	int n = 0;
+	stack[n++] = { 0, tMin };
+	while (n > 0) {
+		int node = stack[--n].node;
+		if (node >= 0) {
+			const Node &nd = nodes[node];
+			int mask = RayBoxes(nd.minX, &o.x, inv, tMin, tMax, tNear);
+			n = PushChildren(stack, n, nd.child, mask, tNear);
+			continue;
+		}
+		int first = (~node) >> 4, count = (~node) & 15;
+		for (int i = first; i < first+count; i++) {
+			const vec3 &v0 = vertices[3*i], e1 = vertices[3*i+1]-v0, e2 = vertices[3*i+2]-v0;
+			vec3 p = cross(d, e2);
+			float det = dot(e1, p);
+			if (det == 0)
+				continue;
+			float invDet = 1/det;
+			vec3 s = o-v0;
+			float u = dot(s, p)*invDet;
+			if (u < 0 || u > 1)
+				continue;
+			vec3 q = cross(s, e1);
+			float v = dot(d, q)*invDet, t = dot(e2, q)*invDet;
+			if (v >= 0 && u+v <= 1 && t >= tMin && t <= tMax)
+				return true;
+		}
+	}
+	return false;
+}
+
+BVHHit BVH::Closest(vec3 p, float maxDistance) const {
+	BVHHit hit;
+	if (nodes.empty())
+		return hit;
+	float best = maxDistance < FLT_MAX? maxDistance*maxDistance : FLT_MAX, d2[4];
+	StackEntry stack[StackSize];
+	int n = 0;
+	stack[n++] = { 0, 0 };
+	while (n > 0) {
+		StackEntry e = stack[--n];
+		if (e.distance > best)
+			continue;
+		if (e.node >= 0) {
+			const Node &node = nodes[e.node];
+			int mask = PointBoxes(node.minX, p, best, d2);
+			n = PushChildren(stack, n, node.child, mask, d2);
+			continue;
+		}
+		int first = (~e.node) >> 4, count = (~e.node) & 15;
+		for (int i = first; i < first+count; i++) {
+			float u, v;
+			vec3 c = ClosestOnTriangle(p, vertices[3*i], vertices[3*i+1], vertices[3*i+2], u, v), dp = c-p;
+			float dd = dot(dp, dp);
+			if (dd <= best) {
+				best = dd;
+				hit.triangle = ids[i];
+				hit.point = c;
+				hit.u = u;
+				hit.v = v;
+			}
+		}
+	}
+	if (hit.triangle >= 0)
+		hit.t = sqrt(best);
+	return hit;
+}
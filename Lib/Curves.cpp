@@ -0,0 +1,122 @@
+// Curves.cpp - cubic Bezier curves evaluated on the GPU, all drawn with one call
+
+#include <glad.h>
+#include "Curves.h"
+#include "Draw.h"
+#include "GLXtras.h"
+#include <vector>
+
+namespace {
+
+GLuint curveShader = 0;
+
+// texels per curve: 4 control points (xyz, 1), color (rgb, 1)
+const int TexelsPerCurve = 5;
+
+const char *curveVShader = R"(
+	#version 330
+	uniform samplerBuffer curves;
+	uniform mat4 fullview;
+	uniform vec2 viewportSize;
+	uniform float pixelsPerSegment = 5;
+	uniform int maxRes = 64;
+	out vec3 vColor;
+	vec2 Screen(vec4 h) {
+		return .5*viewportSize*h.xy/h.w;
+	}
+	void main() {
+		int base = 5*gl_InstanceID;
+		vec3 b1 = texelFetch(curves, base).xyz, b2 = texelFetch(curves, base+1).xyz;
+		vec3 b3 = texelFetch(curves, base+2).xyz, b4 = texelFetch(curves, base+3).xyz;
+		vColor = texelFetch(curves, base+4).rgb;
+		vec4 h1 = fullview*vec4(b1, 1), h2 = fullview*vec4(b2, 1);
+		vec4 h3 = fullview*vec4(b3, 1), h4 = fullview*vec4(b4, 1);
+		// resolution from projected length of control polygon (full res if any point behind eye)
+		int res = maxRes;
+		if (pixelsPerSegment > 0 && min(min(h1.w, h2.w), min(h3.w, h4.w)) > 0) {
+			vec2 s1 = Screen(h1), s2 = Screen(h2), s3 = Screen(h3), s4 = Screen(h4);
+			float len = distance(s1, s2)+distance(s2, s3)+distance(s3, s4);
+			res = clamp(int(ceil(len/pixelsPerSegment)), 1, maxRes);
+		}
+		// vertices beyond res collapse onto the curve end
+		float t = float(min(gl_VertexID, res))/float(res), T = 1-t;
+		vec4 w = vec4(T*T*T, 3*t*T*T, 3*t*t*T, t*t*t);
+		gl_Position = w.x*h1+w.y*h2+w.z*h3+w.w*h4;
+			// Bezier is affine invariant, so blend transformed control points
+	}
+)";
+
+const char *curvePShader = R"(
+	#version 330
+	in vec3 vColor;
+	out vec4 pColor;
+	uniform float opacity = 1;
+	void main() {
+		pColor = vec4(vColor, opacity);
+	}
+)";
+
+} // end namespace
+
+void BuildCurveShader() {
+	if (!curveShader)
+		curveShader = LinkProgramDeferred(&curveVShader, &curvePShader);
+}
+
+BezierCurves::~BezierCurves() {
+	if (buffer) {
+		glDeleteTextures(1, &texture);
+		glDeleteBuffers(1, &buffer);
+		glDeleteVertexArrays(1, &vao);
+	}
+}
+
+void BezierCurves::Set(int n, vec3 *ctrlPts, vec3 *colors, vec3 color) {
+	std::vector<vec4> texels(n*TexelsPerCurve);
+	for (int i = 0; i < n; i++) {
+		vec4 *t = &texels[i*TexelsPerCurve];
+		for (int k = 0; k < 4; k++)
+			t[k] = vec4(ctrlPts[4*i+k], 1);
+		t[4] = vec4(colors? colors[i] : color, 1);
+	}
+	if (!buffer) {
+		glGenBuffers(1, &buffer);
+		glGenTextures(1, &texture);
+		glGenVertexArrays(1, &vao);			// no attributes, but core profile requires a vertex array
+	}
+	int size = texels.size()*sizeof(vec4);
+	glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+	if (n > capacity) {
+		glBufferData(GL_TEXTURE_BUFFER, size, texels.data(), GL_DYNAMIC_DRAW);
+		capacity = n;
+	}
+	else if (size)
+		glBufferSubData(GL_TEXTURE_BUFFER, 0, size, texels.data());
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	nCurves = n;
+}
+
+void BezierCurves::Display(mat4 fullview, float width, float opacity, float pixelsPerSegment, int maxRes) {
+	if (!nCurves)
+		return;
+	BuildCurveShader();
+	if (ProgramPending(curveShader))
+		FinishProgram(curveShader);
+	int vpWidth, vpHeight;
+	GetViewportSize(vpWidth, vpHeight);
+	glUseProgram(curveShader);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_BUFFER, texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer);
+	SetUniform(curveShader, "curves", 0);
+	SetUniform(curveShader, "fullview", fullview);
+	SetUniform(curveShader, "viewportSize", vec2((float) vpWidth, (float) vpHeight));
+	SetUniform(curveShader, "pixelsPerSegment", pixelsPerSegment);
+	SetUniform(curveShader, "maxRes", maxRes < 1? 1 : maxRes);
+	SetUniform(curveShader, "opacity", opacity);
+	glLineWidth(width);
+	glBindVertexArray(vao);
+	glDrawArraysInstanced(GL_LINE_STRIP, 0, (maxRes < 1? 1 : maxRes)+1, nCurves);
+	glBindVertexArray(0);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+}
@@ -1,10 +1,12 @@
 // Draw.cpp - various draw operations (c) 2019-2022 Jules Bloomenthal
 
 #include <glad.h>
-#include <gl/glu.h>
 #include "Draw.h"
+#include "GLState.h"
 #include "GLXtras.h"
 #include "Misc.h"
+#include "Unprojector.h"
+#include "VertexLayout.h"
 #include <float.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,28 +16,26 @@
 
 void GetViewportSize(int &width, int &height) {
 	int vp[4];
-	glGetIntegerv(GL_VIEWPORT, vp);
+	GetGLViewport(vp);
 	width = vp[2];
 	height = vp[3];
 }
 
 vec4 VP() {
-	vec4 vp;
-	glGetFloatv(GL_VIEWPORT, (float *) &vp);
-	return vp;
+	int vp[4];
+	GetGLViewport(vp);
+	return vec4((float) vp[0], (float) vp[1], (float) vp[2], (float) vp[3]);
 }
 
 mat4 Viewport() {
 	// map +/-1 space to screen space viewport
-	float vp[4];
-	glGetFloatv(GL_VIEWPORT, vp);
+	vec4 vp = VP();
 	float x = vp[0], y = vp[1], w = vp[2], h = vp[3];
 	return mat4(vec4(w/2,0,0,x+w/2), vec4(0,h/2,0,y+h/2), vec4(0,0,1,0), vec4(0,0,0,1));
 }
 
 mat4 ScreenMode() {
-	float vp[4];
-	glGetFloatv(GL_VIEWPORT, vp);
+	vec4 vp = VP();
 	mat4 scale = Scale(2.f/(float)vp[2], 2.f/(float)vp[3], 1);
 	mat4 tran = Translate(-2*vp[0]/vp[2]-1, -2*vp[1]/vp[3]-1, 0);
 //	mat4 tran = Translate(.5f*vp[0]/vp[2]-1, vp[1]/vp[3]-1, 0);
@@ -45,7 +45,7 @@ mat4 ScreenMode() {
 
 vec2 ScreenPoint(vec3 p, mat4 m, float *zscreen) {
 	int vp[4];
-	glGetIntegerv(GL_VIEWPORT, vp);
+	GetGLViewport(vp);
 	vec4 xp = m*vec4(p, 1);
 	if (zscreen)
 		*zscreen = xp.z; // /xp.w;
@@ -73,9 +73,9 @@ bool IsVisible(vec3 p, mat4 fullview, vec2 *screenA, int *w, int *h, float fudge
 }
 
 bool DepthXY(int x, int y, float &depth) {
-	if (glIsEnabled(GL_DEPTH_TEST)) {
+	if (GLEnabled(GL_DEPTH_TEST)) {
 		float v, depthRange[2]; // depthRange maps to window coordinates +/-1
-		glGetFloatv(GL_DEPTH_RANGE, depthRange);
+		GetGLDepthRange(depthRange);
 		glReadPixels(x, y, 1, 1, GL_DEPTH_COMPONENT, GL_FLOAT, &v);
 		depth = -1+2*(v-depthRange[0])/(depthRange[1]-depthRange[0]);
 		return true;
@@ -96,48 +96,27 @@ float ScreenDistSq(double x, double y, vec3 p, mat4 m, float *zscreen) {
 	return static_cast<float>(dx*dx+dy*dy);
 }
 
+namespace {
+
+Unprojector screenUnprojector; // rebuilt only when matrices or viewport change
+
+} // end namespace
+
 void ScreenRay(float xscreen, float yscreen, mat4 modelview, mat4 persp, vec3 &p, vec3 &v) {
 	// compute ray from p in direction v; p is transformed eyepoint, xscreen, yscreen determine v
-	int vp[4];
-	glGetIntegerv(GL_VIEWPORT, vp);
-	// origin of ray is always eye (translated origin)
-	p = vec3(modelview[0][3], modelview[1][3], modelview[2][3]);
-	// create transposes for gluUnproject
-	double tpersp[4][4], tmodelview[4][4], a[3], b[3];
-	for (int i = 0; i < 4; i++)
-		for (int j = 0; j < 4; j++) {
-			tmodelview[i][j] = modelview[j][i];
-			tpersp[i][j] = persp[j][i];
-		}
-	// un-project two screen points of differing depth to determine v
-	if (gluUnProject(xscreen, yscreen, .25, (const double*) tmodelview, (const double*) tpersp, vp, &a[0], &a[1], &a[2]) == GL_FALSE)
+	if (!screenUnprojector.Update(modelview, persp))
 		printf("UnProject false\n");
-	if (gluUnProject(xscreen, yscreen, .50, (const double*) tmodelview, (const double*) tpersp, vp, &b[0], &b[1], &b[2]) == GL_FALSE)
-		printf("UnProject false\n");
-	v = normalize(vec3((float) (b[0]-a[0]), (float) (b[1]-a[1]), (float) (b[2]-a[2])));
+	screenUnprojector.Ray(xscreen, yscreen, p, v);
 }
 
 void ScreenLine(float xscreen, float yscreen, mat4 modelview, mat4 persp, vec3 &p1, vec3 &p2) {
 	// compute 3D world space line, given by p1 and p2, that transforms
 	// to a line perpendicular to the screen at (xscreen, yscreen)
-	double tpersp[4][4], tmodelview[4][4], a[3], b[3];
-	// get viewport
-	int vp[4];
-	glGetIntegerv(GL_VIEWPORT, vp);
-	// create transposes
-	for (int i = 0; i < 4; i++)
-		for (int j = 0; j < 4; j++) {
-			tmodelview[i][j] = modelview[j][i];
-			tpersp[i][j] = persp[j][i];
-		}
-	if (gluUnProject(xscreen, yscreen, .25, (const double*) tmodelview, (const double*) tpersp, vp, &a[0], &a[1], &a[2]) == GL_FALSE)
-		printf("UnProject false\n");
-	if (gluUnProject(xscreen, yscreen, .50, (const double*) tmodelview, (const double*) tpersp, vp, &b[0], &b[1], &b[2]) == GL_FALSE)
+	if (!screenUnprojector.Update(modelview, persp))
 		printf("UnProject false\n");
+	screenUnprojector.Line(xscreen, yscreen, p1, p2);
 		// alternatively, a seond point can be determined by transforming the origin by the inverse of modelview
 		// this would yield in world space the camera location, through which all view lines pass
-	p1 = vec3(static_cast<float>(a[0]), static_cast<float>(a[1]), static_cast<float>(a[2]));
-	p2 = vec3(static_cast<float>(b[0]), static_cast<float>(b[1]), static_cast<float>(b[2]));
 }
 
 bool FrontFacing(vec3 base, vec3 vec, mat4 view) {
@@ -163,7 +142,7 @@ const char *drawVShader = R"(
 	in vec3 position;
 	in vec3 color;
 	out vec3 vColor;
-	uniform mat4 view;
+	uniform mat4 view = mat4(1);
 	void main() {
 		gl_Position = view*vec4(position, 1);
 		vColor = color;
@@ -209,14 +188,12 @@ const char *drawPShader = R"(
 )";
 
 int UseDrawShader() {
-	int was = 0;
-	glGetIntegerv(GL_CURRENT_PROGRAM, &was);
-	bool init = !drawShader;
-	if (init)
-		drawShader = LinkProgramViaCode(&drawVShader, &drawPShader);
+	int was = GetGLProgram();
+	if (!drawShader)
+		drawShader = LinkProgramDeferred(&drawVShader, &drawPShader);	// see BuildDrawShaders
+	if (ProgramPending(drawShader))
+		FinishProgram(drawShader);
 	glUseProgram(drawShader);
-	if (init)
-		SetUniform(drawShader, "view", mat4());
 	return was;
 }
 
@@ -226,9 +203,32 @@ int UseDrawShader(mat4 viewMatrix) {
 	return was;
 }
 
+// draw primitives each own a buffer of interleaved position, color and a VAO built from it
+
+namespace {
+
+struct DrawVertex { vec3 position, color; };
+
+const VertexLayout drawLayout = {
+	{ "position", 3, GL_FLOAT, false, 0, sizeof(DrawVertex) },
+	{ "color", 3, GL_FLOAT, false, sizeof(vec3), sizeof(DrawVertex) } };
+
+void BindDrawVertices(GLuint &buffer, GLuint &vao, int nVertices, DrawVertex *vertices) {
+	// make buffer and VAO on first use, bind VAO, load vertices (call after UseDrawShader)
+	if (!vao) {
+		glGenBuffers(1, &buffer);
+		vao = GetVertexArray(buffer, drawLayout, drawShader);
+	}
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	glBufferData(GL_ARRAY_BUFFER, nVertices*sizeof(DrawVertex), vertices, GL_STREAM_DRAW);
+}
+
+} // end namespace
+
 // Disks
 
-GLuint diskBuffer = -1;
+GLuint diskBuffer = 0, diskVao = 0;
 
 void Disk(vec2 p, float diameter, vec3 color, float opacity, bool ring) {
 	Disk(vec3(p), diameter, color, opacity, ring);
@@ -237,21 +237,9 @@ void Disk(vec2 p, float diameter, vec3 color, float opacity, bool ring) {
 void Disk(vec3 p, float diameter, vec3 color, float opacity, bool ring) {
 	// diameter should be >= 0, <= 20
 	UseDrawShader();
-	// create buffer for single vertex (x,y,z,r,g,b)
-	if (diskBuffer < 0) {
-		glGenBuffers(1, &diskBuffer);
-		glBindBuffer(GL_ARRAY_BUFFER, diskBuffer);
-		int bufferSize = 6*sizeof(float);
-		glBufferData(GL_ARRAY_BUFFER, bufferSize, NULL, GL_STATIC_DRAW);
-	}
-	glBindBuffer(GL_ARRAY_BUFFER, diskBuffer); // set active buffer
-	// allocate buffer memory and load location and color data
-	glBufferData(GL_ARRAY_BUFFER, 6*sizeof(float), NULL, GL_STATIC_DRAW); // *** needed??
-	glBufferSubData(GL_ARRAY_BUFFER, 0, 3*sizeof(float), &p.x);
-	glBufferSubData(GL_ARRAY_BUFFER, 3*sizeof(float), 3*sizeof(float), &color.x);
-	// connect shader inputs
-	VertexAttribPointer(drawShader, "position", 3, 0, (void *) 0);
-	VertexAttribPointer(drawShader, "color", 3, 0, (void *) sizeof(vec3));
+	// single vertex (x,y,z,r,g,b)
+	DrawVertex v = { p, color };
+	BindDrawVertices(diskBuffer, diskVao, 1, &v);
 	// draw
 	SetUniform(drawShader, "opacity", opacity);
 	SetUniform(drawShader, "ring", ring);
@@ -267,31 +255,26 @@ void Disk(vec3 p, float diameter, vec3 color, float opacity, bool ring) {
 	SetUniform(drawShader, "fadeToCenter", 1); // needed if GL_POINT_SMOOTH and GL_POINT_SPRITE fail
 #endif
 	glDrawArrays(GL_POINTS, 0, 1);
+	glBindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
 // Lines
 
-GLuint lineBuffer = -1;
+GLuint lineBuffer = 0, lineVao = 0;
 
 void Line(vec3 p1, vec3 p2, float width, vec3 col1, vec3 col2, float opacity) {
 	UseDrawShader();
-	// create a vertex buffer for the array
-	vec3 data[] = {p1, p2, col1, col2};
-	if (lineBuffer <= 0)
-		glGenBuffers(1, &lineBuffer);
-	// set active vertex buffer, load location and color data
-	glBindBuffer(GL_ARRAY_BUFFER, lineBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
-	// connect shader inputs, set uniforms
-	VertexAttribPointer(drawShader, "position", 3, 0, (void *) 0);
-	VertexAttribPointer(drawShader, "color", 3, 0, (void *) (2*sizeof(vec3)));
+	// load location and color data, set uniforms
+	DrawVertex data[] = { {p1, col1}, {p2, col2} };
+	BindDrawVertices(lineBuffer, lineVao, 2, data);
 	SetUniform(drawShader, "fadeToCenter", 0);  // gl_PointCoord fails for lines (instead, use GL_LINE_SMOOTH)
 	SetUniform(drawShader, "opacity", opacity);
 	// draw
 	glLineWidth(width);
 	glDrawArrays(GL_LINES, 0, 2);
 	// cleanup
+	glBindVertexArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
@@ -339,49 +322,38 @@ void LineDot(vec3 p1, vec3 p2, mat4 view, float width, vec3 col, float opacity)
 	}
 }
 
-GLuint lineStripBuffer = 0;
+GLuint lineStripBuffer = 0, lineStripVao = 0;
 
 void LineStrip(int nPoints, vec3 *points, vec3 &color, float opacity, float width) {
-	if (!lineStripBuffer)
-		glGenBuffers(1, &lineStripBuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, lineStripBuffer);
-	int pSize = nPoints*sizeof(vec3);
-	std::vector<vec3> colors(nPoints, color);
-	glBufferData(GL_ARRAY_BUFFER, 2*pSize, NULL, GL_STATIC_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, pSize, points);
-	glBufferSubData(GL_ARRAY_BUFFER, pSize, pSize, &colors[0]);
-	VertexAttribPointer(drawShader, "position", 3, 0, (void *) 0);
-	VertexAttribPointer(drawShader, "color", 3, 0, (void *) pSize);
+	// draw shader already in use, its view set by the caller
+	std::vector<DrawVertex> vertices(nPoints);
+	for (int i = 0; i < nPoints; i++)
+		vertices[i] = { points[i], color };
+	BindDrawVertices(lineStripBuffer, lineStripVao, nPoints, vertices.data());
 	SetUniform(drawShader, "fadeToCenter", 0);
 	SetUniform(drawShader, "opacity", opacity);
 	glLineWidth(width);
 	glDrawArrays(GL_LINE_STRIP, 0, nPoints);
+	glBindVertexArray(0);
 }
 
 // Quads
 
-GLuint quadBuffer = 0;
+GLuint quadBuffer = 0, quadVao = 0;
 
 void Quad(vec3 p1, vec3 p2, vec3 p3, vec3 p4, bool solid, vec3 col, float opacity, float lineWidth) {
 #ifndef GL_QUADS
 	Triangle(p1, p2, p3, col, col, col, opacity, !solid, col, lineWidth);
 	Triangle(p1, p3, p4, col, col, col, opacity, !solid, col, lineWidth);
 #else
-	vec3 data[] = { p1, p2, p3, p4, col, col, col, col };
+	DrawVertex data[] = { {p1, col}, {p2, col}, {p3, col}, {p4, col} };
 	UseDrawShader();
-	if (quadBuffer == 0) {
-		glGenBuffers(1, &quadBuffer);
-		glBindBuffer(GL_ARRAY_BUFFER, quadBuffer);
-		glBufferData(GL_ARRAY_BUFFER, sizeof(data), NULL, GL_STATIC_DRAW);
-	}
-	glBindBuffer(GL_ARRAY_BUFFER, quadBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
-	VertexAttribPointer(drawShader, "position", 3, 0, (void *) 0);
-	VertexAttribPointer(drawShader, "color", 3, 0, (void *) (4*sizeof(vec3)));
+	BindDrawVertices(quadBuffer, quadVao, 4, data);
 	SetUniform(drawShader, "opacity", opacity);
 	SetUniform(drawShader, "fadeToCenter", 0);
 	glLineWidth(lineWidth);
 	glDrawArrays(solid? GL_QUADS : GL_LINE_LOOP, 0, 4);
+	glBindVertexArray(0);
 #endif
 }
 
@@ -448,68 +420,77 @@ void ArrowV(vec3 base, vec3 v, mat4 modelview, mat4 persp, vec3 col, float lineW
 
 GLuint cylinderShader = 0;
 
-void Cylinder(vec3 p1, vec3 p2, float r1, float r2, mat4 modelview, mat4 persp, vec4 color) {
-	const char *vShader = "void main() { gl_Position = vec4(0); }";
-	const char *tcShader = R"(
-		#version 400 core
-		layout (vertices = 4) out;
-		void main() {
-			if (gl_InvocationID == 0) {
-				gl_TessLevelOuter[0] = gl_TessLevelOuter[2] = 1;
-				gl_TessLevelOuter[1] = gl_TessLevelOuter[3] = 24;
-				gl_TessLevelInner[0] = gl_TessLevelInner[1] = 24;
-			}
-		}
-	)";
-	const char *teShader = R"(
-		#version 400 core
-		layout (quads, equal_spacing, ccw) in;
-		uniform vec3 p1;
-		uniform vec3 p2;
-		uniform float r1;
-		uniform float r2;
-		uniform mat4 modelview;
-		uniform mat4 persp;
-		out vec3 tePoint;
-		out vec3 teNormal;
-		void main() {
-			vec2 uv = gl_TessCoord.st;
-			float c = cos(2*3.1415*uv.s), s = sin(2*3.1415*uv.s);
-			vec3 dp = p2-p1;
-			vec3 crosser = dp.x < dp.y? (dp.x < dp.z? vec3(1,0,0) : vec3(0,0,1)) : (dp.y < dp.z? vec3(0,1,0) : vec3(0,0,1));
-			vec3 xcross = normalize(cross(crosser, dp));
-			vec3 ycross = normalize(cross(xcross, dp));
-			vec3 n = c*xcross+s*ycross;
-			vec3 p = mix(p1, p2, uv.t)+mix(r1, r2, uv.t)*n;
-			tePoint = (modelview*vec4(p, 1)).xyz;
-			teNormal = (modelview*vec4(n, 0)).xyz;
-			gl_Position = persp*vec4(tePoint, 1);
-		}
-	)";
-	const char *pShader = R"(
-		#version 130
-		in vec3 tePoint;
-		in vec3 teNormal;
-		out vec4 pColor;
-		uniform vec4 color;
-		uniform vec3 light;
-		void main() {
-			vec3 N = normalize(teNormal);      // surface normal
-			vec3 L = normalize(light-tePoint); // light vector
-			vec3 E = normalize(tePoint);       // eye vector
-			vec3 R = reflect(L, N);            // highlight vector
-			float d = abs(dot(N, L));          // two-sided diffuse
-			float s = abs(dot(R, E));          // two-sided specular
-			float intensity = clamp(d+pow(s, 50), 0, 1);
-			pColor = intensity*color;
+const char *cylVShader = "void main() { gl_Position = vec4(0); }";
+
+const char *cylTCShader = R"(
+	#version 400 core
+	layout (vertices = 4) out;
+	void main() {
+		if (gl_InvocationID == 0) {
+			gl_TessLevelOuter[0] = gl_TessLevelOuter[2] = 1;
+			gl_TessLevelOuter[1] = gl_TessLevelOuter[3] = 24;
+			gl_TessLevelInner[0] = gl_TessLevelInner[1] = 24;
 		}
-	)";
+	}
+)";
+
+const char *cylTEShader = R"(
+	#version 400 core
+)" FRAME_BLOCK_GLSL R"(
+	layout (quads, equal_spacing, ccw) in;
+	uniform vec3 p1;
+	uniform vec3 p2;
+	uniform float r1;
+	uniform float r2;
+	out vec3 tePoint;
+	out vec3 teNormal;
+	void main() {
+		vec2 uv = gl_TessCoord.st;
+		float c = cos(2*3.1415*uv.s), s = sin(2*3.1415*uv.s);
+		vec3 dp = p2-p1;
+		vec3 crosser = dp.x < dp.y? (dp.x < dp.z? vec3(1,0,0) : vec3(0,0,1)) : (dp.y < dp.z? vec3(0,1,0) : vec3(0,0,1));
+		vec3 xcross = normalize(cross(crosser, dp));
+		vec3 ycross = normalize(cross(xcross, dp));
+		vec3 n = c*xcross+s*ycross;
+		vec3 p = mix(p1, p2, uv.t)+mix(r1, r2, uv.t)*n;
+		tePoint = (frame.modelview*vec4(p, 1)).xyz;
+		teNormal = (frame.modelview*vec4(n, 0)).xyz;
+		gl_Position = frame.persp*vec4(tePoint, 1);
+	}
+)";
+
+const char *cylPShader = R"(
+	#version 400 core
+)" FRAME_BLOCK_GLSL R"(
+	in vec3 tePoint;
+	in vec3 teNormal;
+	out vec4 pColor;
+	uniform vec4 color;
+	void main() {
+		vec3 N = normalize(teNormal);      // surface normal
+		vec3 light = frame.nLights > 0? frame.lights[0].xyz : vec3(0);
+		vec3 L = normalize(light-tePoint); // light vector
+		vec3 E = normalize(tePoint);       // eye vector
+		vec3 R = reflect(L, N);            // highlight vector
+		float d = abs(dot(N, L));          // two-sided diffuse
+		float s = abs(dot(R, E));          // two-sided specular
+		float intensity = clamp(d+pow(s, 50), 0, 1);
+		pColor = intensity*color;
+	}
+)";
+
+void Cylinder(vec3 p1, vec3 p2, float r1, float r2, mat4 modelview, mat4 persp, vec4 color) {
+	UpdateFrameBlock(modelview, persp); // skipped if unchanged
+	Cylinder(p1, p2, r1, r2, color);
+}
+
+void Cylinder(vec3 p1, vec3 p2, float r1, float r2, vec4 color) {
 	if (!cylinderShader)
-		cylinderShader = LinkProgramViaCode(&vShader, &tcShader, &teShader, NULL, &pShader);
-	//	cylinderShader = LinkProgramViaCode(&vShader, NULL, &teShader, NULL, &pShader);
+		cylinderShader = LinkProgramDeferred(&cylVShader, &cylTCShader, &cylTEShader, NULL, &cylPShader);
+	//	cylinderShader = LinkProgramViaCode(&cylVShader, NULL, &cylTEShader, NULL, &cylPShader);
+	if (ProgramPending(cylinderShader))
+		FinishProgram(cylinderShader);
 	glUseProgram(cylinderShader);
-	SetUniform(cylinderShader, "modelview", modelview);
-	SetUniform(cylinderShader, "persp", persp);
 	SetUniform(cylinderShader, "color", color);
 	SetUniform(cylinderShader, "p1", p1);
 	SetUniform(cylinderShader, "p2", p2);
@@ -526,72 +507,49 @@ void Cylinder(vec3 p1, vec3 p2, float r1, float r2, mat4 modelview, mat4 persp,
 
 // Triangles with optional outline
 
-GLuint triShader = 0, triBuffer = 0;
+GLuint triShader = 0, triBuffer = 0, triVao = 0;
+
+const VertexLayout triLayout = {
+	{ "point", 3, GL_FLOAT, false, 0, 2*sizeof(vec3) },
+	{ "color", 3, GL_FLOAT, false, sizeof(vec3), 2*sizeof(vec3) } };
 
-// vertex shader
+// vertex shader: triangles are drawn unindexed, so gl_VertexID%3 gives vertex order within triangle
 const char *triVShaderCode = R"(
 	#version 330 core
 	in vec3 point;
 	in vec3 color;
 	out vec3 vColor;
-	uniform mat4 view;
+	out vec3 vBary;
+	uniform mat4 view = mat4(1);
 	void main() {
 		gl_Position = view*vec4(point, 1);
 		vColor = color;
+		int i = gl_VertexID%3;
+		vBary = vec3(i == 0? 1 : 0, i == 1? 1 : 0, i == 2? 1 : 0);
 	}
 )";
 
-// geometry shader with line-drawing
-const char *triGShaderCode = R"(
-	#version 330 core
-	layout (triangles) in;
-	layout (triangle_strip, max_vertices = 3) out;
-	in vec3 vPoint[];
-	in vec3 vColor[];
-	out vec3 gColor;
-	noperspective out vec3 gEdgeDistance;
-	uniform mat4 viewptM;
-	vec3 ViewPoint(int i) {
-		return vec3(viewptM*(gl_in[i].gl_Position/gl_in[i].gl_Position.w));
-	}
-	void main() {
-		float ha = 0, hb = 0, hc = 0;
-		// transform each vertex into viewport space
-		vec3 p0 = ViewPoint(0), p1 = ViewPoint(1), p2 = ViewPoint(2);
-		// find altitudes ha, hb, hc
-		float a = length(p2-p1), b = length(p2-p0), c = length(p1-p0);
-		float alpha = acos((b*b+c*c-a*a)/(2.*b*c));
-		float beta = acos((a*a+c*c-b*b)/(2.*a*c));
-		ha = abs(c*sin(beta));
-		hb = abs(c*sin(alpha));
-		hc = abs(b*sin(alpha));
-		// send triangle vertices and edge distances
-		for (int i = 0; i < 3; i++) {
-		    gEdgeDistance = i==0? vec3(ha, 0, 0) : i==1? vec3(0, hb, 0) : vec3(0, 0, hc);
-			gColor = vColor[i];
-			gl_Position = gl_in[i].gl_Position;
-			EmitVertex();
-		}
-		EndPrimitive();
-	}
-)";
-
-// pixel shader
+// pixel shader with line-drawing (no geometry shader)
 const char *triPShaderCode = R"(
-	#version 410 core
-	in vec3 gColor;
-	noperspective in vec3 gEdgeDistance;
+	#version 330 core
+	in vec3 vColor;
+	in vec3 vBary;
 	uniform vec4 outlineColor = vec4(0, 0, 0, 1);
 	uniform float opacity = 1;
 	uniform float outlineWidth = 1;
 	uniform float transition = 1;
 	uniform int outlineOn = 1;
 	out vec4 pColor;
+	float EdgeDistance() {
+		// distance in pixels to nearest edge: barycentric divided by its screen-space rate of change
+		vec3 dx = dFdx(vBary), dy = dFdy(vBary);
+		vec3 d = vBary/max(sqrt(dx*dx+dy*dy), vec3(1e-6));
+		return min(d.x, min(d.y, d.z));
+	}
 	void main() {
-		pColor = vec4(gColor, opacity);
+		pColor = vec4(vColor, opacity);
 		if (outlineOn > 0) {
-			float minDist = min(gEdgeDistance.x, min(gEdgeDistance.y, gEdgeDistance.z));
-			float t = smoothstep(outlineWidth-transition, outlineWidth+transition, minDist);
+			float t = smoothstep(outlineWidth-transition, outlineWidth+transition, EdgeDistance());
 			if (outlineOn == 2) pColor = vec4(1,1,1,1);
 			pColor = mix(outlineColor, pColor, t);
 		}
@@ -599,12 +557,11 @@ const char *triPShaderCode = R"(
 )";
 
  void UseTriangleShader() {
-	bool init = triShader == 0;
-	if (init)
-		triShader = LinkProgramViaCode(&triVShaderCode, NULL, NULL, &triGShaderCode, &triPShaderCode);
+	if (!triShader)
+		triShader = LinkProgramDeferred(&triVShaderCode, &triPShaderCode);
+	if (ProgramPending(triShader))
+		FinishProgram(triShader);
 	glUseProgram(triShader);
-	if (init)
-		SetUniform(triShader, "view", mat4());
 	glEnable(GL_BLEND);
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glEnable(GL_LINE_SMOOTH);
@@ -615,23 +572,43 @@ void UseTriangleShader(mat4 view) {
 	SetUniform(triShader, "view", view);
 }
 
-void Triangle(vec3 p1, vec3 p2, vec3 p3, vec3 c1, vec3 c2, vec3 c3,
-			  float opacity, bool outline, vec4 outlineCol, float outlineWidth, float transition) {
-	vec3 data[] = { p1, p2, p3, c1, c2, c3 };
+void BuildDrawShaders() {
+	if (!drawShader)
+		drawShader = LinkProgramDeferred(&drawVShader, &drawPShader);
+	if (!triShader)
+		triShader = LinkProgramDeferred(&triVShaderCode, &triPShaderCode);
+}
+
+void Triangles(int nTriangles, vec3 *points, vec3 *colors,
+			   float opacity, bool outline, vec4 outlineCol, float outlineWidth, float transition) {
 	UseTriangleShader();
-	if (triBuffer == 0)
+	if (!triVao) {
 		glGenBuffers(1, &triBuffer);
+		triVao = GetVertexArray(triBuffer, triLayout, triShader);
+	}
+	// interleave points and colors
+	int nVertices = 3*nTriangles;
+	std::vector<vec3> data(2*nVertices);
+	for (int i = 0; i < nVertices; i++) {
+		data[2*i] = points[i];
+		data[2*i+1] = colors[i];
+	}
+	glBindVertexArray(triVao);
 	glBindBuffer(GL_ARRAY_BUFFER, triBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(data), data, GL_STATIC_DRAW);
-	VertexAttribPointer(triShader, "point", 3, 0, (void *) 0);
-	VertexAttribPointer(triShader, "color", 3, 0, (void *) (3*sizeof(vec3)));
-	SetUniform(triShader, "viewptM", Viewport()); // **** ????
+	glBufferData(GL_ARRAY_BUFFER, data.size()*sizeof(vec3), data.data(), GL_STREAM_DRAW);
 	SetUniform(triShader, "opacity", opacity);
 	SetUniform(triShader, "outlineOn", outline? 1 : 0);
 	SetUniform(triShader, "outlineColor", outlineCol);
 	SetUniform(triShader, "outlineWidth", outlineWidth);
 	SetUniform(triShader, "transition", transition);
-	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glDrawArrays(GL_TRIANGLES, 0, nVertices);
+	glBindVertexArray(0);
+}
+
+void Triangle(vec3 p1, vec3 p2, vec3 p3, vec3 c1, vec3 c2, vec3 c3,
+			  float opacity, bool outline, vec4 outlineCol, float outlineWidth, float transition) {
+	vec3 points[] = { p1, p2, p3 }, colors[] = { c1, c2, c3 };
+	Triangles(1, points, colors, opacity, outline, outlineCol, outlineWidth, transition);
 }
 
 // Boxes
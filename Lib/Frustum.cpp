@@ -0,0 +1,79 @@
+// Frustum.cpp - view frustum planes, for culling bounding spheres and boxes
+
+#include "Frustum.h"
+#include <float.h>
+#include <math.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#include <xmmintrin.h>
+#define FRUSTUM_SSE
+#endif
+
+void Frustum::Set(const mat4 &m) {
+	// left, right, bottom, top, near, far: fourth row plus or minus each of the others
+	for (int i = 0; i < 6; i++) {
+		vec4 p = i%2? m[3]-m[i/2] : m[3]+m[i/2];
+		float len = length(vec3(p.x, p.y, p.z));
+		if (len > 0)
+			p = p*(1/len);
+		x[i] = p.x; y[i] = p.y; z[i] = p.z; w[i] = p.w;
+	}
+	for (int i = 6; i < 8; i++) {
+		x[i] = y[i] = z[i] = 0;
+		w[i] = FLT_MAX;
+	}
+}
+
+namespace {
+
+FrustumTest Classify(int outside, int inside) {
+	// outside, inside: plane masks (bit per plane) for which the bound is wholly behind, in front
+	return outside? FrustumOutside : inside == 0xff? FrustumInside : FrustumIntersects;
+}
+
+} // end namespace
+
+FrustumTest Frustum::TestSphere(vec3 c, float r) const {
+	int outside = 0, inside = 0;
+#ifdef FRUSTUM_SSE
+	__m128 cx = _mm_set1_ps(c.x), cy = _mm_set1_ps(c.y), cz = _mm_set1_ps(c.z), pr = _mm_set1_ps(r), nr = _mm_set1_ps(-r);
+	for (int g = 0; g < 2; g++) {
+		__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x+4*g), cx), _mm_mul_ps(_mm_loadu_ps(y+4*g), cy)),
+							  _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(z+4*g), cz), _mm_loadu_ps(w+4*g)));
+		outside |= _mm_movemask_ps(_mm_cmplt_ps(d, nr)) << 4*g;
+		inside |= _mm_movemask_ps(_mm_cmpge_ps(d, pr)) << 4*g;
+	}
+#else
+	for (int i = 0; i < 8; i++) {
+		float d = x[i]*c.x+y[i]*c.y+z[i]*c.z+w[i];
+		outside |= d < -r? 1 << i : 0;
+		inside |= d >= r? 1 << i : 0;
+	}
+#endif
+	return Classify(outside, inside);
+}
+
+FrustumTest Frustum::TestBox(vec3 min, vec3 max) const {
+	// as a sphere, but with radius the box's extent projected onto plane normal
+	vec3 c = .5f*(min+max), e = .5f*(max-min);
+	int outside = 0, inside = 0;
+#ifdef FRUSTUM_SSE
+	__m128 cx = _mm_set1_ps(c.x), cy = _mm_set1_ps(c.y), cz = _mm_set1_ps(c.z);
+	__m128 ex = _mm_set1_ps(e.x), ey = _mm_set1_ps(e.y), ez = _mm_set1_ps(e.z), sign = _mm_set1_ps(-0.f);
+	for (int g = 0; g < 2; g++) {
+		__m128 px = _mm_loadu_ps(x+4*g), py = _mm_loadu_ps(y+4*g), pz = _mm_loadu_ps(z+4*g);
+		__m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px, cx), _mm_mul_ps(py, cy)), _mm_add_ps(_mm_mul_ps(pz, cz), _mm_loadu_ps(w+4*g)));
+		__m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign, px), ex), _mm_mul_ps(_mm_andnot_ps(sign, py), ey)),
+							  _mm_mul_ps(_mm_andnot_ps(sign, pz), ez));
+		outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(d, r), _mm_setzero_ps())) << 4*g;
+		inside |= _mm_movemask_ps(_mm_cmpge_ps(d, r)) << 4*g;
+	}
+#else
+	for (int i = 0; i < 8; i++) {
+		float d = x[i]*c.x+y[i]*c.y+z[i]*c.z+w[i], r = fabs(x[i])*e.x+fabs(y[i])*e.y+fabs(z[i])*e.z;
+		outside |= d+r < 0? 1 << i : 0;
+		inside |= d >= r? 1 << i : 0;
+	}
+#endif
+	return Classify(outside, inside);
+}
@@ -0,0 +1,325 @@
+// GLState.cpp - shadow copy of OpenGL state, filters redundant state changes
+
+#include <glad.h>
+#include "GLState.h"
+#include "GLXtras.h"
+#include <stdio.h>
+
+namespace {
+
+const int NUnits = 32;						// texture units shadowed
+const int NUniformBases = 16;				// indexed uniform buffer bindings shadowed
+const GLuint UnknownBinding = 0xFFFFFFFF;	// indexed binding set by glBindBufferRange
+
+struct Shadow {
+	GLuint program = 0, vao = 0;
+	GLuint arrayBuffer = 0, packBuffer = 0, unpackBuffer = 0, uniformBuffer = 0;
+	GLuint uniformBases[NUniformBases] = { 0 };
+	GLuint activeUnit = 0, textures[NUnits] = { 0 };
+	GLint viewport[4] = { 0, 0, 0, 0 };
+	GLdouble depthRange[2] = { 0, 1 };
+	GLenum blendSrc = GL_ONE, blendDst = GL_ZERO;
+	bool blendKnown = true;					// false after glBlendFuncSeparate
+	bool blend = false, depthTest = false, cullFace = false;
+} shadow;
+
+bool active = false;
+GLStateCounts counts;
+
+// entry points saved when hooks installed
+
+PFNGLUSEPROGRAMPROC realUseProgram = NULL;
+PFNGLBINDVERTEXARRAYPROC realBindVertexArray = NULL;
+PFNGLBINDBUFFERPROC realBindBuffer = NULL;
+PFNGLBINDBUFFERBASEPROC realBindBufferBase = NULL;
+PFNGLBINDBUFFERRANGEPROC realBindBufferRange = NULL;
+PFNGLDELETEBUFFERSPROC realDeleteBuffers = NULL;
+PFNGLDELETEVERTEXARRAYSPROC realDeleteVertexArrays = NULL;
+PFNGLACTIVETEXTUREPROC realActiveTexture = NULL;
+PFNGLBINDTEXTUREPROC realBindTexture = NULL;
+PFNGLDELETETEXTURESPROC realDeleteTextures = NULL;
+PFNGLVIEWPORTPROC realViewport = NULL;
+PFNGLDEPTHRANGEPROC realDepthRange = NULL;
+PFNGLBLENDFUNCPROC realBlendFunc = NULL;
+PFNGLBLENDFUNCSEPARATEPROC realBlendFuncSeparate = NULL;
+PFNGLENABLEPROC realEnable = NULL;
+PFNGLDISABLEPROC realDisable = NULL;
+
+bool Redundant(bool unchanged, int &category) {
+	// count call as skipped (in category) if it would leave state unchanged, else as issued
+	if (!unchanged) {
+		counts.issued++;
+		return false;
+	}
+	counts.skipped++;
+	category++;
+	return true;
+}
+
+bool *Capability(GLenum cap) {
+	return cap == GL_BLEND? &shadow.blend : cap == GL_DEPTH_TEST? &shadow.depthTest : cap == GL_CULL_FACE? &shadow.cullFace : NULL;
+}
+
+GLuint *BufferTarget(GLenum target) {
+	return target == GL_ARRAY_BUFFER?		 &shadow.arrayBuffer :
+		   target == GL_PIXEL_PACK_BUFFER?	 &shadow.packBuffer :
+		   target == GL_PIXEL_UNPACK_BUFFER? &shadow.unpackBuffer :
+		   target == GL_UNIFORM_BUFFER?		 &shadow.uniformBuffer : NULL;
+		// GL_ELEMENT_ARRAY_BUFFER is vertex array state, so not shadowed
+}
+
+// hooks
+
+void APIENTRY HookUseProgram(GLuint program) {
+	if (Redundant(program == shadow.program, counts.skippedPrograms))
+		return;
+	if (NPendingPrograms() && ProgramPending(program))
+		FinishProgram(program);				// first use of program from LinkProgramDeferred
+	shadow.program = program;
+	realUseProgram(program);
+}
+
+void APIENTRY HookBindVertexArray(GLuint vao) {
+	if (Redundant(vao == shadow.vao, counts.skippedBuffers))
+		return;
+	shadow.vao = vao;
+	realBindVertexArray(vao);
+}
+
+void APIENTRY HookBindBuffer(GLenum target, GLuint buffer) {
+	GLuint *b = BufferTarget(target);
+	if (Redundant(b && *b == buffer, counts.skippedBuffers))
+		return;
+	if (b) *b = buffer;
+	realBindBuffer(target, buffer);
+}
+
+void APIENTRY HookBindBufferBase(GLenum target, GLuint index, GLuint buffer) {
+	// also sets the generic binding
+	bool tracked = target == GL_UNIFORM_BUFFER && index < NUniformBases;
+	if (Redundant(tracked && shadow.uniformBases[index] == buffer && shadow.uniformBuffer == buffer, counts.skippedBuffers))
+		return;
+	if (target == GL_UNIFORM_BUFFER) shadow.uniformBuffer = buffer;
+	if (tracked) shadow.uniformBases[index] = buffer;
+	realBindBufferBase(target, index, buffer);
+}
+
+void APIENTRY HookBindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+	// offset and size are not shadowed, so never skipped
+	counts.issued++;
+	if (target == GL_UNIFORM_BUFFER) shadow.uniformBuffer = buffer;
+	if (target == GL_UNIFORM_BUFFER && index < NUniformBases) shadow.uniformBases[index] = UnknownBinding;
+	realBindBufferRange(target, index, buffer, offset, size);
+}
+
+void APIENTRY HookDeleteBuffers(GLsizei n, const GLuint *buffers) {
+	// deleted buffers are unbound by GL
+	GLuint *bs[] = { &shadow.arrayBuffer, &shadow.packBuffer, &shadow.unpackBuffer, &shadow.uniformBuffer };
+	for (int i = 0; i < n; i++) {
+		for (int k = 0; k < 4; k++)
+			if (buffers[i] && *bs[k] == buffers[i]) *bs[k] = 0;
+		for (int k = 0; k < NUniformBases; k++)
+			if (buffers[i] && shadow.uniformBases[k] == buffers[i]) shadow.uniformBases[k] = 0;
+	}
+	realDeleteBuffers(n, buffers);
+}
+
+void APIENTRY HookDeleteVertexArrays(GLsizei n, const GLuint *arrays) {
+	for (int i = 0; i < n; i++)
+		if (arrays[i] && shadow.vao == arrays[i]) shadow.vao = 0;
+	realDeleteVertexArrays(n, arrays);
+}
+
+void APIENTRY HookActiveTexture(GLenum texture) {
+	GLuint unit = texture-GL_TEXTURE0;
+	if (Redundant(unit == shadow.activeUnit, counts.skippedTextures))
+		return;
+	shadow.activeUnit = unit;
+	realActiveTexture(texture);
+}
+
+void APIENTRY HookBindTexture(GLenum target, GLuint texture) {
+	bool tracked = target == GL_TEXTURE_2D && shadow.activeUnit < NUnits;
+	if (Redundant(tracked && shadow.textures[shadow.activeUnit] == texture, counts.skippedTextures))
+		return;
+	if (tracked) shadow.textures[shadow.activeUnit] = texture;
+	realBindTexture(target, texture);
+}
+
+void APIENTRY HookDeleteTextures(GLsizei n, const GLuint *textures) {
+	for (int i = 0; i < n; i++)
+		for (int u = 0; u < NUnits; u++)
+			if (textures[i] && shadow.textures[u] == textures[i]) shadow.textures[u] = 0;
+	realDeleteTextures(n, textures);
+}
+
+void APIENTRY HookViewport(GLint x, GLint y, GLsizei w, GLsizei h) {
+	GLint *vp = shadow.viewport;
+	if (Redundant(vp[0] == x && vp[1] == y && vp[2] == w && vp[3] == h, counts.skippedOther))
+		return;
+	vp[0] = x; vp[1] = y; vp[2] = w; vp[3] = h;
+	realViewport(x, y, w, h);
+}
+
+void APIENTRY HookDepthRange(GLdouble n, GLdouble f) {
+	if (Redundant(shadow.depthRange[0] == n && shadow.depthRange[1] == f, counts.skippedOther))
+		return;
+	shadow.depthRange[0] = n;
+	shadow.depthRange[1] = f;
+	realDepthRange(n, f);
+}
+
+void APIENTRY HookBlendFunc(GLenum src, GLenum dst) {
+	if (Redundant(shadow.blendKnown && shadow.blendSrc == src && shadow.blendDst == dst, counts.skippedOther))
+		return;
+	shadow.blendSrc = src;
+	shadow.blendDst = dst;
+	shadow.blendKnown = true;
+	realBlendFunc(src, dst);
+}
+
+void APIENTRY HookBlendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha) {
+	counts.issued++;
+	shadow.blendKnown = false;
+	realBlendFuncSeparate(srcRGB, dstRGB, srcAlpha, dstAlpha);
+}
+
+void APIENTRY HookEnable(GLenum cap) {
+	bool *c = Capability(cap);
+	if (Redundant(c && *c, counts.skippedOther))
+		return;
+	if (c) *c = true;
+	realEnable(cap);
+}
+
+void APIENTRY HookDisable(GLenum cap) {
+	bool *c = Capability(cap);
+	if (Redundant(c && !*c, counts.skippedOther))
+		return;
+	if (c) *c = false;
+	realDisable(cap);
+}
+
+GLuint GetInteger(GLenum name) {
+	GLint v = 0;
+	glGetIntegerv(name, &v);
+	return (GLuint) v;
+}
+
+} // end namespace
+
+// Initialization
+
+void SyncGLState() {
+	shadow.program = GetInteger(GL_CURRENT_PROGRAM);
+	shadow.vao = GetInteger(GL_VERTEX_ARRAY_BINDING);
+	shadow.arrayBuffer = GetInteger(GL_ARRAY_BUFFER_BINDING);
+	shadow.packBuffer = GetInteger(GL_PIXEL_PACK_BUFFER_BINDING);
+	shadow.unpackBuffer = GetInteger(GL_PIXEL_UNPACK_BUFFER_BINDING);
+	shadow.uniformBuffer = GetInteger(GL_UNIFORM_BUFFER_BINDING);
+	// indexed uniform buffer bindings: known only if bound whole (by glBindBufferBase, size 0)
+	GLint nBases = 0;
+	glGetIntegerv(GL_MAX_UNIFORM_BUFFER_BINDINGS, &nBases);
+	for (int i = 0; i < NUniformBases; i++) {
+		GLint b = 0, size = 0;
+		if (i < nBases) {
+			glGetIntegeri_v(GL_UNIFORM_BUFFER_BINDING, i, &b);
+			glGetIntegeri_v(GL_UNIFORM_BUFFER_SIZE, i, &size);
+		}
+		shadow.uniformBases[i] = size? UnknownBinding : (GLuint) b;
+	}
+	// texture bindings, per unit
+	GLuint unit = GetInteger(GL_ACTIVE_TEXTURE)-GL_TEXTURE0;
+	GLint nUnits = 0;
+	glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &nUnits);
+	for (int u = 0; u < NUnits; u++) {
+		shadow.textures[u] = 0;
+		if (u < nUnits) {
+			(realActiveTexture? realActiveTexture : glActiveTexture)(GL_TEXTURE0+u);
+			shadow.textures[u] = GetInteger(GL_TEXTURE_BINDING_2D);
+		}
+	}
+	(realActiveTexture? realActiveTexture : glActiveTexture)(GL_TEXTURE0+unit);
+	shadow.activeUnit = unit;
+	// viewport, depth, blend
+	glGetIntegerv(GL_VIEWPORT, shadow.viewport);
+	glGetDoublev(GL_DEPTH_RANGE, shadow.depthRange);
+	shadow.blendSrc = GetInteger(GL_BLEND_SRC_RGB);
+	shadow.blendDst = GetInteger(GL_BLEND_DST_RGB);
+	shadow.blendKnown = shadow.blendSrc == GetInteger(GL_BLEND_SRC_ALPHA) && shadow.blendDst == GetInteger(GL_BLEND_DST_ALPHA);
+	shadow.blend = glIsEnabled(GL_BLEND) == GL_TRUE;
+	shadow.depthTest = glIsEnabled(GL_DEPTH_TEST) == GL_TRUE;
+	shadow.cullFace = glIsEnabled(GL_CULL_FACE) == GL_TRUE;
+}
+
+bool InitGLState() {
+	if (active)
+		return true;
+	if (!glad_glUseProgram)
+		return false;
+	SyncGLState();
+	realUseProgram = glad_glUseProgram;				glad_glUseProgram = HookUseProgram;
+	realBindVertexArray = glad_glBindVertexArray;	glad_glBindVertexArray = HookBindVertexArray;
+	realBindBuffer = glad_glBindBuffer;				glad_glBindBuffer = HookBindBuffer;
+	realBindBufferBase = glad_glBindBufferBase;		glad_glBindBufferBase = HookBindBufferBase;
+	realBindBufferRange = glad_glBindBufferRange;	glad_glBindBufferRange = HookBindBufferRange;
+	realDeleteBuffers = glad_glDeleteBuffers;		glad_glDeleteBuffers = HookDeleteBuffers;
+	realDeleteVertexArrays = glad_glDeleteVertexArrays; glad_glDeleteVertexArrays = HookDeleteVertexArrays;
+	realActiveTexture = glad_glActiveTexture;		glad_glActiveTexture = HookActiveTexture;
+	realBindTexture = glad_glBindTexture;			glad_glBindTexture = HookBindTexture;
+	realDeleteTextures = glad_glDeleteTextures;		glad_glDeleteTextures = HookDeleteTextures;
+	realViewport = glad_glViewport;					glad_glViewport = HookViewport;
+	realDepthRange = glad_glDepthRange;				glad_glDepthRange = HookDepthRange;
+	realBlendFunc = glad_glBlendFunc;				glad_glBlendFunc = HookBlendFunc;
+	realBlendFuncSeparate = glad_glBlendFuncSeparate; glad_glBlendFuncSeparate = HookBlendFuncSeparate;
+	realEnable = glad_glEnable;						glad_glEnable = HookEnable;
+	realDisable = glad_glDisable;					glad_glDisable = HookDisable;
+	active = true;
+	return true;
+}
+
+bool GLStateActive() { return active; }
+
+// Queries
+
+void GetGLViewport(int vp[4]) {
+	if (active)
+		for (int i = 0; i < 4; i++)
+			vp[i] = shadow.viewport[i];
+	else
+		glGetIntegerv(GL_VIEWPORT, vp);
+}
+
+GLuint GetGLProgram() {
+	return active? shadow.program : GetInteger(GL_CURRENT_PROGRAM);
+}
+
+bool GLEnabled(GLenum cap) {
+	bool *c = active? Capability(cap) : NULL;
+	return c? *c : glIsEnabled(cap) == GL_TRUE;
+}
+
+void GetGLDepthRange(float range[2]) {
+	if (active) {
+		range[0] = (float) shadow.depthRange[0];
+		range[1] = (float) shadow.depthRange[1];
+	}
+	else
+		glGetFloatv(GL_DEPTH_RANGE, range);
+}
+
+// Counts
+
+GLStateCounts GetGLStateCounts(bool reset) {
+	GLStateCounts c = counts;
+	if (reset)
+		counts = GLStateCounts();
+	return c;
+}
+
+void PrintGLStateCounts(const char *title) {
+	GLStateCounts &c = counts;
+	printf("%s%sstate calls: %i issued, %i skipped (programs %i, buffers %i, textures %i, other %i)\n",
+		title? title : "", title? ": " : "", c.issued, c.skipped,
+		c.skippedPrograms, c.skippedBuffers, c.skippedTextures, c.skippedOther);
+}
@@ -1,16 +1,123 @@
 // GLXtras.cpp - GLSL support (c) 2019-2022 Jules Bloomenthal
 
 #include <glad.h>
-#include <gl/glu.h>
+#include <GLFW/glfw3.h>
+#include "GLState.h"
 #include "GLXtras.h"
+#include "Trace.h"
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
 #include <vector>
+#ifndef NDEBUG
+#include <atomic>
+#endif
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
 
 // Print OpenGL, GLSL Details
 
+namespace {
+
+const char *ErrorString(GLenum e) {
+	switch (e) {
+		case GL_INVALID_ENUM: return "invalid enumerant";
+		case GL_INVALID_VALUE: return "invalid value";
+		case GL_INVALID_OPERATION: return "invalid operation";
+		case GL_STACK_OVERFLOW: return "stack overflow";
+		case GL_STACK_UNDERFLOW: return "stack underflow";
+		case GL_OUT_OF_MEMORY: return "out of memory";
+		case GL_INVALID_FRAMEBUFFER_OPERATION: return "invalid framebuffer operation";
+	}
+	return "unknown error";
+}
+
+#ifndef NDEBUG
+
+// debug messages are written by the driver (possibly from its own threads) into a ring
+// each writer claims a slot with an atomic increment, and publishes it by setting seq (a seqlock:
+// seq is 0 while the slot is written); the reader (PrintGLErrors) copies a slot, then re-reads seq,
+// so consumes slots in order, skipping any overwritten while copied
+
+const int DebugRingSize = 64, DebugMessageLength = 256;
+
+struct DebugSlot {
+	std::atomic<unsigned> seq{0};			// ticket+1 once written
+	GLenum source = 0, type = 0, severity = 0;
+	GLuint id = 0;
+	char message[DebugMessageLength];
+};
+
+DebugSlot debugRing[DebugRingSize];
+std::atomic<unsigned> debugHead{0};
+unsigned debugTail = 0;
+bool debugActive = false;
+
+void APIENTRY DebugCallback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei length, const GLchar *message, const void *) {
+	unsigned ticket = debugHead.fetch_add(1, std::memory_order_relaxed);
+	DebugSlot &s = debugRing[ticket%DebugRingSize];
+	s.seq.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);	// seq 0 visible before any payload write
+	s.source = source;
+	s.type = type;
+	s.id = id;
+	s.severity = severity;
+	int n = length < 0? (int) strlen(message) : length;
+	n = n < DebugMessageLength-1? n : DebugMessageLength-1;
+	memcpy(s.message, message, n);
+	s.message[n] = 0;
+	s.seq.store(ticket+1, std::memory_order_release);
+}
+
+const char *DebugTypeString(GLenum type) {
+	switch (type) {
+		case GL_DEBUG_TYPE_ERROR: return "error";
+		case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+		case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "undefined behavior";
+		case GL_DEBUG_TYPE_PORTABILITY: return "portability";
+		case GL_DEBUG_TYPE_PERFORMANCE: return "performance";
+	}
+	return "other";
+}
+
+int DrainDebugRing(const char *title) {
+	// print messages written since last drain; return # errors
+	int nErrors = 0;
+	unsigned head = debugHead.load(std::memory_order_acquire);
+	if (head-debugTail > (unsigned) DebugRingSize) {
+		printf("(%u GL debug messages lost)\n", head-debugTail-DebugRingSize);
+		debugTail = head-DebugRingSize;
+	}
+	for (; debugTail != head; debugTail++) {
+		DebugSlot &s = debugRing[debugTail%DebugRingSize];
+		if (s.seq.load(std::memory_order_acquire) != debugTail+1)
+			break; // still being written: leave for next drain
+		GLenum type = s.type;
+		GLuint id = s.id;
+		char message[DebugMessageLength];
+		memcpy(message, s.message, DebugMessageLength);
+		std::atomic_thread_fence(std::memory_order_acquire);	// copies complete before seq re-read
+		if (s.seq.load(std::memory_order_relaxed) != debugTail+1)
+			continue; // overwritten while copying
+		message[DebugMessageLength-1] = 0;
+		nErrors += type == GL_DEBUG_TYPE_ERROR;
+		printf("%s%sGL %s (%u): %s\n", title? title : "", title? ": " : "", DebugTypeString(type), id, message);
+	}
+	return nErrors;
+}
+
+#endif
+
+} // end namespace
+
 int PrintGLErrors(const char *title) {
+#ifndef NDEBUG
+	if (debugActive)
+		return DrainDebugRing(title);
+#endif
 	char buf[1000];
 	int nErrors = 0;
 	buf[0] = 0;
@@ -18,7 +125,7 @@ int PrintGLErrors(const char *title) {
 		GLenum n = glGetError();
 		if (n == GL_NO_ERROR)
 			break;
-		sprintf(buf+strlen(buf), "%s%s", !nErrors++? "" : ", ", gluErrorString(n));
+		sprintf(buf+strlen(buf), "%s%s", !nErrors++? "" : ", ", ErrorString(n));
 			// do not call Debug() while looping through errors, so accumulate in buf
 	}
 	if (nErrors) {
@@ -28,6 +135,50 @@ int PrintGLErrors(const char *title) {
 	return nErrors;
 }
 
+// Debug Output
+
+bool InitGLDebug(bool synchronous) {
+#ifndef NDEBUG
+	if (!glad_glDebugMessageCallback || !glad_glDebugMessageControl)
+		return false;
+	// without a debug context, messages may not be issued, and errors would go unreported
+	GLint flags = 0;
+	glGetIntegerv(GL_CONTEXT_FLAGS, &flags);
+	if (!(flags & GL_CONTEXT_FLAG_DEBUG_BIT))
+		return false;
+	glEnable(GL_DEBUG_OUTPUT);
+	if (synchronous)
+		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+	glDebugMessageCallback(DebugCallback, NULL);
+	// errors and warnings only: notifications (eg, buffer placement) would flood the ring
+	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_TRUE);
+	glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, NULL, GL_FALSE);
+	glDebugMessageControl(GL_DONT_CARE, GL_DEBUG_TYPE_OTHER, GL_DEBUG_SEVERITY_LOW, 0, NULL, GL_FALSE);
+	while (glGetError() != GL_NO_ERROR)
+		;
+	debugTail = debugHead.load();
+	debugActive = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool GLDebugActive() {
+#ifndef NDEBUG
+	return debugActive;
+#else
+	return false;
+#endif
+}
+
+void LabelObject(GLenum identifier, GLuint name, const char *label) {
+#ifndef NDEBUG
+	if (debugActive && name && label)
+		glObjectLabel(identifier, name, -1, label);
+#endif
+}
+
 void PrintVersionInfo() {
 	const GLubyte *renderer    = glGetString(GL_RENDERER);
 	const GLubyte *vendor      = glGetString(GL_VENDOR);
@@ -100,35 +251,48 @@ void PrintProgramUniforms(int programID) {
 
 // Compilation
 
+namespace {
+
+bool ReadShaderFile(const char *filename, std::string &code) {
+	FILE* fp = fopen(filename, "r");
+	if (fp == NULL) {
+		printf("can't open file\n");
+		return false;
+	}
+	code.resize(0);
+	int c;
+	while ((c = fgetc(fp)) != EOF)
+		code.push_back((char) c);
+	fclose(fp);
+	return true;
+}
+
+} // end namespace
+
 GLuint CompileShaderViaFile(const char *filename, GLint type) {
-		FILE* fp = fopen(filename, "r");
-		if (fp == NULL) {
-			printf("can't open file\n");
-			return 0;
-		}
-		fseek(fp, 0L, SEEK_END);
-		long maxSize = ftell(fp);
-		fseek(fp, 0L, SEEK_SET);
-		char *buf = new char[maxSize+1], c;
-		int nchars = 0;
-		while ((c = fgetc(fp)) != EOF)
-			buf[nchars++] = c;
-		buf[nchars] = 0;
-		fclose(fp);
-		GLuint s = CompileShaderViaCode((const char **) &buf, type);
-		delete [] buf;
-		return s;
+	std::string code;
+	if (!ReadShaderFile(filename, code))
+		return 0;
+	const char *buf = code.c_str();
+	return CompileShaderViaCode(&buf, type);
 }
 
-GLuint CompileShaderViaCode(const char **code, GLint type) {
+namespace {
+
+GLuint SubmitShader(const char **code, GLint type) {
+	// start compilation, do not wait for it
 	GLuint shader = glCreateShader(type);
 	if (!shader) {
 		PrintGLErrors();
-		return false;
+		return 0;
 	}
 	glShaderSource(shader, 1, code, NULL);
 	glCompileShader(shader);
-	// check compile status
+	return shader;
+}
+
+bool ShaderCompiled(GLuint shader) {
+	// check compile status (waits for compilation)
 	GLint result;
 	glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
 	if (result == GL_FALSE) {
@@ -143,22 +307,202 @@ GLuint CompileShaderViaCode(const char **code, GLint type) {
 			delete [] log;
 		}
 		else printf("shader compilation failed\n");
+		return false;
+	}
+	return true;
+}
+
+} // end namespace
+
+GLuint CompileShaderViaCode(const char **code, GLint type) {
+	GLuint shader = SubmitShader(code, type);
+	if (shader && !ShaderCompiled(shader)) {
+		glDeleteShader(shader);
 		return 0;
 	}
 	return shader;
 }
 
+// Program Binary Cache
+
+namespace {
+
+std::string cacheDirectory = "ShaderCache";
+
+typedef unsigned long long Hash64;
+
+Hash64 Fnv1a(Hash64 h, const void *data, size_t n) {
+	const unsigned char *c = (const unsigned char *) data;
+	for (size_t i = 0; i < n; i++)
+		h = (h^c[i])*1099511628211ULL;
+	return h;
+}
+
+Hash64 Fnv1a(Hash64 h, const char *s) {
+	return s? Fnv1a(h, s, strlen(s)+1) : Fnv1a(h, "", 1); // include terminator to separate strings
+}
+
+bool CacheEnabled() {
+	GLint nFormats = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &nFormats);
+	return !cacheDirectory.empty() && nFormats > 0;
+}
+
+std::string CacheFilename(int nStages, const char **codes[], const GLenum types[]) {
+	// hash stage sources with driver identity: a driver update invalidates the cache
+	Hash64 h = 14695981039346656037ULL;
+	h = Fnv1a(h, "program binary cache v1");
+	h = Fnv1a(h, (const char *) glGetString(GL_VENDOR));
+	h = Fnv1a(h, (const char *) glGetString(GL_RENDERER));
+	h = Fnv1a(h, (const char *) glGetString(GL_VERSION));
+	for (int i = 0; i < nStages; i++)
+		if (codes[i]) {
+			h = Fnv1a(h, &types[i], sizeof(GLenum));
+			h = Fnv1a(h, *codes[i]);
+		}
+	char name[32];
+	sprintf(name, "/%016llx.bin", h);
+	return cacheDirectory+name;
+}
+
+void MakeDirectory(const char *dir) {
+#ifdef _WIN32
+	_mkdir(dir);
+#else
+	mkdir(dir, 0755);
+#endif
+}
+
+// deferred linking
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+struct PendingLink {
+	GLuint program = 0;
+	GLuint shaders[6] = { 0, 0, 0, 0, 0, 0 };
+	int nStages = 0;
+	std::string cacheFile;					// empty if cache disabled
+};
+
+std::vector<PendingLink> pendingLinks;
+int parallelCompile = -1;					// -1: not yet known
+
+typedef void (APIENTRYP PFNMAXSHADERCOMPILERTHREADS)(GLuint count);
+
+bool ParallelCompile() {
+	// does driver report completion status without blocking?
+	// on first call, if so, let the driver choose how many threads compile (glad doesn't load this entry)
+	if (parallelCompile < 0) {
+		GLint nExtensions = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &nExtensions);
+		parallelCompile = 0;
+		const char *setThreads = NULL;
+		for (int i = 0; i < nExtensions && !parallelCompile; i++) {
+			const char *e = (const char *) glGetStringi(GL_EXTENSIONS, i);
+			if (e && !strcmp(e, "GL_KHR_parallel_shader_compile"))
+				setThreads = "glMaxShaderCompilerThreadsKHR";
+			if (e && !strcmp(e, "GL_ARB_parallel_shader_compile"))
+				setThreads = "glMaxShaderCompilerThreadsARB";
+			parallelCompile = setThreads != NULL;
+		}
+		PFNMAXSHADERCOMPILERTHREADS maxThreads = setThreads? (PFNMAXSHADERCOMPILERTHREADS) glfwGetProcAddress(setThreads) : NULL;
+		if (maxThreads)
+			maxThreads(0xFFFFFFFF);		// implementation-specific maximum
+	}
+	return parallelCompile == 1;
+}
+
+PendingLink StartLink(int nStages, const char **codes[], const GLenum types[]) {
+	// submit stage sources (null entries skipped) for compilation and linking, or load from cache
+	// return with program 0 if compilation could not start; with nStages 0 if program loaded from cache
+	PendingLink l;
+	bool cache = CacheEnabled();
+	if (cache) {
+		l.cacheFile = CacheFilename(nStages, codes, types);
+		GLuint program = glCreateProgram();
+		if (ReadProgramBinary(program, l.cacheFile.c_str())) {
+			BindFrameBlock(program);
+			l.program = program;
+			return l;
+		}
+		glDeleteProgram(program); // miss, or binary rejected (eg, driver changed)
+	}
+	bool ok = true;
+	for (int i = 0; i < nStages; i++)
+		if (codes[i]) {
+			l.shaders[i] = SubmitShader(codes[i], types[i]);
+			ok = ok && l.shaders[i];
+		}
+	l.nStages = nStages;
+	l.program = ok? glCreateProgram() : 0;
+	if (l.program) {
+		if (cache)
+			glProgramParameteri(l.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		for (int i = 0; i < nStages; i++)
+			if (l.shaders[i]) glAttachShader(l.program, l.shaders[i]);
+		glLinkProgram(l.program);
+	}
+	return l;
+}
+
+void FinishLink(PendingLink &l) {
+	// wait for link, report errors, bind Frame block, write cache, free shaders
+	if (l.program && l.nStages) {
+		GLint status;
+		glGetProgramiv(l.program, GL_LINK_STATUS, &status);
+		if (status == GL_FALSE) {
+			for (int i = 0; i < l.nStages; i++)
+				if (l.shaders[i]) ShaderCompiled(l.shaders[i]);
+			PrintProgramLog(l.program);
+		}
+		else {
+			BindFrameBlock(l.program);
+			if (!l.cacheFile.empty()) {
+				MakeDirectory(cacheDirectory.c_str());
+				WriteProgramBinary(l.program, l.cacheFile.c_str());
+			}
+		}
+		for (int i = 0; i < l.nStages; i++)
+			if (l.shaders[i]) glDetachShader(l.program, l.shaders[i]);
+	}
+	for (int i = 0; i < l.nStages; i++)
+		if (l.shaders[i]) {
+			if (!l.program) ShaderCompiled(l.shaders[i]);
+			glDeleteShader(l.shaders[i]);
+		}
+	l.nStages = 0;
+}
+
+GLuint LinkStages(int nStages, const char **codes[], const GLenum types[], bool defer = false) {
+	if (defer)
+		ParallelCompile();				// before the first deferred compile, so the thread count applies
+	PendingLink l = StartLink(nStages, codes, types);
+	if (defer && l.program && l.nStages)
+		pendingLinks.push_back(l);
+	else
+		FinishLink(l);
+	return l.program;
+}
+
+} // end namespace
+
+void SetProgramCacheDirectory(const char *directory) {
+	cacheDirectory = directory? directory : "";
+}
+
+const char *GetProgramCacheDirectory() {
+	return cacheDirectory.c_str();
+}
+
 // Linking
 
 GLuint LinkProgramViaCode(const char **vertexCode, const char **pixelCode) {
-	GLuint vshader = CompileShaderViaCode(vertexCode, GL_VERTEX_SHADER);
-	GLuint pshader = CompileShaderViaCode(pixelCode, GL_FRAGMENT_SHADER);
-	GLuint p = LinkProgram(vshader, pshader);
-	glDetachShader(p, vshader);
-	glDetachShader(p, pshader);
-	glDeleteShader(vshader);
-	glDeleteShader(pshader);
-	return p;
+	TRACE_ZONE("LinkProgramViaCode");
+	const char **codes[] = { vertexCode, pixelCode };
+	GLenum types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+	return vertexCode && pixelCode? LinkStages(2, codes, types) : 0;
 }
 
 GLuint LinkProgramViaCode(const char **vertexCode,
@@ -166,50 +510,87 @@ GLuint LinkProgramViaCode(const char **vertexCode,
 						  const char **tessellationEvalCode,
 						  const char **geometryCode,
 						  const char **pixelCode) {
-	GLuint vshader = CompileShaderViaCode(vertexCode, GL_VERTEX_SHADER);
-	GLuint tcshader = 0;
-#ifdef GL_TESS_EVALUATION_SHADER
-	if (tessellationControlCode)
-		tcshader = CompileShaderViaCode(tessellationControlCode, GL_TESS_CONTROL_SHADER);
-#endif
-	GLuint teshader = 0;
-#ifdef GL_TESS_EVALUATION_SHADER
-	if (tessellationEvalCode)
-		teshader = CompileShaderViaCode(tessellationEvalCode, GL_TESS_EVALUATION_SHADER);
-#endif
-	GLuint gshader = geometryCode? CompileShaderViaCode(geometryCode, GL_GEOMETRY_SHADER) : 0;
-	GLuint pshader = CompileShaderViaCode(pixelCode, GL_FRAGMENT_SHADER);
-	return LinkProgram(vshader, tcshader, teshader, gshader, pshader);
+	TRACE_ZONE("LinkProgramViaCode");
+	const char **codes[] = { vertexCode, tessellationControlCode, tessellationEvalCode, geometryCode, pixelCode };
+	GLenum types[] = { GL_VERTEX_SHADER, GL_TESS_CONTROL_SHADER, GL_TESS_EVALUATION_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER };
+	return vertexCode && pixelCode? LinkStages(5, codes, types) : 0;
 }
 
-void LinkProgramViaCode(GLuint computeProgram, const char **computeCode) {
-	GLuint computeShader = CompileShaderViaCode(computeCode, GL_COMPUTE_SHADER);
-	glAttachShader(computeProgram, computeShader);
-	glLinkProgram(computeProgram);
-	glDetachShader(computeProgram, computeShader);
-	glDeleteShader(computeShader);
-	GLint status;
-	glGetProgramiv(computeProgram, GL_LINK_STATUS, &status);
-	if (status == GL_FALSE) PrintProgramLog(computeProgram);
+GLuint LinkProgramViaCode(const char **computeCode) {
+	TRACE_ZONE("LinkProgramViaCode");
+	const char **codes[] = { computeCode };
+	GLenum types[] = { GL_COMPUTE_SHADER };
+	return LinkStages(1, codes, types);
 }
 
-GLuint LinkProgramViaCode(const char **computeCode) {
-	GLuint computeProgram = glCreateProgram();
-	LinkProgramViaCode(computeProgram, computeCode);
-	return computeProgram;
+GLuint LinkProgramDeferred(const char **vertexCode, const char **pixelCode) {
+	return LinkProgramDeferred(vertexCode, NULL, NULL, NULL, pixelCode);
+}
+
+GLuint LinkProgramDeferred(const char **vertexCode,
+						   const char **tessellationControlCode,
+						   const char **tessellationEvalCode,
+						   const char **geometryCode,
+						   const char **pixelCode) {
+	const char **codes[] = { vertexCode, tessellationControlCode, tessellationEvalCode, geometryCode, pixelCode };
+	GLenum types[] = { GL_VERTEX_SHADER, GL_TESS_CONTROL_SHADER, GL_TESS_EVALUATION_SHADER, GL_GEOMETRY_SHADER, GL_FRAGMENT_SHADER };
+	return vertexCode && pixelCode? LinkStages(5, codes, types, true) : 0;
+}
+
+int NPendingPrograms() {
+	return (int) pendingLinks.size();
+}
+
+bool ProgramPending(GLuint program) {
+	for (PendingLink &l : pendingLinks)
+		if (l.program == program)
+			return true;
+	return false;
+}
+
+bool ProgramReady(GLuint program) {
+	if (!ProgramPending(program))
+		return true;
+	if (!ParallelCompile())
+		return true; // status query would block, so finishing costs the same as waiting
+	GLint done = GL_FALSE;
+	glGetProgramiv(program, GL_COMPLETION_STATUS_KHR, &done);
+	return done == GL_TRUE;
+}
+
+bool FinishProgram(GLuint program) {
+	for (size_t i = 0; i < pendingLinks.size(); i++)
+		if (pendingLinks[i].program == program) {
+			PendingLink l = pendingLinks[i];
+			pendingLinks.erase(pendingLinks.begin()+i);
+			FinishLink(l);
+			break;
+		}
+	GLint status = GL_FALSE;
+	if (program)
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+	return status == GL_TRUE;
+}
+
+int FinishPrograms(bool onlyReady) {
+	int nFinished = 0;
+	for (size_t i = 0; i < pendingLinks.size(); )
+		if (!onlyReady || ProgramReady(pendingLinks[i].program)) {
+			PendingLink l = pendingLinks[i];
+			pendingLinks.erase(pendingLinks.begin()+i);
+			FinishLink(l);
+			nFinished++;
+		}
+		else i++;
+	return nFinished;
 }
 
 GLuint LinkProgramViaFile(const char *computeShaderFile) {
-	GLuint cshader = CompileShaderViaFile(computeShaderFile, GL_COMPUTE_SHADER);
-	if (!cshader)
+	std::string code;
+	if (!ReadShaderFile(computeShaderFile, code))
 		return 0;
-	GLuint program = glCreateProgram();
-	glAttachShader(program, cshader);
-	glLinkProgram(program);
-	GLint status;
-	glGetProgramiv(program, GL_LINK_STATUS, &status);
-	if (status == GL_FALSE) PrintProgramLog(program);
-	return program;
+	const char *c = code.c_str();
+	return LinkProgramViaCode(&c);
 }
 
 GLuint LinkProgram(GLuint vshader, GLuint pshader) {
@@ -233,22 +614,23 @@ GLuint LinkProgram(GLuint vshader, GLuint tcshader, GLuint teshader, GLuint gsha
 		GLint status;
 		glGetProgramiv(program, GL_LINK_STATUS, &status);
 		if (status == GL_FALSE) PrintProgramLog(program);
+		else BindFrameBlock(program);
 	}
 	return program;
 }
 
 GLuint LinkProgramViaFile(const char *vertexShaderFile, const char *pixelShaderFile) {
-	GLuint vshader = CompileShaderViaFile(vertexShaderFile, GL_VERTEX_SHADER);
-	GLuint fshader = CompileShaderViaFile(pixelShaderFile, GL_FRAGMENT_SHADER);
-	return LinkProgram(vshader, fshader);
+	std::string vcode, pcode;
+	if (!ReadShaderFile(vertexShaderFile, vcode) || !ReadShaderFile(pixelShaderFile, pcode))
+		return 0;
+	const char *v = vcode.c_str(), *p = pcode.c_str();
+	return LinkProgramViaCode(&v, &p);
 }
 
 // Miscellany
 
 int CurrentProgram() {
-	int program = 0;
-	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
-	return program;
+	return GetGLProgram();
 }
 
 void DeleteProgram(int program) {
@@ -267,9 +649,13 @@ void WriteProgramBinary(GLuint program, const char *filename) {
 	GLenum binaryFormat = 0;
 	GLsizei sizeBinary = 0, sizeEnum = sizeof(GLenum);
 	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &sizeBinary);
+	if (sizeBinary <= 0)
+		return;
 	std::vector<BYTE> data(sizeBinary);
 	glGetProgramBinary(program, sizeBinary, NULL, &binaryFormat, &data[0]);
 	FILE *out = fopen(filename, "wb");
+	if (!out)
+		return;
 	fwrite(&binaryFormat, sizeEnum, 1, out);
 	fwrite(&data[0], 1, sizeBinary, out);
 	fclose(out);
@@ -281,6 +667,10 @@ bool ReadProgramBinary(GLuint program, const char *filename) {
 		fseek(in, 0, SEEK_END);
 		long filesize = ftell(in);
 		int sizeEnum = sizeof(GLenum), sizeBinary = filesize-sizeEnum;
+		if (sizeBinary <= 0) {
+			fclose(in);
+			return false;
+		}
 		std::vector<BYTE> data(sizeBinary);
 		GLenum binaryFormat;
 		fseek(in, 0, 0);
@@ -288,7 +678,9 @@ bool ReadProgramBinary(GLuint program, const char *filename) {
 		fread((char *) &data[0], 1, sizeBinary, in);
 		fclose(in);
 		glProgramBinary(program, binaryFormat, &data[0], sizeBinary);
-		return true;
+		GLint status = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		return status == GL_TRUE;
 	}
 	return false;
 }
@@ -430,6 +822,468 @@ bool SetUniform(int program, const char *name, mat4 m, bool report) {
 	return true;
 }
 
+// Frame Statistics
+
+#ifdef GL_STATS
+
+namespace {
+
+GLFrameStats statsCurrent, statsLast;
+bool statsActive = false;
+
+decltype(glad_glDrawArrays) realDrawArrays = NULL;
+decltype(glad_glDrawElements) realDrawElements = NULL;
+decltype(glad_glDrawArraysInstanced) realDrawArraysInstanced = NULL;
+decltype(glad_glDrawElementsInstanced) realDrawElementsInstanced = NULL;
+decltype(glad_glUseProgram) realStatsUseProgram = NULL;
+decltype(glad_glBindTexture) realStatsBindTexture = NULL;
+decltype(glad_glBindBuffer) realStatsBindBuffer = NULL;
+decltype(glad_glBindVertexArray) realStatsBindVertexArray = NULL;
+decltype(glad_glBufferData) realBufferData = NULL;
+decltype(glad_glBufferSubData) realBufferSubData = NULL;
+decltype(glad_glReadPixels) realReadPixels = NULL;
+
+long long Triangles(GLenum mode, GLsizei count) {
+	switch (mode) {
+		case GL_TRIANGLES: return count/3;
+		case GL_TRIANGLE_STRIP:
+		case GL_TRIANGLE_FAN: return count > 2? count-2 : 0;
+#ifdef GL_QUADS
+		case GL_QUADS: return 2*(count/4);
+#endif
+	}
+	return 0; // points, lines, patches (tessellated on GPU, so unknown)
+}
+
+void Draw(GLenum mode, GLsizei count, GLsizei instances) {
+	statsCurrent.draws++;
+	statsCurrent.vertices += (long long) count*instances;
+	statsCurrent.triangles += Triangles(mode, count)*instances;
+}
+
+void APIENTRY StatsDrawArrays(GLenum mode, GLint first, GLsizei count) {
+	Draw(mode, count, 1);
+	realDrawArrays(mode, first, count);
+}
+
+void APIENTRY StatsDrawElements(GLenum mode, GLsizei count, GLenum type, const void *indices) {
+	Draw(mode, count, 1);
+	realDrawElements(mode, count, type, indices);
+}
+
+void APIENTRY StatsDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei n) {
+	Draw(mode, count, n);
+	realDrawArraysInstanced(mode, first, count, n);
+}
+
+void APIENTRY StatsDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei n) {
+	Draw(mode, count, n);
+	realDrawElementsInstanced(mode, count, type, indices, n);
+}
+
+void APIENTRY StatsUseProgram(GLuint program) {
+	statsCurrent.programBinds++;
+	realStatsUseProgram(program);
+}
+
+void APIENTRY StatsBindTexture(GLenum target, GLuint texture) {
+	statsCurrent.textureBinds++;
+	realStatsBindTexture(target, texture);
+}
+
+void APIENTRY StatsBindBuffer(GLenum target, GLuint buffer) {
+	statsCurrent.bufferBinds++;
+	realStatsBindBuffer(target, buffer);
+}
+
+void APIENTRY StatsBindVertexArray(GLuint vao) {
+	statsCurrent.vertexArrayBinds++;
+	realStatsBindVertexArray(vao);
+}
+
+void APIENTRY StatsBufferData(GLenum target, GLsizeiptr size, const void *data, GLenum usage) {
+	if (data) {
+		// allocation without data (or orphaning) is not an upload
+		statsCurrent.uploads++;
+		statsCurrent.uploadBytes += size;
+	}
+	realBufferData(target, size, data, usage);
+}
+
+void APIENTRY StatsBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void *data) {
+	statsCurrent.uploads++;
+	statsCurrent.uploadBytes += size;
+	realBufferSubData(target, offset, size, data);
+}
+
+void APIENTRY StatsReadPixels(GLint x, GLint y, GLsizei w, GLsizei h, GLenum format, GLenum type, void *pixels) {
+	statsCurrent.readPixels++;
+	realReadPixels(x, y, w, h, format, type, pixels);
+}
+
+} // end namespace
+
+bool InitGLStats() {
+	if (statsActive)
+		return true;
+	if (!glad_glDrawArrays)
+		return false;
+	realDrawArrays = glad_glDrawArrays;						glad_glDrawArrays = StatsDrawArrays;
+	realDrawElements = glad_glDrawElements;					glad_glDrawElements = StatsDrawElements;
+	realDrawArraysInstanced = glad_glDrawArraysInstanced;	glad_glDrawArraysInstanced = StatsDrawArraysInstanced;
+	realDrawElementsInstanced = glad_glDrawElementsInstanced; glad_glDrawElementsInstanced = StatsDrawElementsInstanced;
+	realStatsUseProgram = glad_glUseProgram;				glad_glUseProgram = StatsUseProgram;
+	realStatsBindTexture = glad_glBindTexture;				glad_glBindTexture = StatsBindTexture;
+	realStatsBindBuffer = glad_glBindBuffer;				glad_glBindBuffer = StatsBindBuffer;
+	realStatsBindVertexArray = glad_glBindVertexArray;		glad_glBindVertexArray = StatsBindVertexArray;
+	realBufferData = glad_glBufferData;						glad_glBufferData = StatsBufferData;
+	realBufferSubData = glad_glBufferSubData;				glad_glBufferSubData = StatsBufferSubData;
+	realReadPixels = glad_glReadPixels;						glad_glReadPixels = StatsReadPixels;
+	return statsActive = true;
+}
+
+void GLStatsFrame() {
+	statsLast = statsCurrent;
+	statsCurrent = GLFrameStats();
+}
+
+GLFrameStats GetGLFrameStats(bool current) {
+	return current? statsCurrent : statsLast;
+}
+
+#else
+
+bool InitGLStats() { return false; }
+void GLStatsFrame() { }
+GLFrameStats GetGLFrameStats(bool /*current*/) { return GLFrameStats(); }
+
+#endif
+
+void PrintGLFrameStats(const char *title) {
+#ifdef GL_STATS
+	GLFrameStats s = statsLast;
+	printf("%s%sdraws %i, triangles %lli, vertices %lli, binds (program %i, texture %i, buffer %i, vao %i), ",
+		title? title : "", title? ": " : "", s.draws, s.triangles, s.vertices, s.programBinds, s.textureBinds, s.bufferBinds, s.vertexArrayBinds);
+	printf("uploads %i (%lli bytes), read pixels %i\n", s.uploads, s.uploadBytes, s.readPixels);
+#else
+	printf("%s%sGL stats not compiled (define GL_STATS)\n", title? title : "", title? ": " : "");
+#endif
+}
+
+// Per-frame Uniform Block
+
+namespace {
+
+FrameBlock frameBlock, uploadedBlock;
+GLuint frameBuffer = 0;
+
+void UploadFrameBlock() {
+	if (!frameBuffer) {
+		glGenBuffers(1, &frameBuffer);
+		glBindBuffer(GL_UNIFORM_BUFFER, frameBuffer);
+		glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameBlock), &frameBlock, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		glBindBufferBase(GL_UNIFORM_BUFFER, FrameBlockBinding, frameBuffer);
+	}
+	else if (!memcmp(&frameBlock, &uploadedBlock, sizeof(FrameBlock)))
+		return;
+	else {
+		glBindBuffer(GL_UNIFORM_BUFFER, frameBuffer);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameBlock), &frameBlock);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+	uploadedBlock = frameBlock;
+}
+
+} // end namespace
+
+void UpdateFrameBlock(mat4 modelview, mat4 persp) {
+	int vp[4];
+	GetGLViewport(vp);
+	FrameBlock &f = frameBlock;
+	f.modelview = modelview;
+	f.persp = persp;
+	f.fullview = persp*modelview;
+	float w = (float) vp[2], h = (float) vp[3];
+	f.viewport = vec4((float) vp[0], (float) vp[1], w, h);
+	f.screenMode = Translate(-2*vp[0]/w-1, -2*vp[1]/h-1, 0)*Scale(2/w, 2/h, 1); // as ScreenMode (Draw.h)
+	UploadFrameBlock();
+}
+
+void UpdateFrameLights(int nLights, vec3 *lights, mat4 *modelview) {
+	FrameBlock &f = frameBlock;
+	f.nLights = nLights < MaxFrameLights? nLights : MaxFrameLights;
+	for (int i = 0; i < MaxFrameLights; i++)
+		f.lights[i] = i >= f.nLights? vec4() : modelview? *modelview*vec4(lights[i], 1) : vec4(lights[i], 1);
+	UploadFrameBlock();
+}
+
+const FrameBlock &GetFrameBlock() {
+	return frameBlock;
+}
+
+void BindFrameBlock(GLuint program) {
+	GLuint index = glGetUniformBlockIndex(program, "Frame");
+	if (index != GL_INVALID_INDEX)
+		glUniformBlockBinding(program, index, FrameBlockBinding);
+}
+
+// Program Reflection
+
+namespace {
+
+int UniformTypeBytes(GLenum type) {
+	switch (type) {
+		case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_UNSIGNED_INT_VEC2: case GL_BOOL_VEC2: return 8;
+		case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_UNSIGNED_INT_VEC3: case GL_BOOL_VEC3: return 12;
+		case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_UNSIGNED_INT_VEC4: case GL_BOOL_VEC4: case GL_FLOAT_MAT2: return 16;
+		case GL_FLOAT_MAT3: return 36;
+		case GL_FLOAT_MAT4: return 64;
+		case GL_FLOAT_MAT2x3: case GL_FLOAT_MAT3x2: return 24;
+		case GL_FLOAT_MAT2x4: case GL_FLOAT_MAT4x2: return 32;
+		case GL_FLOAT_MAT3x4: case GL_FLOAT_MAT4x3: return 48;
+		case GL_DOUBLE: return 8;
+		case GL_DOUBLE_VEC2: return 16;
+		case GL_DOUBLE_VEC3: return 24;
+		case GL_DOUBLE_VEC4: return 32;
+		default: return 4; // scalars, samplers, images
+	}
+}
+
+std::string BaseName(const char *name) {
+	// strip trailing "[0]" from array uniforms
+	const char *b = strchr(name, '[');
+	return b? std::string(name, b-name) : std::string(name);
+}
+
+} // end namespace
+
+bool Program::Reflect(GLuint program) {
+	id = program;
+	uniforms.resize(0);
+	attributes.resize(0);
+	cache.resize(0);
+	nUploads = nSkipped = 0;
+	if (!program)
+		return false;
+	if (ProgramPending(program))
+		FinishProgram(program);
+	char name[256];
+	GLint nUniforms = 0, nAttributes = 0, offset = 0;
+	glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &nUniforms);
+	for (int i = 0; i < nUniforms; i++) {
+		UniformInfo u;
+		glGetActiveUniform(program, i, sizeof(name), NULL, &u.size, &u.type, name);
+		u.location = glGetUniformLocation(program, name);
+		if (u.location < 0)
+			continue; // in a uniform block
+		u.name = BaseName(name);
+		u.nBytes = UniformTypeBytes(u.type)*u.size;
+		u.offset = offset;
+		offset += u.nBytes;
+		uniforms.push_back(u);
+	}
+	cache.resize(offset);
+	glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &nAttributes);
+	for (int i = 0; i < nAttributes; i++) {
+		AttributeInfo a;
+		glGetActiveAttrib(program, i, sizeof(name), NULL, &a.size, &a.type, name);
+		a.location = glGetAttribLocation(program, name);
+		a.name = BaseName(name);
+		attributes.push_back(a);
+	}
+	return true;
+}
+
+int Program::Uniform(const char *name, bool report) {
+	for (int i = 0; i < (int) uniforms.size(); i++)
+		if (uniforms[i].name == name)
+			return i;
+	if (report)
+		printf("can't find named uniform: %s\n", name);
+	return -1;
+}
+
+int Program::Attribute(const char *name, bool report) {
+	for (AttributeInfo &a : attributes)
+		if (a.name == name)
+			return a.location;
+	if (report)
+		printf("cant find attribute %s\n", name);
+	return -1;
+}
+
+void Program::Forget() {
+	for (UniformInfo &u : uniforms)
+		u.known = false;
+}
+
+bool Program::Changed(int handle, const void *v, int nBytes) {
+	if (handle < 0 || handle >= (int) uniforms.size())
+		return false;
+	UniformInfo &u = uniforms[handle];
+	nBytes = nBytes < u.nBytes? nBytes : u.nBytes;
+	char *c = cache.data()+u.offset;
+	if (u.known && !memcmp(c, v, nBytes)) {
+		nSkipped++;
+		return false;
+	}
+	memcpy(c, v, nBytes);
+	u.known = true;
+	nUploads++;
+	return true;
+}
+
+bool Program::Set(int handle, bool v) {
+	int i = v? 1 : 0;
+	if (!Changed(handle, &i, sizeof(int))) return false;
+	glProgramUniform1i(id, uniforms[handle].location, i);
+	return true;
+}
+
+bool Program::Set(int handle, int v) {
+	if (!Changed(handle, &v, sizeof(int))) return false;
+	glProgramUniform1i(id, uniforms[handle].location, v);
+	return true;
+}
+
+bool Program::Set(int handle, float v) {
+	if (!Changed(handle, &v, sizeof(float))) return false;
+	glProgramUniform1f(id, uniforms[handle].location, v);
+	return true;
+}
+
+bool Program::Set(int handle, vec2 v) {
+	if (!Changed(handle, &v, sizeof(vec2))) return false;
+	glProgramUniform2f(id, uniforms[handle].location, v.x, v.y);
+	return true;
+}
+
+bool Program::Set(int handle, vec3 v) {
+	if (!Changed(handle, &v, sizeof(vec3))) return false;
+	glProgramUniform3f(id, uniforms[handle].location, v.x, v.y, v.z);
+	return true;
+}
+
+bool Program::Set(int handle, vec4 v) {
+	if (!Changed(handle, &v, sizeof(vec4))) return false;
+	glProgramUniform4f(id, uniforms[handle].location, v.x, v.y, v.z, v.w);
+	return true;
+}
+
+bool Program::Set(int handle, mat4 m) {
+	if (!Changed(handle, &m[0][0], sizeof(mat4))) return false;
+	glProgramUniformMatrix4fv(id, uniforms[handle].location, 1, true, &m[0][0]);
+	return true;
+}
+
+bool Program::Setv(int handle, int count, const int *v) {
+	if (!Changed(handle, v, count*sizeof(int))) return false;
+	glProgramUniform1iv(id, uniforms[handle].location, count, v);
+	return true;
+}
+
+bool Program::Setv(int handle, int count, const float *v) {
+	if (!Changed(handle, v, count*sizeof(float))) return false;
+	glProgramUniform1fv(id, uniforms[handle].location, count, v);
+	return true;
+}
+
+bool Program::Set3v(int handle, int count, const float *v) {
+	if (!Changed(handle, v, 3*count*sizeof(float))) return false;
+	glProgramUniform3fv(id, uniforms[handle].location, count, v);
+	return true;
+}
+
+bool Program::Set4v(int handle, int count, const float *v) {
+	if (!Changed(handle, v, 4*count*sizeof(float))) return false;
+	glProgramUniform4fv(id, uniforms[handle].location, count, v);
+	return true;
+}
+
+void Program::VertexAttribPointer(int location, GLint ncomponents, GLsizei stride, const GLvoid *offset) {
+	if (location < 0)
+		return;
+	glEnableVertexAttribArray(location);
+	glVertexAttribPointer(location, ncomponents, GL_FLOAT, GL_FALSE, stride, offset);
+}
+
+void Program::Print() {
+	printf("program %i: %i uniforms, %i attributes\n", id, (int) uniforms.size(), (int) attributes.size());
+	for (UniformInfo &u : uniforms)
+		printf("  uniform %s: location %i, type 0x%x, size %i\n", u.name.c_str(), u.location, u.type, u.size);
+	for (AttributeInfo &a : attributes)
+		printf("  attribute %s: location %i, type 0x%x, size %i\n", a.name.c_str(), a.location, a.type, a.size);
+	printf("  %i uploads, %i skipped\n", nUploads, nSkipped);
+}
+
+// Shader Variants
+
+namespace {
+
+std::string Specialize(const char *code, const std::vector<std::string> &features, unsigned mask) {
+	// insert feature #defines after #version (which must come first)
+	std::string defines = "#define VARIANTS\n";
+	for (size_t i = 0; i < features.size(); i++)
+		defines += "#define "+features[i]+(mask & (1u << i)? " true\n" : " false\n");
+	std::string s(code);
+	size_t v = s.find("#version");
+	if (v == std::string::npos)
+		return defines+s;
+	size_t eol = s.find('\n', v);
+	return eol == std::string::npos? s+"\n"+defines : s.insert(eol+1, defines);
+}
+
+} // end namespace
+
+ShaderVariants::ShaderVariants(const char *vertexCode, const char *pixelCode, std::initializer_list<const char *> names)
+	: vertexCode(vertexCode), pixelCode(pixelCode) {
+	for (const char *n : names)
+		features.push_back(n);
+}
+
+unsigned ShaderVariants::Feature(const char *name) {
+	for (size_t i = 0; i < features.size(); i++)
+		if (features[i] == name)
+			return 1u << i;
+	return 0;
+}
+
+GLuint ShaderVariants::Prepare(unsigned mask) {
+	mask &= (1u << features.size())-1;
+	Variant &v = variants[mask];
+	if (!v.id) {
+		std::string vCode = Specialize(vertexCode, features, mask), pCode = Specialize(pixelCode, features, mask);
+		const char *vc = vCode.c_str(), *pc = pCode.c_str();
+		v.id = LinkProgramDeferred(&vc, &pc);
+	}
+	return v.id;
+}
+
+Program &ShaderVariants::Get(unsigned mask) {
+	mask &= (1u << features.size())-1;
+	Variant &v = variants[mask];
+	if (!v.id)
+		Prepare(mask);
+	if (ProgramPending(v.id))
+		FinishProgram(v.id);		// check status, bind Frame block, cache binary, free shaders
+	if (v.program.id != v.id)
+		v.program.Reflect(v.id);
+	return v.program;
+}
+
+Program &ShaderVariants::Use(unsigned mask) {
+	Program &p = Get(mask);
+	glUseProgram(p.id);
+	return p;
+}
+
+Program &ShaderVariants::Generic() {
+	if (!generic.id)
+		generic.Reflect(LinkProgramViaCode(&vertexCode, &pixelCode));
+	return generic;
+}
+
 // Attribute Access
 
 void DisableVertexAttribute(int program, const char *name) {
@@ -0,0 +1,192 @@
+// GpuTimer.cpp - scoped GPU timers, results read frames later so nothing blocks
+
+#include <glad.h>
+#include "GpuTimer.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+struct Record {
+	int timer = 0;
+	GLuint queries[2] = { 0, 0 };			// start, end timestamps; reused each time frame slot reused
+	bool ended = false;						// end timestamp issued within the frame
+};
+
+struct Frame {
+	std::vector<Record> records;
+	int nRecords = 0;
+	GLuint last = 0;						// query issued last in frame
+	bool pending = false;					// recorded, not yet collected
+};
+
+struct Timer {
+	const char *name = NULL;
+	std::vector<float> samples;				// ring of per-frame totals (ms)
+	int nSamples = 0, next = 0;
+	float last = 0;
+};
+
+const int NFrames = GpuTimerLatency+1;
+Frame frames[NFrames];
+int current = 0, frameCount = 0, window = 60, nDropped = 0;
+std::vector<Timer> timers;
+
+int TimerIndex(const char *name) {
+	for (size_t i = 0; i < timers.size(); i++)
+		if (timers[i].name == name || !strcmp(timers[i].name, name))
+			return (int) i;
+	Timer t;
+	t.name = name;
+	t.samples.resize(window);
+	timers.push_back(t);
+	return (int) timers.size()-1;
+}
+
+void AddSample(Timer &t, float ms) {
+	t.samples[t.next] = ms;
+	t.next = (t.next+1)%window;
+	t.nSamples = t.nSamples < window? t.nSamples+1 : window;
+	t.last = ms;
+}
+
+bool Collect(Frame &f) {
+	// read results if all available (timestamps complete in order issued, so test last issued)
+	GLint available = 0;
+	glGetQueryObjectiv(f.last, GL_QUERY_RESULT_AVAILABLE, &available);
+	if (!available)
+		return false;
+	std::vector<double> sums(timers.size(), 0);
+	std::vector<char> used(timers.size(), 0);
+	for (int i = 0; i < f.nRecords; i++) {
+		Record &r = f.records[i];
+		if (!r.ended)
+			continue;
+		GLuint64 start = 0, end = 0;
+		glGetQueryObjectui64v(r.queries[0], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(r.queries[1], GL_QUERY_RESULT, &end);
+		sums[r.timer] += end > start? 1.e-6*(double) (end-start) : 0;
+		used[r.timer] = 1;
+	}
+	for (size_t i = 0; i < timers.size(); i++)
+		if (used[i])
+			AddSample(timers[i], (float) sums[i]);
+	return true;
+}
+
+GpuTimerStat Stat(Timer &t) {
+	GpuTimerStat s;
+	s.name = t.name;
+	s.nFrames = t.nSamples;
+	s.lastMs = t.last;
+	if (t.nSamples) {
+		float sum = 0;
+		s.minMs = s.maxMs = t.samples[0];
+		for (int i = 0; i < t.nSamples; i++) {
+			float v = t.samples[i];
+			s.minMs = v < s.minMs? v : s.minMs;
+			s.maxMs = v > s.maxMs? v : s.maxMs;
+			sum += v;
+		}
+		s.avgMs = sum/t.nSamples;
+	}
+	return s;
+}
+
+} // end namespace
+
+// Timers
+
+GpuTimer::GpuTimer(const char *name) {
+	Frame &f = frames[current];
+	if (f.nRecords == (int) f.records.size()) {
+		f.records.push_back(Record());
+		glGenQueries(2, f.records.back().queries);
+	}
+	frame = frameCount;						// frame may end before timer does
+	record = f.nRecords;
+	Record &r = f.records[f.nRecords++];
+	r.timer = TimerIndex(name);
+	r.ended = false;
+	glQueryCounter(r.queries[0], GL_TIMESTAMP);
+	f.last = r.queries[0];
+}
+
+GpuTimer::~GpuTimer() {
+	// if frame has ended, its record is left unended and discarded
+	if (frame != frameCount)
+		return;
+	Frame &f = frames[current];
+	Record &r = f.records[record];
+	glQueryCounter(r.queries[1], GL_TIMESTAMP);
+	r.ended = true;
+	f.last = r.queries[1];
+}
+
+void GpuTimerFrame() {
+	frames[current].pending = frames[current].nRecords > 0;
+	current = (current+1)%NFrames;
+	frameCount++;
+	// collect oldest first; stop at first frame still in flight
+	for (int k = 0; k < NFrames-1; k++) {
+		Frame &f = frames[(current+k)%NFrames];
+		if (!f.pending)
+			continue;
+		if (!Collect(f))
+			break;
+		f.pending = false;
+	}
+	// reuse oldest slot; if its results are still not available, drop them rather than wait
+	Frame &f = frames[current];
+	if (f.pending)
+		nDropped++;
+	f.pending = false;
+	f.nRecords = 0;
+	f.last = 0;
+}
+
+// Statistics
+
+void SetGpuTimerWindow(int nFrames) {
+	window = nFrames < 1? 1 : nFrames;
+	for (Timer &t : timers) {
+		t.samples.assign(window, 0);
+		t.nSamples = t.next = 0;
+	}
+}
+
+std::vector<GpuTimerStat> GpuTimerStats() {
+	std::vector<GpuTimerStat> stats;
+	for (Timer &t : timers)
+		stats.push_back(Stat(t));
+	return stats;
+}
+
+bool GpuTimerStats(const char *name, GpuTimerStat &stat) {
+	for (Timer &t : timers)
+		if (t.name == name || !strcmp(t.name, name)) {
+			stat = Stat(t);
+			return t.nSamples > 0;
+		}
+	return false;
+}
+
+void PrintGpuTimers() {
+	for (Timer &t : timers) {
+		GpuTimerStat s = Stat(t);
+		printf("%-24s %7.3f ms (min %7.3f, max %7.3f, %i frames)\n", s.name, s.avgMs, s.minMs, s.maxMs, s.nFrames);
+	}
+	if (nDropped)
+		printf("(%i frames dropped: results not available after %i frames)\n", nDropped, GpuTimerLatency);
+}
+
+void ClearGpuTimers() {
+	for (Frame &f : frames) {
+		for (Record &r : f.records)
+			glDeleteQueries(2, r.queries);
+		f = Frame();
+	}
+	timers.resize(0);
+	current = nDropped = 0;
+	frameCount++;							// timers alive now are discarded
+}
@@ -6,6 +6,7 @@
 #include "GLXtras.h"
 #include "Misc.h"
 #include "Letters.h"
+#include "VertexLayout.h"
 #include <stdio.h>
 
 namespace {
@@ -79,7 +80,11 @@ const char *pixelShader = R"(
 	}
 )";
 
-GLuint shaderProgram = 0, vBufferId = 0;
+GLuint shaderProgram = 0, vBufferId = 0, vao = 0;
+
+const VertexLayout layout = { { "point", 4, GL_FLOAT, false, 0, 4*sizeof(float) } };
+	// each vertex is 4 floats: x, y, u, v
+
 GLuint textureNameLower = 0, textureNameUpper = 0, textureNameNumber = 0;
 int textureUnitLower = 2, textureUnitUpper = 3, textureUnitNumber = 4; // this dies if GLUint?!
 
@@ -166,10 +171,10 @@ void Letter(int x, int y, char c, vec3 color, float ptSize) {
 		glBindBuffer(GL_ARRAY_BUFFER, vBufferId);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(float)*4*6, NULL, GL_DYNAMIC_DRAW);
 			// need 4 vertices for quad, but 6 if triangles
+		vao = GetVertexArray(vBufferId, layout, shaderProgram);
 	}
+	glBindVertexArray(vao);
 	glBindBuffer(GL_ARRAY_BUFFER, vBufferId);
-	VertexAttribPointer(shaderProgram, "point", 4, 4*sizeof(float), 0);
-		// each vertex is 4 floats, stride is 4 floats
 	int texUnit = type == Upper? textureUnitUpper : type == Lower? textureUnitLower : textureUnitNumber;
 	GLuint texName = type == Upper? textureNameUpper : type == Lower? textureNameLower : textureNameNumber;
 	glActiveTexture(GL_TEXTURE0+texUnit);
@@ -1,17 +1,28 @@
 // Mesh.cpp - mesh IO and operations (c) 2019-2022 Jules Bloomenthal
 
+#include "BVH.h"
 #include "CameraArcball.h"
 #include "GLXtras.h"
 #include "Draw.h"
+#include "Frustum.h"
 #include "Mesh.h"
+#include "MeshOptimize.h"
+#include "MeshSimplify.h"
 #include "Misc.h"
+#include "Trace.h"
 #include <assert.h>
 #include <iostream>
 #include <fstream>
 #include <direct.h>
 #include <float.h>
+#include <stddef.h>
 #include <string.h>
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
+#include <limits.h>
+#include <mutex>
+#include <thread>
 
 using std::string;
 using std::vector;
@@ -106,52 +117,69 @@ void MeshFramer::Draw(mat4 fullview) {
 
 namespace {
 
-GLuint meshShader = 0;
+struct MeshUniforms {
+	int model, pointOffset, pointScale, useTexture, textureName, outline, outlineColor, outlineWidth, transition, useInstance, defaultColor, opacity;
+};
 
 // Mesh Shaders
 
 const char *meshVertexShader = R"(
 	#version 330
+)" FRAME_BLOCK_GLSL R"(
 	layout (location = 0) in vec3 point;
 	layout (location = 1) in vec3 normal;
 	layout (location = 2) in vec2 uv;
 	layout (location = 3) in mat4 instance; // for use with glDrawArrays/ElementsInstanced
-	layout (location = 7) in vec3 color;	// unused?
+	layout (location = 7) in vec3 color;	// per instance, see Mesh::DisplayInstanced
+	layout (location = 8) in vec3 bary;		// barycentric, for outlines
 	out vec3 vPoint;
 	out vec3 vNormal;
 	out vec2 vUv;
 	out vec3 vColor;
+	out vec3 vBary;
 	uniform bool useInstance = false;
-	uniform mat4 modelview;
-	uniform mat4 persp;
+	uniform mat4 model;						// object to world; camera in Frame block
+	uniform vec3 pointOffset = vec3(0), pointScale = vec3(1); // dequantize (see MeshVertexFormat)
 	void main() {
-		mat4 m = useInstance? modelview*instance : modelview;
-		vPoint = (m*vec4(point, 1)).xyz;
+		mat4 m = frame.modelview*(useInstance? model*instance : model);
+		vPoint = (m*vec4(pointOffset+pointScale*point, 1)).xyz;
 		vNormal = (m*vec4(normal, 0)).xyz;
-		gl_Position = persp*vec4(vPoint, 1);
+		gl_Position = frame.persp*vec4(vPoint, 1);
 		vUv = uv;
 		vColor = color;
+		vBary = bary;
 	}
 )";
 
 const char *meshPixelShader = R"(
 	#version 330
+)" FRAME_BLOCK_GLSL R"(
 	in vec3 vPoint;
 	in vec3 vNormal;
 	in vec2 vUv;
 	in vec3 vColor;
+	in vec3 vBary;
 	out vec4 pColor;
+	#ifndef VARIANTS
 	uniform bool useLight = true;
-	uniform vec3 light;
-	uniform vec3 lights[20];
-	uniform int nlights = 0;
-	uniform vec3 defaultColor = vec3(1);
-	uniform bool useDefaultColor = true;
-	uniform float opacity = 1;
-	uniform sampler2D textureName;
 	uniform bool useTexture = false;
 	uniform bool useTint = false;
+	uniform bool useDefaultColor = true;
 	uniform bool fwdFacing = false;
+	#endif
+	uniform vec3 defaultColor = vec3(1);
+	uniform float opacity = 1;
+	uniform sampler2D textureName;
+	uniform int outline = 0;					// 0: none, 1: edges over surface, 2: edges only
+	uniform vec4 outlineColor = vec4(0, 0, 0, 1);
+	uniform float outlineWidth = 1;
+	uniform float transition = 1;
+	float EdgeDistance() {
+		// distance in pixels to nearest edge: barycentric divided by its screen-space rate of change
+		vec3 dx = dFdx(vBary), dy = dFdy(vBary);
+		vec3 d = vBary/max(sqrt(dx*dx+dy*dy), vec3(1e-6));
+		return min(d.x, min(d.y, d.z));
+	}
 	float Intensity(vec3 normalV, vec3 eyeV, vec3 point, vec3 light) {
 		vec3 lightV = normalize(light-point);		// light vector
 		vec3 reflectV = reflect(lightV, normalV);   // highlight vector
@@ -160,14 +188,16 @@ const char *meshPixelShader = R"(
 		return clamp(d+pow(s, 50), 0, 1);
 	}
 	void main() {
+		float edge = outline > 0? EdgeDistance() : 0; // before discard, so derivatives defined
 		vec3 N = normalize(vNormal);				// surface normal
 		if (fwdFacing && N.z < 0) discard;
 		vec3 E = normalize(vPoint);					// eye vector
 		float intensity = 1;
 		if (useLight) {
-			if (nlights == 0) intensity = Intensity(N, E, vPoint, light);
-			for (int i = 0; i < nlights; i++)
-				intensity += Intensity(N, E, vPoint, lights[i]);
+			// lights from Frame block, or a light at the eye if none
+			intensity = frame.nLights == 0? Intensity(N, E, vPoint, vec3(0)) : 0;
+			for (int i = 0; i < frame.nLights; i++)
+				intensity += Intensity(N, E, vPoint, frame.lights[i].xyz);
 			intensity = clamp(intensity, 0, 1);
 		}
 		vec3 color = useTexture? texture(textureName, vUv).rgb : useDefaultColor? defaultColor : vColor;
@@ -177,19 +207,74 @@ const char *meshPixelShader = R"(
 			color.b *= defaultColor.b;
 		}
 		pColor = vec4(intensity*color, opacity); // 1);
+		if (outline > 0) {
+			float t = smoothstep(outlineWidth-transition, outlineWidth+transition, edge);
+			if (outline == 2) {
+				if (t >= 1) discard;
+				pColor.a *= 1-t;
+			}
+			else
+				pColor = mix(outlineColor, pColor, t);
+		}
 	}
 )";
 
+// specializations of mesh shader, in MeshFeature order (see Mesh.h)
+ShaderVariants meshVariants(meshVertexShader, meshPixelShader, { "useLight", "useTexture", "useTint", "useDefaultColor", "fwdFacing" });
+
+struct MeshVariant {
+	Program *program = NULL;
+	MeshUniforms u;
+} meshVariantUniforms[32];
+
+int meshFeatures = MeshLight | MeshDefaultColor;
+vec3 meshColor(1, 1, 1);
+float meshOpacity = 1;
+
+MeshUniforms FindMeshUniforms(Program &p) {
+	return { p.Uniform("model"), p.Uniform("pointOffset"), p.Uniform("pointScale"), p.Uniform("useTexture"), p.Uniform("textureName"),
+			 p.Uniform("outline"), p.Uniform("outlineColor"), p.Uniform("outlineWidth"), p.Uniform("transition"), p.Uniform("useInstance"),
+			 p.Uniform("defaultColor"), p.Uniform("opacity") };
+}
+
+MeshVariant &GetMeshVariant(int features) {
+	// variant compiled, and its uniform handles resolved, on first use
+	MeshVariant &v = meshVariantUniforms[features & 31];
+	if (!v.program) {
+		v.program = &meshVariants.Get(features & 31);
+		v.u = FindMeshUniforms(*v.program);
+		char label[100];
+		sprintf(label, "mesh shader, features %i", features & 31);
+		LabelObject(GL_PROGRAM, v.program->id, label);
+	}
+	return v;
+}
+
 } // end namespace
 
-GLuint GetMeshShader() {
-	if (!meshShader)
-		meshShader = LinkProgramViaCode(&meshVertexShader, &meshPixelShader);
-	return meshShader;
+void SetMeshFeatures(int features) { meshFeatures = features; }
+
+int GetMeshFeatures() { return meshFeatures; }
+
+void SetMeshColor(vec3 color) { meshColor = color; }
+
+vec3 GetMeshColor() { return meshColor; }
+
+void SetMeshOpacity(float opacity) { meshOpacity = opacity; }
+
+float GetMeshOpacity() { return meshOpacity; }
+
+Program &GetMeshProgram(bool textured) {
+	int features = (meshFeatures & ~MeshTexture) | (textured? MeshTexture : 0);
+	return *GetMeshVariant(features).program;
 }
 
-GLuint UseMeshShader() {
-	GLuint s = GetMeshShader();
+GLuint GetMeshShader(bool textured) {
+	return GetMeshProgram(textured).id;
+}
+
+GLuint UseMeshShader(bool textured) {
+	GLuint s = GetMeshShader(textured);
 	glUseProgram(s);
 	return s;
 }
@@ -201,29 +286,234 @@ void Enable(int id, int ncomps, int offset) {
 	glVertexAttribPointer(id, ncomps, GL_FLOAT, GL_FALSE, 0, (void *) offset);
 }
 
+Mesh::~Mesh() {
+	lodJob.reset();							// cancel and join any level of detail build
+	GLuint buffers[] = { vBufferId, indexBufferId, edgeBufferId, outlineBufferId, instanceBufferId }, vaos[] = { vao, edgeVao, outlineVao };
+	glDeleteBuffers(5, buffers);
+	glDeleteVertexArrays(3, vaos);
+}
+
+namespace {
+
+unsigned short Half(float f) {
+	// float to IEEE half, rounded to nearest; out of range values clamp to max half
+	unsigned int x;
+	memcpy(&x, &f, 4);
+	unsigned int sign = (x >> 16) & 0x8000, mantissa = x & 0x7fffff;
+	int e = (int) ((x >> 23) & 0xff)-127+15;
+	if (e >= 31) return (unsigned short) (sign | 0x7bff);
+	if (e <= 0) {
+		// subnormal half, or zero
+		if (e < -10) return (unsigned short) sign;
+		mantissa |= 0x800000;
+		int shift = 14-e;
+		return (unsigned short) (sign | ((mantissa+(1 << (shift-1))) >> shift));
+	}
+	unsigned int h = sign | (e << 10) | (mantissa >> 13);
+	return (unsigned short) (h+((mantissa >> 12) & 1));		// round; a carry correctly bumps exponent
+}
+
+unsigned int Pack1010102(vec3 n) {
+	// signed normalized 10-10-10-2, x in low bits (GL_INT_2_10_10_10_REV)
+	auto Comp = [](float v) { v = v < -1? -1 : v > 1? 1 : v; return (unsigned int) ((int) floor(v*511+.5f) & 0x3ff); };
+	return Comp(n.x) | (Comp(n.y) << 10) | (Comp(n.z) << 20);
+}
+
+struct PackedVertex {
+	float point[3];
+	unsigned int normal;
+	unsigned short uv[2];
+};
+
+struct QuantizedVertex {
+	unsigned short point[4];				// fourth unused, for alignment
+	unsigned int normal;
+	unsigned short uv[2];
+};
+
+void SetVertexArrays(Mesh &m, int nPts, int nNrms, int nUvs, int stride) {
+	// create vertex array objects for mesh, one for triangles and one for edges
+	// the two differ only in their element buffer
+	// enable attributes for vertex buffer in m.vertexFormat (stride 0 if planar)
+	int sizePoints = nPts*sizeof(vec3), sizeNormals = nNrms*sizeof(vec3);
+	if (!m.vao)
+		glGenVertexArrays(1, &m.vao);
+	if (!m.edgeVao)
+		glGenVertexArrays(1, &m.edgeVao);
+	glBindBuffer(GL_ARRAY_BUFFER, m.vBufferId);
+	for (GLuint a : { m.vao, m.edgeVao }) {
+		glBindVertexArray(a);
+		// enable attributes
+		if (m.vertexFormat == MeshPlanar) {
+			Enable(0, 3, 0);								// VertexAttribPointer(shader, "point", 3, 0, (void *) 0);
+			if (nNrms) Enable(1, 3, sizePoints);			// VertexAttribPointer(shader, "normal", 3, 0, (void *) sizePoints);
+			else glDisableVertexAttribArray(1);
+			if (nUvs) Enable(2, 2, sizePoints+sizeNormals); // VertexAttribPointer(shader, "uv", 2, 0, (void *) (sizePoints+sizeNormals));
+			else glDisableVertexAttribArray(2);
+		}
+		else {
+			bool quantized = m.vertexFormat == MeshQuantized;
+			size_t normalOffset = quantized? offsetof(QuantizedVertex, normal) : offsetof(PackedVertex, normal);
+			size_t uvOffset = quantized? offsetof(QuantizedVertex, uv) : offsetof(PackedVertex, uv);
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, quantized? GL_UNSIGNED_SHORT : GL_FLOAT, quantized? GL_TRUE : GL_FALSE, stride, (void *) 0);
+			if (nNrms) {
+				glEnableVertexAttribArray(1);
+				glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride, (void *) normalOffset);
+			}
+			else glDisableVertexAttribArray(1);
+			if (nUvs) {
+				glEnableVertexAttribArray(2);
+				glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride, (void *) uvOffset);
+			}
+			else glDisableVertexAttribArray(2);
+		}
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+}
+
+void UploadIndices(Mesh &m, const int *tris, int nTris, const int *edges, int nEdges) {
+	// element buffer bindings are recorded in the vertex array objects
+	if (!m.vao)
+		return;
+	if (!m.indexBufferId)
+		glGenBuffers(1, &m.indexBufferId);
+	if (!m.edgeBufferId)
+		glGenBuffers(1, &m.edgeBufferId);
+	glBindVertexArray(m.vao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.indexBufferId);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, nTris*sizeof(int), tris, GL_STATIC_DRAW);
+	glBindVertexArray(m.edgeVao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.edgeBufferId);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, nEdges*sizeof(int), edges, GL_STATIC_DRAW);
+	glBindVertexArray(0);
+	m.nIndices = nTris;
+	m.nEdgeIndices = nEdges;
+	// outline vertices and levels of detail now stale
+	m.nOutlineVertices = 0;
+	m.lods.resize(0);
+	m.lodJob.reset();
+}
+
+void MeshIndices(Mesh &m, vector<int> &tris, vector<int> &edges) {
+	// triangle indices, quads split along i1-i3
+	tris.resize(3*(m.triangles.size()+2*m.quads.size()));
+	int n = 0;
+	for (int3 &t : m.triangles) {
+		tris[n++] = t.i1; tris[n++] = t.i2; tris[n++] = t.i3;
+	}
+	for (int4 &q : m.quads) {
+		tris[n++] = q.i1; tris[n++] = q.i2; tris[n++] = q.i3;
+		tris[n++] = q.i1; tris[n++] = q.i3; tris[n++] = q.i4;
+	}
+	// unique edges, each keyed by its (lesser, greater) vertex ids
+	vector<unsigned long long> keys;
+	keys.reserve(3*m.triangles.size()+4*m.quads.size());
+	auto AddEdge = [&keys](int a, int b) {
+		keys.push_back(a < b? ((unsigned long long) a << 32) | (unsigned) b : ((unsigned long long) b << 32) | (unsigned) a);
+	};
+	for (int3 &t : m.triangles) {
+		AddEdge(t.i1, t.i2); AddEdge(t.i2, t.i3); AddEdge(t.i3, t.i1);
+	}
+	for (int4 &q : m.quads) {
+		AddEdge(q.i1, q.i2); AddEdge(q.i2, q.i3); AddEdge(q.i3, q.i4); AddEdge(q.i4, q.i1);
+	}
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+	edges.resize(2*keys.size());
+	for (size_t i = 0; i < keys.size(); i++) {
+		edges[2*i] = (int) (keys[i] >> 32);
+		edges[2*i+1] = (int) (keys[i] & 0xffffffff);
+	}
+}
+
+void SetBounds(Mesh &m, const vector<vec3> &pts) {
+	// box, and sphere centered on box
+	if (pts.empty()) {
+		m.boundsMin = m.boundsMax = m.sphereCenter = vec3(0, 0, 0);
+		m.sphereRadius = -1;
+	}
+	else {
+		MinMax((vector<vec3> &) pts, m.boundsMin, m.boundsMax);
+		m.sphereCenter = .5f*(m.boundsMin+m.boundsMax);
+		float r2 = 0;
+		for (const vec3 &p : pts) {
+			vec3 d = p-m.sphereCenter;
+			r2 = std::max(r2, dot(d, d));
+		}
+		m.sphereRadius = sqrt(r2);
+	}
+	m.boundsDirty = true;
+}
+
+} // end namespace
+
+void Mesh::UpdateBounds() { SetBounds(*this, points); }
+
 void Mesh::Buffer(vector<vec3> &pts, vector<vec3> *nrms, vector<vec2> *tex) {
+	TRACE_ZONE("Mesh::Buffer");
 	int nPts = pts.size(), nNrms = nrms? nrms->size() : 0, nUvs = tex? tex->size() : 0;
 	if (!nPts) { printf("mesh missing points\n"); return; }
+	if (nNrms && nNrms != nPts) { printf("mesh normals/points mismatch\n"); nNrms = 0; }
+	if (nUvs && nUvs != nPts) { printf("mesh uvs/points mismatch\n"); nUvs = 0; }
+	SetBounds(*this, pts);
 	// create vertex buffer
-	glGenBuffers(1, &vBufferId);
+	if (!vBufferId)
+		glGenBuffers(1, &vBufferId);
 	glBindBuffer(GL_ARRAY_BUFFER, vBufferId);
-	// allocate GPU memory for vertex locations and colors
-	int sizePoints = nPts*sizeof(vec3), sizeNormals = nNrms*sizeof(vec3), sizeUvs = nUvs*sizeof(vec2);
-	int bufferSize = sizePoints+sizeUvs+sizeNormals;
-	glBufferData(GL_ARRAY_BUFFER, bufferSize, NULL, GL_STATIC_DRAW);
-	// load data to buffer
-	if (nPts) glBufferSubData(GL_ARRAY_BUFFER, 0, sizePoints, pts.data());
-	if (nNrms) glBufferSubData(GL_ARRAY_BUFFER, sizePoints, sizeNormals, nrms->data());
-	if (nUvs) glBufferSubData(GL_ARRAY_BUFFER, sizePoints+sizeNormals, sizeUvs, tex->data());
-	// create vertex array object for mesh
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-	// enable attributes
-	if (nPts) Enable(0, 3, 0);						// VertexAttribPointer(shader, "point", 3, 0, (void *) 0);
-	if (nNrms) Enable(1, 3, sizePoints);			// VertexAttribPointer(shader, "normal", 3, 0, (void *) sizePoints);
-	if (nUvs) Enable(2, 2, sizePoints+sizeNormals); // VertexAttribPointer(shader, "uv", 2, 0, (void *) (sizePoints+sizeNormals));
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
+	int sizePoints = nPts*sizeof(vec3), sizeNormals = nNrms*sizeof(vec3), sizeUvs = nUvs*sizeof(vec2), stride = 0;
+	if (vertexFormat == MeshPlanar) {
+		// allocate GPU memory for vertex locations, normals, uvs
+		int bufferSize = sizePoints+sizeUvs+sizeNormals;
+		glBufferData(GL_ARRAY_BUFFER, bufferSize, NULL, GL_STATIC_DRAW);
+		// load data to buffer
+		if (nPts) glBufferSubData(GL_ARRAY_BUFFER, 0, sizePoints, pts.data());
+		if (nNrms) glBufferSubData(GL_ARRAY_BUFFER, sizePoints, sizeNormals, nrms->data());
+		if (nUvs) glBufferSubData(GL_ARRAY_BUFFER, sizePoints+sizeNormals, sizeUvs, tex->data());
+	}
+	else if (vertexFormat == MeshPacked) {
+		vector<PackedVertex> vertices(nPts);
+		for (int i = 0; i < nPts; i++) {
+			PackedVertex &v = vertices[i];
+			v.point[0] = pts[i].x; v.point[1] = pts[i].y; v.point[2] = pts[i].z;
+			v.normal = nNrms? Pack1010102((*nrms)[i]) : 0;
+			v.uv[0] = nUvs? Half((*tex)[i].x) : 0;
+			v.uv[1] = nUvs? Half((*tex)[i].y) : 0;
+		}
+		stride = sizeof(PackedVertex);
+		glBufferData(GL_ARRAY_BUFFER, nPts*stride, vertices.data(), GL_STATIC_DRAW);
+	}
+	else {
+		// 16-bit points relative to bounding box, restored in vertex shader by pointOffset+pointScale*point
+		vec3 min, max;
+		MinMax(pts, min, max);
+		pointOffset = min;
+		pointScale = max-min;
+		vec3 inv(pointScale.x > 0? 1/pointScale.x : 0, pointScale.y > 0? 1/pointScale.y : 0, pointScale.z > 0? 1/pointScale.z : 0);
+		vector<QuantizedVertex> vertices(nPts);
+		for (int i = 0; i < nPts; i++) {
+			QuantizedVertex &v = vertices[i];
+			vec3 p = pts[i]-min;
+			v.point[0] = (unsigned short) (p.x*inv.x*65535+.5f);
+			v.point[1] = (unsigned short) (p.y*inv.y*65535+.5f);
+			v.point[2] = (unsigned short) (p.z*inv.z*65535+.5f);
+			v.point[3] = 0;
+			v.normal = nNrms? Pack1010102((*nrms)[i]) : 0;
+			v.uv[0] = nUvs? Half((*tex)[i].x) : 0;
+			v.uv[1] = nUvs? Half((*tex)[i].y) : 0;
+		}
+		stride = sizeof(QuantizedVertex);
+		glBufferData(GL_ARRAY_BUFFER, nPts*stride, vertices.data(), GL_STATIC_DRAW);
+	}
+	SetVertexArrays(*this, nPts, nNrms, nUvs, stride);
+	BufferIndices();
+}
+
+void Mesh::BufferIndices() {
+	vector<int> tris, edges;
+	MeshIndices(*this, tris, edges);
+	UploadIndices(*this, tris.data(), tris.size(), edges.data(), edges.size());
 }
 
 void Mesh::Buffer() { Buffer(points, normals.size()? &normals : NULL, uvs.size()? &uvs : NULL); }
@@ -242,44 +532,779 @@ void Mesh::Set(vector<vec3> &pts, vector<vec3> *nrms, vector<vec2> *tex, vector<
 	Buffer(pts, nrms, tex);
 }
 
-void Mesh::Display(CameraAB camera, bool lines) {
-	int nTris = triangles.size(), nQuads = quads.size();
-	bool useTexture = textureUnit > 0 && uvs.size() > 0;
-	// enable shader and vertex array object
-	int shader = UseMeshShader();
-	glBindVertexArray(vao);
-	// texture
-	SetUniform(shader, "useTexture", useTexture);
+namespace {
+
+void BufferOutline(Mesh &m) {
+	// unindexed copy of triangles (quads split in two) with barycentric coordinates
+	// a quad's diagonal is hidden by holding the opposite barycentric at 1
+	int nTris = m.triangles.size(), nQuads = m.quads.size(), nVrts = 3*(nTris+2*nQuads);
+	bool hasNrms = m.normals.size() > 0, hasUvs = m.uvs.size() > 0;
+	vector<vec3> pts(nVrts), nrms(hasNrms? nVrts : 0), barys(nVrts);
+	vector<vec2> uvs(hasUvs? nVrts : 0);
+	int n = 0;
+	auto Add = [&](int id, vec3 b) {
+		pts[n] = m.points[id];
+		if (hasNrms) nrms[n] = m.normals[id];
+		if (hasUvs) uvs[n] = m.uvs[id];
+		barys[n++] = b;
+	};
+	vec3 b0(1, 0, 0), b1(0, 1, 0), b2(0, 0, 1);
+	for (int3 &t : m.triangles) {
+		Add(t.i1, b0); Add(t.i2, b1); Add(t.i3, b2);
+	}
+	for (int4 &q : m.quads) {
+		Add(q.i1, b0+b1); Add(q.i2, b1); Add(q.i3, b1+b2);	// diagonal i1-i3 opposite i2
+		Add(q.i1, b0+b2); Add(q.i3, b1+b2); Add(q.i4, b2);	// diagonal i1-i3 opposite i4
+	}
+	if (!m.outlineBufferId)
+		glGenBuffers(1, &m.outlineBufferId);
+	if (!m.outlineVao)
+		glGenVertexArrays(1, &m.outlineVao);
+	int sizePts = nVrts*sizeof(vec3), sizeNrms = nrms.size()*sizeof(vec3), sizeUvs = uvs.size()*sizeof(vec2);
+	glBindVertexArray(m.outlineVao);
+	glBindBuffer(GL_ARRAY_BUFFER, m.outlineBufferId);
+	glBufferData(GL_ARRAY_BUFFER, 2*sizePts+sizeNrms+sizeUvs, NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sizePts, pts.data());
+	if (sizeNrms) glBufferSubData(GL_ARRAY_BUFFER, sizePts, sizeNrms, nrms.data());
+	if (sizeUvs) glBufferSubData(GL_ARRAY_BUFFER, sizePts+sizeNrms, sizeUvs, uvs.data());
+	glBufferSubData(GL_ARRAY_BUFFER, sizePts+sizeNrms+sizeUvs, sizePts, barys.data());
+	Enable(0, 3, 0);
+	if (sizeNrms) Enable(1, 3, sizePts); else glDisableVertexAttribArray(1);
+	if (sizeUvs) Enable(2, 2, sizePts+sizeNrms); else glDisableVertexAttribArray(2);
+	Enable(8, 3, sizePts+sizeNrms+sizeUvs);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindVertexArray(0);
+	m.nOutlineVertices = nVrts;
+}
+
+MeshVariant &SetMeshUniforms(Mesh &m, const CameraAB &camera, int excludeFeatures = 0) {
+	// enable shader variant for current features (less any excluded) and mesh, set texture and transform uniforms
+	UpdateFrameBlock(camera.modelview, camera.persp);	// skipped if camera unchanged
+	bool useTexture = m.textureUnit > 0 && m.uvs.size() > 0;
+	int features = (meshFeatures & ~MeshTexture & ~excludeFeatures) | (useTexture? MeshTexture : 0);
+	MeshVariant &v = GetMeshVariant(features);
+	glUseProgram(v.program->id);
 	if (useTexture) {
-		glActiveTexture(GL_TEXTURE0+textureName);   // Unit? active texture corresponds with textureUnit or textureName?
-		glBindTexture(GL_TEXTURE_2D, textureName);  // bound texture and shader id correspond with textureName
-		SetUniform(shader, "textureName", (int) textureName);
-	}
-	// set custom transform and draw (xform = mesh transforms X view transform)
-	SetUniform(shader, "modelview", camera.modelview*transform);
-	SetUniform(shader, "persp", camera.persp);
-	if (lines) {
-		for (int i = 0; i < nTris; i++)
-			glDrawElements(GL_LINE_LOOP, 3, GL_UNSIGNED_INT, &triangles[i]);
-		for (int i = 0; i < nQuads; i++)
-			glDrawElements(GL_LINE_LOOP, 4, GL_UNSIGNED_INT, &quads[i]);
+		glActiveTexture(GL_TEXTURE0+m.textureName);   // Unit? active texture corresponds with textureUnit or textureName?
+		glBindTexture(GL_TEXTURE_2D, m.textureName);  // bound texture and shader id correspond with textureName
+		v.program->Set(v.u.textureName, (int) m.textureName);
 	}
-	else {
-		glDrawElements(GL_TRIANGLES, 3*nTris, GL_UNSIGNED_INT, triangles.data());
-		glDrawElements(GL_QUADS, 4*nQuads, GL_UNSIGNED_INT, quads.data());
+	// set mesh transform (view transform is in Frame block)
+	v.program->Set(v.u.model, m.transform);
+	bool quantized = m.vertexFormat == MeshQuantized;
+	v.program->Set(v.u.pointOffset, quantized? m.pointOffset : vec3(0, 0, 0));
+	v.program->Set(v.u.pointScale, quantized? m.pointScale : vec3(1, 1, 1));
+	v.program->Set(v.u.defaultColor, meshColor);
+	v.program->Set(v.u.opacity, meshOpacity);
+	return v;
+}
+
+void DrawOutline(Mesh &m, MeshVariant &v, int mode, vec4 outlineColor, float outlineWidth, float transition) {
+	if (!m.nOutlineVertices && (m.triangles.size() || m.quads.size()))
+		BufferOutline(m);
+	Program &p = *v.program;
+	p.Set(v.u.outline, mode);
+	p.Set(v.u.outlineColor, outlineColor);
+	p.Set(v.u.outlineWidth, outlineWidth);
+	p.Set(v.u.transition, transition);
+	// outline vertices are always float, whatever the mesh vertex format
+	p.Set(v.u.pointOffset, vec3(0, 0, 0));
+	p.Set(v.u.pointScale, vec3(1, 1, 1));
+	glBindVertexArray(m.outlineVao);
+	glDrawArrays(GL_TRIANGLES, 0, m.nOutlineVertices);
+	glBindVertexArray(0);
+	p.Set(v.u.outline, 0);
+}
+
+} // end namespace
+
+// Levels of Detail
+
+const float LODRatios[] = { .5f, .25f, .125f, .0625f };	// of full mesh triangles
+const int NLODs = sizeof(LODRatios)/sizeof(float);
+
+struct MeshLODJob {
+	// levels are simplified on a worker thread, and uploaded by SelectLOD as each is ready
+	// destroying a job cancels and joins its worker
+	vector<vec3> points;
+	vector<int3> triangles;					// full mesh, quads split
+	vector<int3> lods[NLODs];
+	float errors[NLODs] = { 0 };
+	int firstIndex[NLODs+1] = { 0 };		// levels packed after full mesh, within nIndices reserved
+	int nIndices = 0;
+	std::atomic<int> nReady{0};				// levels complete
+	std::atomic<bool> done{false}, cancel{false};
+	std::thread worker;
+	void Run() {
+		TRACE_ZONE("MeshLODJob");
+		vector<int3> lod = triangles;
+		float error = 0;
+		for (int i = 0; i < NLODs && !cancel; i++) {
+			int target = (int) (LODRatios[i]*triangles.size()), nBefore = lod.size();
+			if (target < 64)
+				break;
+			error += Simplify(points, lod, target, FLT_MAX, &cancel);	// error of each level relative to the last
+			if (cancel || lod.size() > .9f*nBefore || firstIndex[i]+3*(int) lod.size() > nIndices)
+				break;						// seams prevent reduction (or level would overrun reserved space)
+			lods[i] = lod;
+			firstIndex[i+1] = firstIndex[i]+3*lod.size();
+			errors[i] = error;
+			nReady.store(i+1, std::memory_order_release);
+		}
+		done = true;
+	}
+	~MeshLODJob();
+};
+
+namespace {
+
+bool meshLODs = false;
+float lodThreshold = 1;
+
+// jobs with a running worker, cancelled and joined at exit (before Trace, say, is destroyed)
+std::mutex lodJobsMutex;
+vector<MeshLODJob *> lodJobs;
+
+void JoinLODJobs() {
+	vector<MeshLODJob *> jobs;
+	{
+		std::lock_guard<std::mutex> lock(lodJobsMutex);
+		jobs.swap(lodJobs);
+	}
+	for (MeshLODJob *j : jobs) {
+		j->cancel = true;
+		if (j->worker.joinable())
+			j->worker.join();
+	}
+}
+
+void StartLODJob(MeshLODJob *job) {
+	static bool atExitSet = false;
+	std::lock_guard<std::mutex> lock(lodJobsMutex);
+	if (!atExitSet) {
+		atexit(JoinLODJobs);
+		atExitSet = true;
+	}
+	lodJobs.push_back(job);
+	job->worker = std::thread([job]() { job->Run(); });
+}
+
+float MaxScale(const mat4 &m) {
+	// largest scale of upper 3x3
+	float s = 0;
+	for (int k = 0; k < 3; k++)
+		s = std::max(s, length(vec3(m[0][k], m[1][k], m[2][k])));
+	return s;
+}
+
+void UploadLODs(Mesh &m, MeshLODJob &job) {
+	// upload levels completed since last call, each once, into its reserved range of the index buffer
+	int nReady = job.nReady.load(std::memory_order_acquire);
+	if ((int) m.lods.size() >= nReady)
+		return;
+	glBindVertexArray(m.vao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m.indexBufferId);
+	for (int i = m.lods.size(); i < nReady; i++) {
+		MeshLOD lod;
+		lod.firstIndex = job.firstIndex[i];
+		lod.nIndices = 3*job.lods[i].size();
+		lod.error = job.errors[i];
+		glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, lod.firstIndex*sizeof(int), lod.nIndices*sizeof(int), job.lods[i].data());
+		m.lods.push_back(lod);
+	}
+	glBindVertexArray(0);
+}
+
+} // end namespace
+
+MeshLODJob::~MeshLODJob() {
+	cancel = true;
+	{
+		std::lock_guard<std::mutex> lock(lodJobsMutex);
+		lodJobs.erase(std::remove(lodJobs.begin(), lodJobs.end(), this), lodJobs.end());
+	}
+	if (worker.joinable())
+		worker.join();
+}
+
+void SetMeshLODs(bool enable) { meshLODs = enable; }
+
+bool GetMeshLODs() { return meshLODs; }
+
+void SetMeshLODThreshold(float pixels) { lodThreshold = pixels; }
+
+float GetMeshLODThreshold() { return lodThreshold; }
+
+void Mesh::BuildLODs(bool background) {
+	lodJob.reset();							// cancel any build in progress
+	lods.resize(0);
+	UpdateBounds();
+	if (!vao)
+		return;
+	std::shared_ptr<MeshLODJob> job = std::make_shared<MeshLODJob>();
+	job->points = points;
+	job->triangles = triangles;
+	for (int4 &q : quads) {
+		job->triangles.push_back(int3(q.i1, q.i2, q.i3));
+		job->triangles.push_back(int3(q.i1, q.i3, q.i4));
 	}
+	// reserve index buffer for full mesh (as uploaded by UploadIndices) and levels at their target sizes
+	int nFull = 3*job->triangles.size(), nIndices = nFull;
+	for (int i = 0; i < NLODs; i++)
+		nIndices += 3*(int) (LODRatios[i]*job->triangles.size());
+	job->firstIndex[0] = nFull;
+	job->nIndices = nIndices;
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBufferId);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, nIndices*sizeof(int), NULL, GL_STATIC_DRAW);
+	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, nFull*sizeof(int), job->triangles.data());
 	glBindVertexArray(0);
+	lodJob = job;
+	if (background)
+		StartLODJob(job.get());
+	else
+		job->Run();
+}
+
+int Mesh::SelectLOD(const CameraAB &camera) {
+	if (lodJob) {
+		UploadLODs(*this, *lodJob);
+		if (lodJob->done)
+			lodJob.reset();					// joins worker
+	}
+	float radius = sphereRadius;
+	if (lods.empty() || radius <= 0)
+		return 0;
+	// bounding sphere in eye space
+	mat4 m = camera.modelview*transform;
+	vec4 c = m*vec4(sphereCenter, 1);
+	float scale = MaxScale(m);
+	float distance = -c.z;
+	if (distance <= radius*scale)
+		return 0;							// camera within sphere
+	int width, height;
+	GetViewportSize(width, height);
+	float pixels = radius*scale*camera.persp[1][1]*height/(2*distance);	// projected radius
+	for (int i = lods.size(); i > 0; i--)
+		if (lods[i-1].error/radius*pixels <= lodThreshold)
+			return i;
+	return 0;
+}
+
+void Mesh::Display(const CameraAB &camera, bool lines) {
+	SetMeshUniforms(*this, camera);
+	// edges only (drawn in surface color), or triangles
+	int lod = lines? 0 : SelectLOD(camera);
+	glBindVertexArray(lines? edgeVao : vao);
+	if (lod)
+		glDrawElements(GL_TRIANGLES, lods[lod-1].nIndices, GL_UNSIGNED_INT, (void *) (lods[lod-1].firstIndex*sizeof(int)));
+	else
+		glDrawElements(lines? GL_LINES : GL_TRIANGLES, lines? nEdgeIndices : nIndices, GL_UNSIGNED_INT, 0);
+	glBindVertexArray(0);
+}
+
+void Mesh::DisplayOutline(const CameraAB &camera, vec4 outlineColor, float outlineWidth, float transition) {
+	MeshVariant &v = SetMeshUniforms(*this, camera);
+	DrawOutline(*this, v, 1, outlineColor, outlineWidth, transition);
+}
+
+void Mesh::DisplayInstanced(const CameraAB &camera, const vector<mat4> &instances, const vector<vec3> *colors, bool lines) {
+	int nInstances = instances.size(), matrixSize = nInstances*sizeof(mat4);
+	if (!nInstances || !vao)
+		return;
+	bool useColors = colors && (int) colors->size() == nInstances;
+	// instance colors replace the default color for this draw
+	MeshVariant &v = SetMeshUniforms(*this, camera, useColors? MeshDefaultColor : 0);
+	// orphan and refill stream buffer: matrices, then colors
+	if (!instanceBufferId)
+		glGenBuffers(1, &instanceBufferId);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBufferId);
+	glBufferData(GL_ARRAY_BUFFER, matrixSize+(useColors? nInstances*sizeof(vec3) : 0), NULL, GL_STREAM_DRAW);
+	float *f = (float *) glMapBufferRange(GL_ARRAY_BUFFER, 0, matrixSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+	if (!f) {
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		return;
+	}
+	// GLSL mat4 attribute is read a column per location, so write matrices transposed
+	for (const mat4 &m : instances)
+		for (int c = 0; c < 4; c++)
+			for (int r = 0; r < 4; r++)
+				*f++ = m[r][c];
+	glUnmapBuffer(GL_ARRAY_BUFFER);
+	if (useColors)
+		glBufferSubData(GL_ARRAY_BUFFER, matrixSize, nInstances*sizeof(vec3), colors->data());
+	// instance attributes enabled in vertex array object only for this draw
+	GLuint a = lines? edgeVao : vao;
+	glBindVertexArray(a);
+	for (int c = 0; c < 4; c++) {
+		glEnableVertexAttribArray(3+c);
+		glVertexAttribPointer(3+c, 4, GL_FLOAT, GL_FALSE, sizeof(mat4), (void *) (c*sizeof(vec4)));
+		glVertexAttribDivisor(3+c, 1);
+	}
+	if (useColors) {
+		glEnableVertexAttribArray(7);
+		glVertexAttribPointer(7, 3, GL_FLOAT, GL_FALSE, 0, (void *) (size_t) matrixSize);
+		glVertexAttribDivisor(7, 1);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	v.program->Set(v.u.useInstance, true);
+	glDrawElementsInstanced(lines? GL_LINES : GL_TRIANGLES, lines? nEdgeIndices : nIndices, GL_UNSIGNED_INT, 0, nInstances);
+	v.program->Set(v.u.useInstance, false);
+	for (int i = 3; i <= 7; i++)
+		glDisableVertexAttribArray(i);
+	glBindVertexArray(0);
+}
+
+// Culling
+
+namespace {
+
+void MergeSphere(vec3 &center, float &radius, vec3 c, float r) {
+	// grow sphere (center, radius) to enclose sphere (c, r); negative radius is empty
+	if (r < 0)
+		return;
+	if (radius < 0) {
+		center = c;
+		radius = r;
+		return;
+	}
+	vec3 d = c-center;
+	float dist = length(d);
+	if (dist+r <= radius)
+		return;
+	if (dist+radius <= r) {
+		center = c;
+		radius = r;
+		return;
+	}
+	float newRadius = .5f*(dist+radius+r);
+	center = center+((newRadius-radius)/dist)*d;
+	radius = newRadius;
+}
+
+int DisplayCulled(Mesh &m, const CameraAB &camera, const Frustum &frustum, bool lines, bool inside) {
+	// inside: an ancestor's sphere is wholly within frustum
+	if (!inside) {
+		FrustumTest t = m.worldRadius < 0? FrustumOutside : frustum.TestSphere(m.worldCenter, m.worldRadius);
+		if (t == FrustumOutside)
+			return 0;
+		inside = t == FrustumInside;
+	}
+	int n = 0;
+	if (m.vao && m.sphereRadius >= 0 && (inside || frustum.TestBox(m.worldMin, m.worldMax) != FrustumOutside)) {
+		m.Display(camera, lines);
+		n++;
+	}
+	for (Mesh *c : m.children)
+		n += DisplayCulled(*c, camera, frustum, lines, inside);
+	return n;
+}
+
+} // end namespace
+
+bool Mesh::UpdateWorldBounds() {
+	bool changed = boundsDirty || memcmp(&boundsTransform, &transform, sizeof(mat4)) != 0;
+	if (changed) {
+		boundsTransform = transform;
+		boundsDirty = false;
+		// transformed box, after Arvo, Graphics Gems (1990)
+		for (int i = 0; i < 3; i++) {
+			float lo = transform[i][3], hi = lo;
+			for (int j = 0; j < 3; j++) {
+				float a = transform[i][j]*boundsMin[j], b = transform[i][j]*boundsMax[j];
+				lo += std::min(a, b);
+				hi += std::max(a, b);
+			}
+			worldMin[i] = lo;
+			worldMax[i] = hi;
+		}
+	}
+	for (Mesh *c : children)
+		changed = c->UpdateWorldBounds() || changed;
+	if (changed) {
+		vec4 c = transform*vec4(sphereCenter, 1);
+		worldCenter = vec3(c.x, c.y, c.z);
+		worldRadius = sphereRadius < 0? -1 : sphereRadius*MaxScale(transform);
+		for (Mesh *child : children)
+			MergeSphere(worldCenter, worldRadius, child->worldCenter, child->worldRadius);
+	}
+	return changed;
+}
+
+int Mesh::DisplayCulled(const CameraAB &camera, bool lines) {
+	UpdateWorldBounds();
+	return ::DisplayCulled(*this, camera, Frustum(camera.persp*camera.modelview), lines, false);
+}
+
+// Binary Mesh Cache
+
+namespace {
+
+bool meshCache = true, meshOptimize = false;
+
+const int MeshCacheVersion = 4;
+
+struct MeshCacheHeader {
+	char magic[4];							// "MSHB"
+	int version;
+	long long sourceModified;				// FileModified of source when written
+	long long mtlModified;					// latest FileModified of the source's mtllib files
+	int normalized;							// points as scaled by Read(..., normalize = true)
+	int welded;								// STL vertices welded (see SetWeldSTL)
+	int optimized;							// triangles and vertices reordered by Mesh::Optimize
+	int nPoints, nNormals, nUvs, nTriangles, nQuads, nIndices, nEdgeIndices, nGroups, nMtls, nNameChars, nMtlLibChars;
+	float boundsMin[3], boundsMax[3];		// floats, not vec3, so header is trivially copyable
+	// byte offsets, each a multiple of 16; points, normals, uvs are consecutive, as a planar vertex buffer
+	long long vertices, triangles, quads, indices, edges, groups, mtls, names, mtlLibs, fileSize;
+};
+
+struct MeshCacheGroup {
+	int startTriangle, nTriangles, name, nNameChars;
+};
+
+struct MeshCacheMtl {
+	int startTriangle, nTriangles, name, nNameChars;
+	vec3 ka, kd, ks;
+};
+
+std::atomic<bool> cacheWriteReported{false};
+
+long long Align16(long long n) { return (n+15) & ~15LL; }
+
+void ReportCacheWrite(const char *filename) {
+	// report the first failed write (eg, to a read-only directory), not one per mesh
+	if (!cacheWriteReported.exchange(true))
+		printf("can't write mesh cache %s (further failures not reported)\n", filename);
+}
+
+string MtlPath(const char *objFile, const char *mtlFile) {
+	// mtllib names are relative to the directory of the obj file
+	const char *p = strrchr(objFile, '/');
+	return p? string(objFile, p+1-objFile)+mtlFile : string(mtlFile);
+}
+
+string MtlLibraries(const char *objFile) {
+	// paths of files named by mtllib lines, each followed by newline
+	string libs;
+	MappedFile file;
+	if (!file.Open(objFile))
+		return libs;
+	for (const char *c = file.data, *end = file.data+file.size; c < end; ) {
+		const char *eol = (const char *) memchr(c, '\n', end-c);
+		eol = eol? eol : end;
+		while (c < eol && (*c == ' ' || *c == '\t'))
+			c++;
+		if (eol-c > 7 && !strncmp(c, "mtllib", 6) && isspace((unsigned char) c[6])) {
+			const char *w = c+6;
+			while (w < eol && isspace((unsigned char) *w))
+				w++;
+			const char *e = w;
+			while (e < eol && !isspace((unsigned char) *e))
+				e++;
+			if (e > w)
+				libs += MtlPath(objFile, string(w, e).c_str())+"\n";
+		}
+		c = eol+1;
+	}
+	return libs;
+}
+
+long long MtlModified(const string &libs) {
+	// latest modification time of the listed files (0 if none exist)
+	long long latest = 0;
+	for (size_t i = 0, n; i < libs.size(); i = n+1) {
+		n = libs.find('\n', i);
+		n = n == string::npos? libs.size() : n;
+		string path = libs.substr(i, n-i);
+		if (FileExists(path.c_str()))
+			latest = std::max(latest, (long long) FileModified(path.c_str()));
+	}
+	return latest;
+}
+
+bool WriteMeshCache(Mesh &m, const char *filename, time_t sourceModified, const string &mtlLibs,
+					bool normalized, bool welded, bool optimized) {
+	TRACE_ZONE("WriteMeshCache");
+	vector<int> tris, edges;
+	MeshIndices(m, tris, edges);
+	vector<MeshCacheGroup> groups(m.groups.size());
+	vector<MeshCacheMtl> mtls(m.materials.size());
+	string names;
+	for (size_t i = 0; i < groups.size(); i++) {
+		Group &g = m.groups[i];
+		groups[i] = { g.startTriangle, g.nTriangles, (int) names.size(), (int) g.name.size() };
+		names += g.name;
+	}
+	for (size_t i = 0; i < mtls.size(); i++) {
+		Mtl &t = m.materials[i];
+		mtls[i] = { t.startTriangle, t.nTriangles, (int) names.size(), (int) t.name.size(), t.ka, t.kd, t.ks };
+		names += t.name;
+	}
+	MeshCacheHeader h = {};
+	memcpy(h.magic, "MSHB", 4);
+	h.version = MeshCacheVersion;
+	h.sourceModified = (long long) sourceModified;
+	h.mtlModified = MtlModified(mtlLibs);
+	h.normalized = normalized? 1 : 0;
+	h.welded = welded? 1 : 0;
+	h.optimized = optimized? 1 : 0;
+	h.nPoints = m.points.size();
+	h.nNormals = m.normals.size();
+	h.nUvs = m.uvs.size();
+	h.nTriangles = m.triangles.size();
+	h.nQuads = m.quads.size();
+	h.nIndices = tris.size();
+	h.nEdgeIndices = edges.size();
+	h.nGroups = groups.size();
+	h.nMtls = mtls.size();
+	h.nNameChars = names.size();
+	h.nMtlLibChars = mtlLibs.size();
+	for (int k = 0; k < 3; k++) {
+		h.boundsMin[k] = m.boundsMin[k];
+		h.boundsMax[k] = m.boundsMax[k];
+	}
+	struct Block { long long *offset; const void *data; size_t size; } blocks[] = {
+		{ &h.vertices,  m.points.data(),    h.nPoints*sizeof(vec3) },
+		{ NULL,         m.normals.data(),   h.nNormals*sizeof(vec3) },
+		{ NULL,         m.uvs.data(),       h.nUvs*sizeof(vec2) },
+		{ &h.triangles, m.triangles.data(), h.nTriangles*sizeof(int3) },
+		{ &h.quads,     m.quads.data(),     h.nQuads*sizeof(int4) },
+		{ &h.indices,   tris.data(),        tris.size()*sizeof(int) },
+		{ &h.edges,     edges.data(),       edges.size()*sizeof(int) },
+		{ &h.groups,    groups.data(),      groups.size()*sizeof(MeshCacheGroup) },
+		{ &h.mtls,      mtls.data(),        mtls.size()*sizeof(MeshCacheMtl) },
+		{ &h.names,     names.data(),       names.size() },
+		{ &h.mtlLibs,   mtlLibs.data(),     mtlLibs.size() } };
+	long long offset = Align16(sizeof(h));
+	for (Block &b : blocks) {
+		if (b.offset)
+			*b.offset = offset = Align16(offset);
+		offset += b.size;						// normals, uvs follow points without padding
+	}
+	h.fileSize = offset;
+	FILE *out = fopen(filename, "wb");
+	if (!out) {
+		ReportCacheWrite(filename);
+		return false;
+	}
+	bool ok = fwrite(&h, sizeof(h), 1, out) == 1;
+	char zeros[16] = { 0 };
+	long long written = sizeof(h);
+	for (Block &b : blocks) {
+		if (b.offset) {
+			ok = ok && fwrite(zeros, 1, (size_t) (*b.offset-written), out) == (size_t) (*b.offset-written);
+			written = *b.offset;
+		}
+		ok = ok && (!b.size || fwrite(b.data, 1, b.size, out) == b.size);
+		written += b.size;
+	}
+	fclose(out);
+	if (!ok) {
+		ReportCacheWrite(filename);
+		remove(filename);
+	}
+	return ok;
+}
+
+bool ReadMeshCache(Mesh &m, const char *filename, time_t sourceModified, bool normalized, bool welded, bool optimized) {
+	// read mesh arrays; if planar vertex format, upload vertex and index buffers straight from the mapped file
+	TRACE_ZONE("ReadMeshCache");
+	MappedFile file;
+	if (!file.Open(filename) || file.size < sizeof(MeshCacheHeader))
+		return false;
+	MeshCacheHeader h;
+	memcpy(&h, file.data, sizeof(h));
+	if (memcmp(h.magic, "MSHB", 4) || h.version != MeshCacheVersion || h.fileSize != (long long) file.size ||
+		h.sourceModified != (long long) sourceModified || h.normalized != (normalized? 1 : 0) ||
+		h.welded != (welded? 1 : 0) || h.optimized != (optimized? 1 : 0))
+		return false;
+	// check each block lies within file
+	long long sizeVertices = h.nPoints*(long long) sizeof(vec3)+h.nNormals*(long long) sizeof(vec3)+h.nUvs*(long long) sizeof(vec2);
+	struct { long long offset, size; } blocks[] = {
+		{ h.vertices, sizeVertices }, { h.triangles, h.nTriangles*(long long) sizeof(int3) },
+		{ h.quads, h.nQuads*(long long) sizeof(int4) }, { h.indices, h.nIndices*(long long) sizeof(int) },
+		{ h.edges, h.nEdgeIndices*(long long) sizeof(int) }, { h.groups, h.nGroups*(long long) sizeof(MeshCacheGroup) },
+		{ h.mtls, h.nMtls*(long long) sizeof(MeshCacheMtl) }, { h.names, (long long) h.nNameChars },
+		{ h.mtlLibs, (long long) h.nMtlLibChars } };
+	for (auto &b : blocks)
+		if (b.offset < (long long) sizeof(h) || b.size < 0 || b.offset+b.size > h.fileSize)
+			return false;
+	// materials are read from mtllib files, so a change to any of them invalidates the cache
+	if (MtlModified(string(file.data+h.mtlLibs, h.nMtlLibChars)) != h.mtlModified)
+		return false;
+	const char *d = file.data;
+	const vec3 *points = (const vec3 *) (d+h.vertices), *normals = points+h.nPoints;
+	const vec2 *uvs = (const vec2 *) (normals+h.nNormals);
+	m.points.assign(points, points+h.nPoints);
+	m.normals.assign(normals, normals+h.nNormals);
+	m.uvs.assign(uvs, uvs+h.nUvs);
+	m.triangles.assign((const int3 *) (d+h.triangles), (const int3 *) (d+h.triangles)+h.nTriangles);
+	m.quads.assign((const int4 *) (d+h.quads), (const int4 *) (d+h.quads)+h.nQuads);
+	const char *names = d+h.names;
+	const MeshCacheGroup *groups = (const MeshCacheGroup *) (d+h.groups);
+	const MeshCacheMtl *mtls = (const MeshCacheMtl *) (d+h.mtls);
+	m.groups.resize(0);
+	m.materials.resize(0);
+	for (int i = 0; i < h.nGroups; i++) {
+		const MeshCacheGroup &g = groups[i];
+		if (g.name < 0 || g.nNameChars < 0 || g.name+g.nNameChars > h.nNameChars) return false;
+		m.groups.push_back(Group(g.startTriangle, string(names+g.name, g.nNameChars)));
+		m.groups.back().nTriangles = g.nTriangles;
+	}
+	for (int i = 0; i < h.nMtls; i++) {
+		const MeshCacheMtl &t = mtls[i];
+		if (t.name < 0 || t.nNameChars < 0 || t.name+t.nNameChars > h.nNameChars) return false;
+		m.materials.push_back(Mtl(t.startTriangle, string(names+t.name, t.nNameChars), t.ka, t.kd, t.ks));
+		m.materials.back().nTriangles = t.nTriangles;
+	}
+	m.boundsMin = vec3(h.boundsMin[0], h.boundsMin[1], h.boundsMin[2]);
+	m.boundsMax = vec3(h.boundsMax[0], h.boundsMax[1], h.boundsMax[2]);
+	int nNrms = h.nNormals == h.nPoints? h.nNormals : 0, nUvs = h.nUvs == h.nPoints? h.nUvs : 0;
+	if (m.vertexFormat != MeshPlanar || nNrms != h.nNormals || nUvs != h.nUvs || !h.nPoints) {
+		// other formats are converted from the arrays
+		m.Buffer();
+		return true;
+	}
+	if (!m.vBufferId)
+		glGenBuffers(1, &m.vBufferId);
+	glBindBuffer(GL_ARRAY_BUFFER, m.vBufferId);
+	glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr) sizeVertices, points, GL_STATIC_DRAW);
+	SetVertexArrays(m, h.nPoints, nNrms, nUvs, 0);
+	UploadIndices(m, (const int *) (d+h.indices), h.nIndices, (const int *) (d+h.edges), h.nEdgeIndices);
+	return true;
+}
+
+} // end namespace
+
+void SetMeshCache(bool enable) { meshCache = enable; }
+
+bool GetMeshCache() { return meshCache; }
+
+void SetMeshOptimize(bool enable) { meshOptimize = enable; }
+
+bool GetMeshOptimize() { return meshOptimize; }
+
+void Mesh::Optimize(bool report) {
+	TRACE_ZONE("Mesh::Optimize");
+	int nTriangles = triangles.size(), nPoints = points.size();
+	float before = ACMR(triangles);
+	// reorder within ranges that share group and material
+	vector<int> starts(1, 0);
+	for (Group &g : groups)
+		starts.push_back(g.startTriangle);
+	for (Mtl &t : materials)
+		starts.push_back(t.startTriangle);
+	starts.push_back(nTriangles);
+	std::sort(starts.begin(), starts.end());
+	starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+	vector<int> local(nPoints, -1), global;
+	vector<vec3> localPoints;
+	vector<int3> range;
+	for (size_t r = 0; r+1 < starts.size(); r++) {
+		int begin = std::max(0, starts[r]), end = std::min(nTriangles, starts[r+1]);
+		if (end-begin < 2)
+			continue;
+		// renumber vertices of range from 0, so cost is per range, not per mesh
+		range.assign(triangles.begin()+begin, triangles.begin()+end);
+		global.resize(0);
+		localPoints.resize(0);
+		for (int3 &t : range)
+			for (int k = 0; k < 3; k++) {
+				int &v = t[k];
+				if (local[v] < 0) {
+					local[v] = global.size();
+					global.push_back(v);
+					localPoints.push_back(points[v]);
+				}
+				v = local[v];
+			}
+		OptimizeVertexCache(range, global.size());
+		OptimizeOverdraw(localPoints, range);
+		assert((int) range.size() == end-begin);
+		for (int i = 0; i < end-begin; i++) {
+			int3 &t = range[i];
+			triangles[begin+i] = int3(global[t.i1], global[t.i2], global[t.i3]);
+		}
+		for (int v : global)
+			local[v] = -1;
+	}
+	// renumber vertices, unless normals or uvs are partial (they would lose correspondence)
+	bool partial = (normals.size() && (int) normals.size() != nPoints) || (uvs.size() && (int) uvs.size() != nPoints);
+	if (!partial) {
+		vector<int> remap;
+		OptimizeVertexFetch(triangles, quads, nPoints, remap);
+		RemapVertices(points, remap);
+		RemapVertices(normals, remap);
+		RemapVertices(uvs, remap);
+	}
+	if (report)
+		printf("Mesh.Optimize: %i triangles, ACMR %3.2f -> %3.2f%s\n", nTriangles, before, ACMR(triangles),
+			partial? " (vertices not reordered: partial normals or uvs)" : "");
 }
 
 bool Mesh::Read(string objFile, mat4 *m, bool normalize) {
-	if (!ReadAsciiObj((char *) objFile.c_str(), points, triangles, &normals, &uvs, NULL, NULL, &quads)) {
+	TRACE_ZONE("Mesh::Read");
+	size_t dot = objFile.find_last_of('.');
+	string ext = dot == string::npos? "" : objFile.substr(dot);
+	for (char &c : ext)
+		c = tolower(c);
+	bool weld = ext == ".stl" && GetWeldSTL();
+	string cacheFile = objFile+".mshb";
+	time_t modified = FileExists(objFile.c_str())? FileModified(objFile.c_str()) : 0;
+	if (meshCache && modified && ReadMeshCache(*this, cacheFile.c_str(), modified, normalize, weld, meshOptimize)) {
+		objFilename = objFile;
+		UpdateBounds();
+		if (meshLODs)
+			BuildLODs();
+		if (m)
+			transform = *m;
+		return true;
+	}
+	points.resize(0);
+	normals.resize(0);
+	uvs.resize(0);
+	triangles.resize(0);
+	quads.resize(0);
+	groups.resize(0);
+	materials.resize(0);
+	if (weld) {
+		if (!ReadSTL(objFile.c_str(), points, triangles, &normals)) {
+			printf("Mesh.Read: can't read %s\n", objFile.c_str());
+			return false;
+		}
+	}
+	else if (ext == ".stl") {
+		// three vertices per facet
+		vector<VertexSTL> vertices;
+		if (!ReadSTL(objFile.c_str(), vertices)) {
+			printf("Mesh.Read: can't read %s\n", objFile.c_str());
+			return false;
+		}
+		int nVertices = vertices.size();
+		points.resize(nVertices);
+		normals.resize(nVertices);
+		triangles.resize(nVertices/3);
+		for (int i = 0; i < nVertices; i++) {
+			points[i] = vertices[i].point;
+			normals[i] = vertices[i].normal;
+		}
+		for (int i = 0; i < nVertices/3; i++)
+			triangles[i] = int3(3*i, 3*i+1, 3*i+2);
+	}
+	else if (!ReadAsciiObj((char *) objFile.c_str(), points, triangles, &normals, &uvs, &groups, &materials, &quads)) {
 		printf("Mesh.Read: can't read %s\n", objFile.c_str());
 		return false;
 	}
 	objFilename = objFile;
 	if (normalize)
 		Normalize(points, 1);
+	if (meshOptimize)
+		Optimize();
 	Buffer();
+	if (meshCache && modified)
+		WriteMeshCache(*this, cacheFile.c_str(), modified, ext == ".stl"? "" : MtlLibraries(objFile.c_str()), normalize, weld, meshOptimize);
+	if (meshLODs)
+		BuildLODs();
 	if (m)
 		transform = *m;
 	return true;
@@ -358,15 +1383,62 @@ bool IsInside(const vec2 &p, const vec2 &a, const vec2 &b, const vec2 &c) {
 	return odd;
 }
 
+namespace {
+
+// BVHs built by BuildTriInfos, keyed by a generation number stored in each TriInfo of a build,
+// so a vector rebuilt (or reallocated) never finds an earlier BVH; oldest dropped beyond MaxTriInfoBVHs
+
+struct TriInfoBVH {
+	unsigned generation = 0;
+	size_t nTriangles = 0;
+	std::shared_ptr<BVH> bvh;
+};
+
+const int MaxTriInfoBVHs = 16;
+std::mutex triInfoBVHsMutex;
+vector<TriInfoBVH> triInfoBVHs;
+std::atomic<unsigned> triInfoGeneration{0};
+
+std::shared_ptr<BVH> FindTriInfoBVH(const vector<TriInfo> &triInfos) {
+	if (triInfos.empty())
+		return NULL;
+	unsigned generation = triInfos[0].generation;
+	if (!generation || triInfos.back().generation != generation)
+		return NULL;						// not from BuildTriInfos, or partly replaced
+	std::lock_guard<std::mutex> lock(triInfoBVHsMutex);
+	for (TriInfoBVH &t : triInfoBVHs)
+		if (t.generation == generation && t.nTriangles == triInfos.size())
+			return t.bvh;
+	return NULL;
+}
+
+} // end namespace
+
 void BuildTriInfos(vector<vec3> &points, vector<int3> &triangles, vector<TriInfo> &triInfos) {
+	unsigned generation = ++triInfoGeneration;
+	if (!generation)
+		generation = ++triInfoGeneration;	// 0 reserved for TriInfos not built here
 	triInfos.resize(triangles.size());
 	for (size_t i = 0; i < triangles.size(); i++) {
 		int3 &t = triangles[i];
 		triInfos[i] = TriInfo(points[t.i1], points[t.i2], points[t.i3]);
+		triInfos[i].generation = generation;
 	}
+	TriInfoBVH t;
+	t.generation = generation;
+	t.nTriangles = triangles.size();
+	t.bvh = std::make_shared<BVH>();
+	t.bvh->Build(points, triangles);
+	std::lock_guard<std::mutex> lock(triInfoBVHsMutex);
+	triInfoBVHs.push_back(t);
+	if ((int) triInfoBVHs.size() > MaxTriInfoBVHs)
+		triInfoBVHs.erase(triInfoBVHs.begin());
 }
 
 int IntersectWithLine(vec3 p1, vec3 p2, vector<TriInfo> &triInfos, float &retAlpha) {
+	if (std::shared_ptr<BVH> bvh = FindTriInfoBVH(triInfos))
+		return IntersectWithLine(p1, p2, *bvh, retAlpha);
+	// linear scan
 	int picked = -1;
 	float alpha, minAlpha = FLT_MAX;
 	for (size_t i = 0; i < triInfos.size(); i++) {
@@ -385,6 +1457,12 @@ int IntersectWithLine(vec3 p1, vec3 p2, vector<TriInfo> &triInfos, float &retAlp
 	return picked;
 }
 
+int IntersectWithLine(vec3 p1, vec3 p2, const BVH &bvh, float &alpha) {
+	BVHHit hit = bvh.Nearest(p1, p2-p1, -FLT_MAX, FLT_MAX);
+	alpha = hit.t;
+	return hit.triangle;
+}
+
 // center/scale for unit size models
 
 void UpdateMinMax(vec3 p, vec3 &min, vec3 &max) {
@@ -492,91 +1570,217 @@ char *Lower(char *word) {
 	return word;
 }
 
+namespace {
+
+class TripletHash {
+	// open addressing, linear probing; int triplet (eg, OBJ vid/tid/nid, or STL position bits) to id
+public:
+	TripletHash(size_t n) { Resize(n); }
+	int &operator[](const int3 &key) {
+		if (2*(count+1) > keys.size())
+			Resize(keys.size());
+		size_t i = Hash(key) & mask;
+		for (; ids[i] >= 0; i = (i+1) & mask)
+			if (keys[i].i1 == key.i1 && keys[i].i2 == key.i2 && keys[i].i3 == key.i3)
+				return ids[i];
+		keys[i] = key;
+		count++;
+		return ids[i];						// -1: new entry, caller sets
+	}
+private:
+	vector<int3> keys;
+	vector<int> ids;
+	size_t mask = 0, count = 0;
+	static size_t Hash(const int3 &k) {
+		unsigned long long h = (unsigned) k.i1*0x9E3779B97F4A7C15ull;
+		h ^= (unsigned) k.i2*0xC2B2AE3D27D4EB4Full+(h >> 29);
+		h ^= (unsigned) k.i3*0x165667B19E3779F9ull+(h >> 32);
+		return (size_t) (h ^ (h >> 31));
+	}
+	void Resize(size_t n) {
+		// capacity a power of 2 at least 2n; reinsert
+		size_t capacity = 16;
+		while (capacity < 2*n)
+			capacity <<= 1;
+		vector<int3> oldKeys(std::move(keys));
+		vector<int> oldIds(std::move(ids));
+		keys.assign(capacity, int3());
+		ids.assign(capacity, -1);
+		mask = capacity-1;
+		for (size_t i = 0; i < oldIds.size(); i++)
+			if (oldIds[i] >= 0) {
+				size_t j = Hash(oldKeys[i]) & mask;
+				while (ids[j] >= 0)
+					j = (j+1) & mask;
+				keys[j] = oldKeys[i];
+				ids[j] = oldIds[i];
+			}
+	}
+};
+
+bool weldSTL = false;
+
+bool AsciiSTL(const MappedFile &file) {
+	// binary if size agrees with triangle count (binary headers may also begin "solid")
+	if (file.size >= 84) {
+		unsigned int n;
+		memcpy(&n, file.data+80, 4);
+		if (84+50*(unsigned long long) n == file.size)
+			return false;
+	}
+	const char *c = file.data, *end = file.data+file.size;
+	while (c < end && isspace((unsigned char) *c))
+		c++;
+	return end-c >= 5 && !strncmp(c, "solid", 5);
+}
+
+void AddFacetSTL(vector<VertexSTL> &vertices, int i, vec3 n, vec3 *v) {
+	// set vertices 3i, 3i+1, 3i+2, ordered to agree with facet normal
+	vec3 a(v[1]-v[0]), b(v[2]-v[1]);
+	bool flip = dot(cross(a, b), n) < 0;
+	for (int k = 0; k < 3; k++)
+		vertices[3*i+k] = VertexSTL((float *) &v[flip? 2-k : k].x, (float *) &n.x);
+}
+
+void DecodeBinarySTL(const char *records, int begin, int end, vector<VertexSTL> *vertices) {
+	TRACE_ZONE("ReadSTL records");
+	// each record: 12 normal, 3x12 vertices, 2 attribute (unaligned, little endian)
+	for (int i = begin; i < end; i++) {
+		float f[12];
+		memcpy(f, records+50*(size_t) i, 48);
+		vec3 v[] = { vec3(f[3], f[4], f[5]), vec3(f[6], f[7], f[8]), vec3(f[9], f[10], f[11]) };
+		AddFacetSTL(*vertices, i, vec3(f[0], f[1], f[2]), v);
+	}
+}
+
+int ReadBinarySTL(const MappedFile &file, vector<VertexSTL> &vertices) {
+	  // # bytes      use                  significance
+	  // -------      ---                  ------------
+	  //      80      header               none
+	  //       4      unsigned long int    number of triangles
+	  //      12      3 floats             triangle normal
+	  //      12      3 floats             x,y,z for vertex 1
+	  //      12      3 floats             vertex 2
+	  //      12      3 floats             vertex 3
+	  //       2      unsigned short int   attribute (0)
+	  // endianness is assumed to be little endian
+	if (file.size < 84)
+		return 0;
+	unsigned int nTriangles;
+	memcpy(&nTriangles, file.data+80, 4);
+	size_t nInFile = (file.size-84)/50;
+	if (nTriangles > nInFile) {
+		printf("STL file has %i of %u triangles\n", (int) nInFile, nTriangles);
+		nTriangles = (unsigned int) nInFile;
+	}
+	int n = (int) nTriangles;
+	vertices.resize(3*(size_t) n);
+	// decode in parallel, each thread its own range of triangles
+	int nThreads = (int) std::thread::hardware_concurrency(), minTriangles = 1 << 16;
+	int nRanges = n/minTriangles+1;
+	nRanges = nRanges < nThreads? nRanges : nThreads > 0? nThreads : 1;
+	vector<std::thread> threads;
+	for (int r = 1; r < nRanges; r++)
+		threads.push_back(std::thread(DecodeBinarySTL, file.data+84, (int) ((long long) n*r/nRanges), (int) ((long long) n*(r+1)/nRanges), &vertices));
+	DecodeBinarySTL(file.data+84, 0, n/nRanges, &vertices);
+	for (std::thread &t : threads)
+		t.join();
+	return n;
+}
+
+int ReadAsciiSTL(const MappedFile &file, vector<VertexSTL> &vertices) {
+	// facet normal nx ny nz / outer loop / vertex x y z (3) / endloop / endfacet, one line at a time
+	char line[1000], word[1000];
+	vec3 n, v[3];
+	int nVertices = 0, nTriangles = 0, lineNum = 0;
+	vertices.resize(0);
+	for (const char *c = file.data, *end = file.data+file.size; c < end; lineNum++) {
+		const char *eol = (const char *) memchr(c, '\n', end-c);
+		eol = eol? eol : end;
+		size_t length = eol-c < (int) sizeof(line)-1? eol-c : sizeof(line)-1;
+		memcpy(line, c, length);
+		line[length] = 0;
+		c = eol+1;
+		for (char *r = line; *r; r++)
+			if (*r == '\r') *r = ' ';
+		char *ptr = line;
+		if (!ReadWord(ptr, word, sizeof(word)))
+			continue;
+		Lower(word);
+		if (!strcmp(word, "facet")) {
+			nVertices = 0;
+			n = vec3(0, 0, 0);
+			if (ReadWord(ptr, word, sizeof(word)) && !strcmp(Lower(word), "normal") &&
+				sscanf(ptr, "%g%g%g", &n.x, &n.y, &n.z) != 3)
+				printf("bad normal, line %i\n", lineNum);
+		}
+		else if (!strcmp(word, "vertex")) {
+			if (nVertices < 3 && sscanf(ptr, "%g%g%g", &v[nVertices].x, &v[nVertices].y, &v[nVertices].z) == 3)
+				nVertices++;
+			else
+				printf("bad vertex, line %i\n", lineNum);
+		}
+		else if (!strcmp(word, "endfacet") && nVertices == 3) {
+			vertices.resize(vertices.size()+3);
+			AddFacetSTL(vertices, nTriangles++, n, v);
+		}
+	}
+	return nTriangles;
+}
+
+} // end namespace
+
+void SetWeldSTL(bool weld) { weldSTL = weld; }
+
+bool GetWeldSTL() { return weldSTL; }
+
 int ReadSTL(const char *filename, vector<VertexSTL> &vertices) {
+	TRACE_ZONE("ReadSTL");
 	// the facet normal should point outwards from the solid object; if this is zero,
 	// most software will calculate a normal from the ordered triangle vertices using the right-hand rule
-	class Helper {
-	public:
-		bool status = false;
-		int nTriangles = 0;
-		vector<VertexSTL> *verts;
-		vector<string> vSpecs;                              // ASCII only
-		Helper(const char *filename, vector<VertexSTL> *verts) : verts(verts) {
-			char line[1000], word[1000], *ptr = line;
-			ifstream inText(filename, ios::in);             // text default mode
-			inText.getline(line, 10);
-			bool ascii = ReadWord(ptr, word, 10) && !strcmp(Lower(word), "solid");
-			// bool ascii = ReadWord(ptr, word, 10) && !_stricmp(word, "solid");
-			ascii = false; // hmm!
-			if (ascii)
-				status = ReadASCII(inText);
-			inText.close();
-			if (!ascii) {
-				FILE *inBinary = fopen(filename, "rb");     // inText.setmode(ios::binary) fails
-				if (inBinary) {
-					nTriangles = 0;
-					status = ReadBinary(inBinary);
-					fclose(inBinary);
-				}
-				else
-					status = false;
-			}
-		}
-		bool ReadASCII(ifstream &in) {
-			printf("can't read ASCII STL\n");
-			return true;
-		}
-		bool ReadBinary(FILE *in) {
-				  // # bytes      use                  significance
-				  // -------      ---                  ------------
-				  //      80      header               none
-				  //       4      unsigned long int    number of triangles
-				  //      12      3 floats             triangle normal
-				  //      12      3 floats             x,y,z for vertex 1
-				  //      12      3 floats             vertex 2
-				  //      12      3 floats             vertex 3
-				  //       2      unsigned short int   attribute (0)
-				  // endianness is assumed to be little endian
-			// in.setmode(ios::binary); doc says setmode good, but compiler says not so
-			// sizeof(bool)=1, sizeof(char)=1, sizeof(short)=2, sizeof(int)=4, sizeof(float)=4
-			char buf[81];
-			int nTriangle = 0;//, vid1, vid2, vid3;
-			if (fread(buf, 1, 80, in) != 80) // header
-				return false;
-			if (fread(&nTriangles, sizeof(int), 1, in) != 1)
-				return false;
-			while (!feof(in)) {
-				vec3 v[3], n;
-				if (nTriangle == nTriangles)
-					break;
-				if (nTriangles > 5000 && nTriangle && nTriangle%1000 == 0)
-					printf("\rread %i/%i triangles", nTriangle, nTriangles);
-				if (fread(&n.x, sizeof(float), 3, in) != 3)
-					printf("\ncan't read triangle %d normal\n", nTriangle);
-				for (int k = 0; k < 3; k++)
-					if (fread(&v[k].x, sizeof(float), 3, in) != 3)
-						printf("\ncan't read vid %d\n", verts->size());
-				vec3 a(v[1]-v[0]), b(v[2]-v[1]);
-				vec3 ntmp = cross(a, b);
-				if (dot(ntmp, n) < 0) {
-					vec3 vtmp = v[0];
-					v[0] = v[2];
-					v[2] = vtmp;
-				}
-				for (int k = 0; k < 3; k++)
-					verts->push_back(VertexSTL((float *) &v[k].x, (float *) &n.x));
-				unsigned short attribute;
-				if (fread(&attribute, sizeof(short), 1, in) != 1)
-					printf("\ncan't read attribute\n");
-				nTriangle++;
-			}
-			printf("\r\t\t\t\t\t\t\r");
-			return true;
+	MappedFile file;
+	vertices.resize(0);
+	if (!file.Open(filename))
+		return 0;
+	if (!AsciiSTL(file))
+		return ReadBinarySTL(file, vertices);
+	int n = ReadAsciiSTL(file, vertices);
+	// a binary file whose header begins "solid" and whose size disagrees with its count
+	// (eg, truncated, or padded) yields no ASCII facets: read as binary, clamping the count
+	return n == 0 && file.size >= 84? ReadBinarySTL(file, vertices) : n;
+}
+
+int ReadSTL(const char *filename, vector<vec3> &points, vector<int3> &triangles, vector<vec3> *normals) {
+	vector<VertexSTL> vertices;
+	int nTriangles = ReadSTL(filename, vertices);
+	TRACE_ZONE("ReadSTL weld");
+	// weld vertices with identical positions (-0 and 0 considered the same)
+	TripletHash ids(vertices.size()/6+1);
+	vector<int> vids(vertices.size());
+	points.resize(0);
+	for (size_t i = 0; i < vertices.size(); i++) {
+		vec3 p = vertices[i].point+vec3(0, 0, 0);
+		int bits[3];
+		memcpy(bits, &p.x, sizeof(float));
+		memcpy(bits+1, &p.y, sizeof(float));
+		memcpy(bits+2, &p.z, sizeof(float));
+		int3 key(bits[0], bits[1], bits[2]);
+		int &id = ids[key];
+		if (id < 0) {
+			id = points.size();
+			points.push_back(p);
 		}
-	};
-	Helper h(filename, &vertices);
-	return h.nTriangles;
-} // end ReadSTL
+		vids[i] = id;
+	}
+	triangles.resize(nTriangles);
+	for (int i = 0; i < nTriangles; i++)
+		triangles[i] = int3(vids[3*i], vids[3*i+1], vids[3*i+2]);
+	if (normals) {
+		normals->resize(0);
+		SetVertexNormals(points, triangles, *normals);
+	}
+	return nTriangles;
+}
 
 // ASCII OBJ
 
@@ -628,6 +1832,90 @@ MtlMap ReadMaterial(const char *filename) {
 	return mtlMap;
 }
 
+void ObjDirective(const char *filename, const char *keyword, char *ptr, MtlMap &mtlMap, int nTriangles,
+				  vector<Group> *triangleGroups, vector<Mtl> *triangleMtls) {
+	// process mtllib, usemtl, or g line; keyword is lowered, ptr follows it
+	char word[WordLim];
+	if (!strcmp(keyword, "mtllib")) {
+		if (ReadWord(ptr, word, WordLim)) {
+			mtlMap = ReadMaterial(MtlPath(filename, word).c_str());
+			if (false) {
+				int count = 0;
+				for (MtlMap::iterator iter = mtlMap.begin(); iter != mtlMap.end(); iter++) {
+					string s = (string) iter->first;
+					Mtl m = (Mtl) iter->second;
+					printf("m[%i].name=%s,.kd=(%3.2f,%3.2f,%3.2f),s=%s\n", count++, m.name.c_str(), m.kd.x, m.kd.y, m.kd.z, s.c_str());
+				}
+			}					
+		}
+	}
+	else if (!strcmp(keyword, "usemtl")) {
+		if (ReadWord(ptr, word, WordLim)) {
+			MtlMap::iterator it = mtlMap.find(string(word));
+			if (it == mtlMap.end())
+				printf("no such material: %s\n", word);
+			else {
+				Mtl m = it->second;
+				m.startTriangle = nTriangles;
+				if (triangleMtls)
+					triangleMtls->push_back(m);
+			}
+		}
+	}
+	else if (!strcmp(keyword, "g")) {
+		if (ReadWord(ptr, word, WordLim)) {				// read group name
+			if (triangleGroups)
+				triangleGroups->push_back(Group(nTriangles, string(word)));
+		}
+	}
+}
+
+void AddObjFace(vector<int> &vids, vector<vec3> &points, vector<int3> &triangles,
+				vector<vec3> *normals, vector<int4> *quads, vector<int2> *segs) {
+	// add triangle, quad, segment, or triangulated polygon given face vertex ids
+	int nids = vids.size();
+	if (nids == 3) {
+		int id1 = vids[0], id2 = vids[1], id3 = vids[2];
+		if (normals && (int) normals->size() > id1) {
+			vec3 &p1 = points[id1], &p2 = points[id2], &p3 = points[id3];
+			vec3 a(p2-p1), b(p3-p2), n(cross(a, b));
+			if (dot(n, (*normals)[id1]) < 0) {
+				int tmp = id1;
+				id1 = id3;
+				id3 = tmp;
+			}
+		}
+		// create triangle
+		triangles.push_back(int3(id1, id2, id3));
+	}
+	else if (nids == 4 && quads)
+		quads->push_back(int4(vids[0], vids[1], vids[2], vids[3]));
+	else if (nids == 2 && segs)
+		segs->push_back(int2(vids[0], vids[1]));
+	else
+		// create polygon as nvids-2 triangles
+		for (int i = 1; i < nids-1; i++) {
+			triangles.push_back(int3(vids[0], vids[i], vids[(i+1)%nids]));
+		}
+}
+
+void SetObjGroupCounts(int nTriangles, vector<Group> *triangleGroups, vector<Mtl> *triangleMtls) {
+	if (triangleGroups) {
+		int nGroups = triangleGroups->size();
+		for (int i = 0; i < nGroups; i++) {
+			int next = i < nGroups-1? (*triangleGroups)[i+1].startTriangle : nTriangles;
+			(*triangleGroups)[i].nTriangles = next-(*triangleGroups)[i].startTriangle;
+		}
+	}
+	if (triangleMtls) {
+		int nMtls = triangleMtls->size();
+		for (int i = 0; i < nMtls; i++) {
+			int next = i < nMtls-1? (*triangleMtls)[i+1].startTriangle : nTriangles;
+			(*triangleMtls)[i].nTriangles = next-(*triangleMtls)[i].startTriangle;
+		}
+	}
+}
+
 struct CompareVid {
 	bool operator() (const int3 &a, const int3 &b) const {
 		return (a.i1==b.i1? (a.i2==b.i2? a.i3 < b.i3 : a.i2 < b.i2) : a.i1 < b.i1);
@@ -637,7 +1925,7 @@ struct CompareVid {
 typedef std::map<int3, int, CompareVid> VidMap;
 	// int3 is key, int is value
 
-bool ReadAsciiObj(const char    *filename,
+bool ReadAsciiObjSerial(const char    *filename,
 				  vector<vec3>  &points,
 				  vector<int3>  &triangles,
 				  vector<vec3>  *normals,
@@ -650,6 +1938,7 @@ bool ReadAsciiObj(const char    *filename,
 	// polygons are assumed simple (ie, no holes and not self-intersecting);
 	// some file attributes are not supported by this implementation;
 	// obj format indexes vertices from 1
+	TRACE_ZONE("ReadAsciiObjSerial");
 	FILE *in = fopen(filename, "r");
 	if (!in)
 		return false;
@@ -677,48 +1966,8 @@ bool ReadAsciiObj(const char    *filename,
 		Lower(word);
 		if (*word == '#')
 			continue;
-		else if (!strcmp(word, "mtllib")) {
-			if (ReadWord(ptr, word, WordLim)) {
-				char name[100];
-				const char *p = strrchr(filename, '/'); //-filename, count = 0;
-				if (p) {
-					int nchars = p-filename;
-					strncpy(name, filename, nchars+1);
-					name[nchars+1] = 0;
-					strcat(name, word);
-				}
-				else
-					strcpy(name, word);
-				mtlMap = ReadMaterial(name);
-				if (false) {
-					int count = 0;
-					for (MtlMap::iterator iter = mtlMap.begin(); iter != mtlMap.end(); iter++) {
-						string s = (string) iter->first;
-						Mtl m = (Mtl) iter->second;
-						printf("m[%i].name=%s,.kd=(%3.2f,%3.2f,%3.2f),s=%s\n", count++, m.name.c_str(), m.kd.x, m.kd.y, m.kd.z, s.c_str());
-					}
-				}					
-			}
-		}
-		else if (!strcmp(word, "usemtl")) {
-			if (ReadWord(ptr, word, WordLim)) {
-				MtlMap::iterator it = mtlMap.find(string(word));
-				if (it == mtlMap.end())
-					printf("no such material: %s\n", word);
-				else {
-					Mtl m = it->second;
-					m.startTriangle = triangles.size();
-					if (triangleMtls)
-						triangleMtls->push_back(m);
-				}
-			}
-		}
-		else if (!strcmp(word, "g")) {
-			if (ReadWord(ptr, word, WordLim)) {				// read group name
-				if (triangleGroups)
-					triangleGroups->push_back(Group(triangles.size(), string(word)));
-			}
-		}
+		else if (!strcmp(word, "mtllib") || !strcmp(word, "usemtl") || !strcmp(word, "g"))
+			ObjDirective(filename, word, ptr, mtlMap, triangles.size(), triangleGroups, triangleMtls);
 		else if (!strcmp(word, "v")) {                      // read vertex coordinates
 			if (sscanf(ptr, "%g%g%g", &v.x, &v.y, &v.z) != 3) {
 				printf("bad line %d in object file", lineNum);
@@ -777,30 +2026,7 @@ bool ReadAsciiObj(const char    *filename,
 				else
 					vids.push_back(it->second);
 			}
-			int nids = vids.size();
-			if (nids == 3) {
-				int id1 = vids[0], id2 = vids[1], id3 = vids[2];
-				if (normals && (int) normals->size() > id1) {
-					vec3 &p1 = points[id1], &p2 = points[id2], &p3 = points[id3];
-					vec3 a(p2-p1), b(p3-p2), n(cross(a, b));
-					if (dot(n, (*normals)[id1]) < 0) {
-						int tmp = id1;
-						id1 = id3;
-						id3 = tmp;
-					}
-				}
-				// create triangle
-				triangles.push_back(int3(id1, id2, id3));
-			}
-			else if (nids == 4 && quads)
-				quads->push_back(int4(vids[0], vids[1], vids[2], vids[3]));
-			else if (nids == 2 && segs)
-				segs->push_back(int2(vids[0], vids[1]));
-			else
-				// create polygon as nvids-2 triangles
-				for (int i = 1; i < nids-1; i++) {
-					triangles.push_back(int3(vids[0], vids[i], vids[(i+1)%nids]));
-				}
+			AddObjFace(vids, points, triangles, normals, quads, segs);
 		} // end "f"
 		else if (*word == 0 || *word == '\n')               // skip blank line
 			continue;
@@ -809,22 +2035,325 @@ bool ReadAsciiObj(const char    *filename,
 			continue; // return false;
 		}
 	} // end read til end of file
-	if (triangleGroups) {
-		int nGroups = triangleGroups->size();
-		for (int i = 0; i < nGroups; i++) {
-			int next = i < nGroups-1? (*triangleGroups)[i+1].startTriangle : triangles.size();
-			(*triangleGroups)[i].nTriangles = next-(*triangleGroups)[i].startTriangle;
+	SetObjGroupCounts(triangles.size(), triangleGroups, triangleMtls);
+	return true;
+} // end ReadAsciiObjSerial
+
+// Parallel OBJ Reader
+
+namespace {
+
+struct ObjDirectiveLine {
+	int face;								// # faces in chunk preceding the directive
+	string line;
+};
+
+struct ObjChunk {
+	const char *begin = NULL, *end = NULL;	// whole lines, end follows a newline
+	vector<vec3> vertices, normals;
+	vector<vec2> uvs;
+	vector<int> corners;					// vid, tid, nid per face corner, from 0 (as in file, less 1)
+	vector<int> faceSizes;					// # corners per face
+	vector<ObjDirectiveLine> directives;	// mtllib, usemtl, g lines, applied in order during merge
+	// over all corners, index less # vertices (uvs, normals) read so far in chunk
+	// once preceding chunks are counted, these tell whether a corner refers to an element not yet read
+	int minDeficit[3] = { INT_MAX, INT_MAX, INT_MAX }, maxDeficit[3] = { INT_MIN, INT_MIN, INT_MIN };
+	bool irregular = false;					// line the fast parser can't match exactly with sscanf/atoi
+};
+
+const float powersOf10[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+bool ParseFloat(const char *&p, const char *eol, float &f) {
+	// parse [+-]digits[.digits][e[+-]digits] as sscanf %g would; return false if any doubt
+	while (p < eol && (*p == ' ' || *p == '\t'))
+		p++;
+	const char *start = p;
+	bool negative = *p == '-';
+	if (*p == '-' || *p == '+')
+		p++;
+	unsigned long long mantissa = 0;
+	int nDigits = 0, nSignificant = 0, exponent = 0;
+	for (; *p >= '0' && *p <= '9'; p++, nDigits++)
+		if (nSignificant < 19) {
+			if (mantissa || *p != '0') nSignificant++;
+			mantissa = 10*mantissa+(*p-'0');
 		}
+		else
+			exponent++;						// digit beyond 19 significant
+	if (*p == '.')
+		for (p++; *p >= '0' && *p <= '9'; p++, nDigits++)
+			if (nSignificant < 19) {
+				if (mantissa || *p != '0') nSignificant++;
+				mantissa = 10*mantissa+(*p-'0');
+				exponent--;
+			}
+	if (!nDigits)
+		return false;
+	if (*p == 'e' || *p == 'E') {
+		const char *e = p+1;
+		bool negativeE = *e == '-';
+		if (*e == '-' || *e == '+')
+			e++;
+		if (*e < '0' || *e > '9')
+			return false;
+		int n = 0;
+		for (; *e >= '0' && *e <= '9'; e++)
+			n = n < 10000? 10*n+(*e-'0') : n;
+		exponent += negativeE? -n : n;
+		p = e;
 	}
-	if (triangleMtls) {
-		int nMtls = triangleMtls->size();
-		for (int i = 0; i < nMtls; i++) {
-			int next = i < nMtls-1? (*triangleMtls)[i+1].startTriangle : triangles.size();
-			(*triangleMtls)[i].nTriangles = next-(*triangleMtls)[i].startTriangle;
+	if (p < eol && *p != ' ' && *p != '\t' && *p != '\r')
+		return false;
+	if (mantissa < (1 << 24) && exponent >= -10 && exponent <= 10) {
+		// mantissa and power of 10 exact as floats, so one operation rounds correctly
+		f = exponent < 0? (float) mantissa/powersOf10[-exponent] : (float) mantissa*powersOf10[exponent];
+		f = negative? -f : f;
+		return true;
+	}
+	// otherwise let strtof round
+	char buf[64];
+	int n = p-start;
+	if (n >= (int) sizeof(buf))
+		return false;
+	memcpy(buf, start, n);
+	buf[n] = 0;
+	f = strtof(buf, NULL);
+	return true;
+}
+
+bool ParseIndex(const char *&p, int &i) {
+	// parse 1 to 9 digits, value > 0
+	int n = 0;
+	for (i = 0; *p >= '0' && *p <= '9' && n < 10; p++, n++)
+		i = 10*i+(*p-'0');
+	return n > 0 && n < 10 && i > 0;
+}
+
+void ParseObjChunk(ObjChunk &c) {
+	TRACE_ZONE("ReadAsciiObj chunk");
+	for (const char *p = c.begin; p < c.end; ) {
+		const char *eol = (const char *) memchr(p, '\n', c.end-p);
+		const char *next = eol+1;
+		bool crlf = eol > p && eol[-1] == '\r';
+#ifdef _WIN32
+		const char *lineEnd = crlf? eol-1 : eol;	// text mode reads \r\n as \n
+#else
+		const char *lineEnd = eol;
+#endif
+		if (lineEnd-p+1 >= LineLim-1) {			// as fgets with LineLim
+			c.irregular = true;
+			return;
+		}
+		// keyword delimited as by ReadWord
+		while (p < eol && (*p == ' ' || *p == '\t'))
+			p++;
+		const char *k = p;
+		while (p < eol && *p != ' ' && *p != '\t')
+			p++;
+		int nk = p-k;
+		bool keywordEndsLine = nk > 0 && p == eol && crlf;	// keyword includes \r, or not, according to platform
+		char keyword[8] = { 0 };
+		for (int i = 0; i < nk-(keywordEndsLine? 1 : 0) && i < 7; i++)
+			keyword[i] = tolower(k[i]);
+		if (keywordEndsLine) {
+			// a lone v, vn, or vt is an error on one platform, an unknown keyword on the other
+			if (!strcmp(keyword, "v") || !strcmp(keyword, "vn") || !strcmp(keyword, "vt")) {
+				c.irregular = true;
+				return;
+			}
+			nk = 0;								// otherwise ignored either way
+		}
+		if (!nk || *k == '#' || nk > 6) {
+			p = next;
+			continue;
+		}
+		if (!strcmp(keyword, "v") || !strcmp(keyword, "vn")) {
+			vec3 v;
+			if (!ParseFloat(p, eol, v.x) || !ParseFloat(p, eol, v.y) || !ParseFloat(p, eol, v.z)) {
+				c.irregular = true;
+				return;
+			}
+			(keyword[1]? c.normals : c.vertices).push_back(v);
+		}
+		else if (!strcmp(keyword, "vt")) {
+			vec2 t;
+			if (!ParseFloat(p, eol, t.x) || !ParseFloat(p, eol, t.y)) {
+				c.irregular = true;
+				return;
+			}
+			c.uvs.push_back(t);
+		}
+		else if (!strcmp(keyword, "f")) {
+			// corners are vid, vid/tid, vid/tid/nid, vid//nid, vid/tid/ or vid//
+			int nCorners = 0;
+			for (;;) {
+				while (p < eol && (*p == ' ' || *p == '\t'))
+					p++;
+				if (p == eol || (p+1 == eol && *p == '\r'))
+					break;
+				int vid = 0, tid = 0, nid = 0;
+				if (!ParseIndex(p, vid)) {
+					c.irregular = true;
+					return;
+				}
+				tid = nid = vid;
+				if (*p == '/') {
+					p++;
+					if (*p != '/' && !ParseIndex(p, tid)) {
+						c.irregular = true;
+						return;
+					}
+					if (*p == '/') {
+						p++;
+						bool digit = *p >= '0' && *p <= '9';
+						if ((digit && !ParseIndex(p, nid)) || (!digit && *p == '\r')) {
+							c.irregular = true;		// atoi would see "\r" as 0 where \r not removed
+							return;
+						}
+					}
+				}
+				if (p < eol && *p != ' ' && *p != '\t' && !(p+1 == eol && *p == '\r')) {
+					c.irregular = true;
+					return;
+				}
+				int ids[] = { vid-1, tid-1, nid-1 };
+				int counts[] = { (int) c.vertices.size(), (int) c.uvs.size(), (int) c.normals.size() };
+				for (int i = 0; i < 3; i++) {
+					int d = ids[i]-counts[i];
+					c.minDeficit[i] = d < c.minDeficit[i]? d : c.minDeficit[i];
+					c.maxDeficit[i] = d > c.maxDeficit[i]? d : c.maxDeficit[i];
+					c.corners.push_back(ids[i]);
+				}
+				nCorners++;
+			}
+			c.faceSizes.push_back(nCorners);
+		}
+		else if (!strcmp(keyword, "g") || !strcmp(keyword, "usemtl") || !strcmp(keyword, "mtllib"))
+			c.directives.push_back({ (int) c.faceSizes.size(), string(k, lineEnd) });
+		p = next;
+	}
+}
+
+} // end namespace
+
+bool ReadAsciiObj(const char    *filename,
+				  vector<vec3>  &points,
+				  vector<int3>  &triangles,
+				  vector<vec3>  *normals,
+				  vector<vec2>  *textures,
+				  vector<Group> *triangleGroups,
+				  vector<Mtl>   *triangleMtls,
+				  vector<int4>  *quads,
+				  vector<int2>  *segs) {
+	// parse line-aligned chunks of the mapped file in parallel, then merge them in file order
+	// anything the fast parser can't reproduce exactly (bad or unusual numbers, over-long lines,
+	// faces that refer to elements defined later) is left to ReadAsciiObjSerial
+	TRACE_ZONE("ReadAsciiObj");
+	MappedFile file;
+	if (!file.Open(filename))
+		return false;
+	// as with fgets/feof, a last line without newline is not read
+	const char *begin = file.data, *end = file.data+file.size;
+	while (end > begin && end[-1] != '\n')
+		end--;
+	// split into chunks of whole lines
+	size_t size = end-begin, minChunk = 1 << 20;
+	int nThreads = (int) std::thread::hardware_concurrency();
+	int nChunks = (int) (size/minChunk)+1;
+	nChunks = nChunks < nThreads? nChunks : nThreads > 0? nThreads : 1;
+	vector<ObjChunk> chunks(nChunks);
+	const char *p = begin;
+	for (int i = 0; i < nChunks; i++) {
+		const char *e = i == nChunks-1? end : begin+(i+1)*(size/nChunks);
+		e = e > p? e : p;
+		while (e < end && e > begin && e[-1] != '\n')
+			e++;
+		chunks[i].begin = p;
+		chunks[i].end = p = e;
+	}
+	vector<std::thread> threads;
+	for (int i = 1; i < nChunks; i++)
+		threads.push_back(std::thread(ParseObjChunk, std::ref(chunks[i])));
+	ParseObjChunk(chunks[0]);
+	for (std::thread &t : threads)
+		t.join();
+	// count elements preceding each chunk, decide for each chunk whether its corners get normals and uvs
+	TRACE_ZONE("ReadAsciiObj merge");
+	int nVertices = 0, nUvs = 0, nNormals = 0;
+	size_t nAllFaces = 0;
+	vector<char> useNormals(nChunks, 0), useUvs(nChunks, 0);
+	bool serial = false;
+	auto Uses = [&serial](ObjChunk &c, int i, int nPreceding) {
+		// corners all refer to elements already read, or all to elements not yet read (eg, none in file)
+		if (c.maxDeficit[i] < nPreceding) return true;
+		if (c.minDeficit[i] < nPreceding) serial = true;
+		return false;
+	};
+	for (int i = 0; i < nChunks && !serial; i++) {
+		ObjChunk &c = chunks[i];
+		serial = c.irregular || c.maxDeficit[0] >= nVertices;
+		useNormals[i] = normals && Uses(c, 2, nNormals);
+		useUvs[i] = textures && Uses(c, 1, nUvs);
+		nVertices += c.vertices.size();
+		nUvs += c.uvs.size();
+		nNormals += c.normals.size();
+		nAllFaces += c.faceSizes.size();
+	}
+	if (serial) {
+		file.Close();
+		return ReadAsciiObjSerial(filename, points, triangles, normals, textures, triangleGroups, triangleMtls, quads, segs);
+	}
+	vector<vec3> tmpVertices, tmpNormals;
+	vector<vec2> tmpTextures;
+	tmpVertices.reserve(nVertices);
+	tmpNormals.reserve(normals? nNormals : 0);
+	tmpTextures.reserve(textures? nUvs : 0);
+	for (ObjChunk &c : chunks) {
+		tmpVertices.insert(tmpVertices.end(), c.vertices.begin(), c.vertices.end());
+		if (normals) tmpNormals.insert(tmpNormals.end(), c.normals.begin(), c.normals.end());
+		if (textures) tmpTextures.insert(tmpTextures.end(), c.uvs.begin(), c.uvs.end());
+	}
+	// merge faces and directives in file order, deduplicating vid/tid/nid triplets
+	TripletHash vidMap(std::max(nVertices, std::max(nUvs, nNormals)));
+	MtlMap mtlMap;
+	char line[LineLim], word[WordLim];
+	vector<int> vids;
+	points.reserve(points.size()+nVertices);
+	triangles.reserve(triangles.size()+nAllFaces);
+	for (int i = 0; i < nChunks; i++) {
+		ObjChunk &c = chunks[i];
+		const int *corner = c.corners.data();
+		size_t d = 0, nFaces = c.faceSizes.size();
+		for (size_t f = 0; f <= nFaces; f++) {
+			for (; d < c.directives.size() && c.directives[d].face == (int) f; d++) {
+				strcpy(line, c.directives[d].line.c_str());
+				char *ptr = line;
+				ReadWord(ptr, word, WordLim);
+				Lower(word);
+				ObjDirective(filename, word, ptr, mtlMap, triangles.size(), triangleGroups, triangleMtls);
+			}
+			if (f == nFaces)
+				break;
+			vids.resize(0);
+			for (int k = 0; k < c.faceSizes[f]; k++, corner += 3) {
+				int vid = corner[0], tid = corner[1], nid = corner[2];
+				int &id = vidMap[int3(vid, tid, nid)];
+				if (id < 0) {
+					id = points.size();
+					points.push_back(tmpVertices[vid]);
+					if (useNormals[i])
+						normals->push_back(tmpNormals[nid]);
+					if (useUvs[i])
+						textures->push_back(tmpTextures[tid]);
+				}
+				vids.push_back(id);
+			}
+			AddObjFace(vids, points, triangles, normals, quads, segs);
 		}
 	}
+	SetObjGroupCounts(triangles.size(), triangleGroups, triangleMtls);
 	return true;
-} // end ReadAsciiObj
+}
 
 bool WriteAsciiObj(const char *filename,
 				   vector<vec3> &points,
@@ -0,0 +1,260 @@
+// MeshOptimize.cpp - reorder triangles and vertices for the GPU vertex cache, overdraw and vertex fetch
+
+#include "MeshOptimize.h"
+#include "Trace.h"
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+
+using std::vector;
+
+namespace {
+
+const int CacheSize = 32;					// LRU cache modeled by OptimizeVertexCache
+const int MaxValence = 32;					// valence scores tabulated up to this
+
+class FifoCache {
+public:
+	FifoCache(int nVertices, int size) : size(size), stamps(nVertices, -size) { }
+	bool Miss(int v) {
+		// a vertex stays cached until size misses after its own
+		if (time-stamps[v] < size)
+			return false;
+		stamps[v] = ++time;
+		return true;
+	}
+	int Misses(const int3 &t) { return Miss(t.i1)+Miss(t.i2)+Miss(t.i3); }
+	void Flush() { time += size; }
+private:
+	int size, time = 0;
+	vector<int> stamps;
+};
+
+int NVertices(const vector<int3> &triangles) {
+	int n = 0;
+	for (const int3 &t : triangles)
+		n = std::max(n, std::max(t.i1, std::max(t.i2, t.i3))+1);
+	return n;
+}
+
+struct VertexScorer {
+	float cacheScores[CacheSize], valenceScores[MaxValence+1];
+	VertexScorer() {
+		// most recent triangle's vertices scored alike, so its orientation doesn't matter
+		for (int i = 0; i < CacheSize; i++)
+			cacheScores[i] = i < 3? .75f : pow(1-(i-3)/(float) (CacheSize-3), 1.5f);
+		valenceScores[0] = 0;
+		for (int i = 1; i <= MaxValence; i++)
+			valenceScores[i] = 2/sqrt((float) i);
+	}
+	float Score(int cachePosition, int valence) const {
+		// low valence favored, to finish off vertices and not leave lone triangles
+		if (valence == 0)
+			return -1;
+		float s = valence <= MaxValence? valenceScores[valence] : 2/sqrt((float) valence);
+		return cachePosition < 0? s : s+cacheScores[cachePosition];
+	}
+};
+
+} // end namespace
+
+float ACMR(const vector<int3> &triangles, int cacheSize) {
+	if (triangles.empty())
+		return 0;
+	FifoCache cache(NVertices(triangles), cacheSize);
+	int misses = 0;
+	for (const int3 &t : triangles)
+		misses += cache.Misses(t);
+	return (float) misses/triangles.size();
+}
+
+void OptimizeVertexCache(vector<int3> &triangles, int nVertices) {
+	TRACE_ZONE("OptimizeVertexCache");
+	static VertexScorer scorer;
+	int nTriangles = triangles.size();
+	if (nTriangles < 2)
+		return;
+	// live (not yet emitted) triangles of each vertex: adjacent[offsets[v]] .. adjacent[offsets[v]+valence[v]-1]
+	vector<int> valence(nVertices, 0), offsets(nVertices+1, 0), adjacent(3*nTriangles);
+	for (const int3 &t : triangles)
+		for (int k = 0; k < 3; k++)
+			valence[t[k]]++;
+	for (int v = 0; v < nVertices; v++)
+		offsets[v+1] = offsets[v]+valence[v];
+	vector<int> fill(offsets.begin(), offsets.end()-1);
+	for (int i = 0; i < nTriangles; i++)
+		for (int k = 0; k < 3; k++)
+			adjacent[fill[triangles[i][k]]++] = i;
+	vector<int> cachePosition(nVertices, -1);
+	vector<float> vertexScores(nVertices), triangleScores(nTriangles);
+	for (int v = 0; v < nVertices; v++)
+		vertexScores[v] = scorer.Score(-1, valence[v]);
+	int best = 0;
+	for (int i = 0; i < nTriangles; i++) {
+		const int3 &t = triangles[i];
+		triangleScores[i] = vertexScores[t.i1]+vertexScores[t.i2]+vertexScores[t.i3];
+		if (triangleScores[i] > triangleScores[best])
+			best = i;
+	}
+	vector<char> emitted(nTriangles, 0);
+	vector<int3> ordered;
+	ordered.reserve(nTriangles);
+	int cache[CacheSize+3], nCache = 0, cursor = 0;
+	while ((int) ordered.size() < nTriangles) {
+		if (best < 0) {
+			// no cached vertex has a live triangle: restart at first unemitted triangle
+			while (emitted[cursor])
+				cursor++;
+			best = cursor;
+		}
+		int3 t = triangles[best];
+		emitted[best] = 1;
+		ordered.push_back(t);
+		for (int k = 0; k < 3; k++) {
+			int v = t[k], *a = &adjacent[offsets[v]], n = valence[v];
+			for (int j = 0; j < n; j++)
+				if (a[j] == best) {
+					a[j] = a[n-1];
+					break;
+				}
+			valence[v]--;
+		}
+		// emitted vertices move to front of cache, others shift back; beyond CacheSize are evicted
+		int updated[CacheSize+3], nUpdated = 0;
+		for (int k = 0; k < 3; k++)
+			if (std::find(updated, updated+nUpdated, t[k]) == updated+nUpdated)
+				updated[nUpdated++] = t[k];
+		for (int j = 0; j < nCache; j++)
+			if (cache[j] != t.i1 && cache[j] != t.i2 && cache[j] != t.i3)
+				updated[nUpdated++] = cache[j];
+		for (int j = 0; j < nUpdated; j++) {
+			int v = updated[j];
+			cachePosition[v] = j < CacheSize? j : -1;
+			vertexScores[v] = scorer.Score(cachePosition[v], valence[v]);
+		}
+		nCache = std::min(nUpdated, CacheSize);
+		std::copy(updated, updated+nCache, cache);
+		// rescore live triangles of updated vertices, choose best
+		best = -1;
+		float bestScore = -FLT_MAX;
+		for (int j = 0; j < nUpdated; j++) {
+			int v = updated[j], *a = &adjacent[offsets[v]];
+			for (int k = 0; k < valence[v]; k++) {
+				int i = a[k];
+				const int3 &tt = triangles[i];
+				float s = triangleScores[i] = vertexScores[tt.i1]+vertexScores[tt.i2]+vertexScores[tt.i3];
+				if (s > bestScore) {
+					bestScore = s;
+					best = i;
+				}
+			}
+		}
+	}
+	triangles.swap(ordered);
+}
+
+void OptimizeOverdraw(const vector<vec3> &points, vector<int3> &triangles, float threshold) {
+	TRACE_ZONE("OptimizeOverdraw");
+	int nTriangles = triangles.size(), nVertices = NVertices(triangles);
+	if (nTriangles < 2)
+		return;
+	// hard boundaries where the cache is effectively flushed (all three vertices missed);
+	// the first triangle always starts one, as it may miss fewer than three (if degenerate)
+	vector<int> starts;
+	FifoCache cache(nVertices, 16);
+	for (int i = 0; i < nTriangles; i++)
+		if (cache.Misses(triangles[i]) == 3 || i == 0)
+			starts.push_back(i);
+	starts.push_back(nTriangles);
+	// split further where a cluster, started with an empty cache, has reached the mesh's miss ratio
+	float target = threshold*ACMR(triangles, 16);
+	vector<int> clusters;
+	for (size_t c = 0; c+1 < starts.size(); c++) {
+		int begin = starts[c], misses = 0;
+		cache.Flush();
+		clusters.push_back(begin);
+		for (int i = begin; i < starts[c+1]; i++) {
+			misses += cache.Misses(triangles[i]);
+			if (i+1 < starts[c+1] && i+1-begin >= 8 && misses <= target*(i+1-begin)) {
+				clusters.push_back(begin = i+1);
+				misses = 0;
+				cache.Flush();
+			}
+		}
+	}
+	int nClusters = clusters.size();
+	clusters.push_back(nTriangles);
+	// sort clusters by facing away from mesh center: likely to occlude the rest, so draw first
+	vec3 center(0, 0, 0);
+	float area = 0;
+	vector<vec3> centroids(nClusters), normals(nClusters);
+	for (int c = 0; c < nClusters; c++) {
+		vec3 centroid(0, 0, 0), normal(0, 0, 0);
+		float clusterArea = 0;
+		for (int i = clusters[c]; i < clusters[c+1]; i++) {
+			const int3 &t = triangles[i];
+			vec3 a = points[t.i1], b = points[t.i2], p = points[t.i3], n = cross(b-a, p-a);
+			float ar = length(n);
+			centroid += ar*(a+b+p)/3;
+			normal += n;
+			clusterArea += ar;
+		}
+		center += centroid;
+		area += clusterArea;
+		centroids[c] = clusterArea > 0? centroid/clusterArea : points[triangles[clusters[c]].i1];
+		normals[c] = normal;
+	}
+	if (area > 0)
+		center = center/area;
+	vector<float> keys(nClusters);
+	vector<int> order(nClusters);
+	for (int c = 0; c < nClusters; c++) {
+		float len = length(normals[c]);
+		keys[c] = len > 0? dot(centroids[c]-center, normals[c]/len) : 0;
+		order[c] = c;
+	}
+	std::stable_sort(order.begin(), order.end(), [&keys](int a, int b) { return keys[a] > keys[b]; });
+	vector<int3> sorted;
+	sorted.reserve(nTriangles);
+	for (int c : order)
+		sorted.insert(sorted.end(), triangles.begin()+clusters[c], triangles.begin()+clusters[c+1]);
+	triangles.swap(sorted);
+}
+
+void OptimizeVertexFetch(vector<int3> &triangles, vector<int4> &quads, int nVertices, vector<int> &remap) {
+	remap.assign(nVertices, -1);
+	int next = 0;
+	for (int3 &t : triangles)
+		for (int k = 0; k < 3; k++) {
+			int &v = t[k];
+			if (remap[v] < 0)
+				remap[v] = next++;
+			v = remap[v];
+		}
+	for (int4 &q : quads)
+		for (int k = 0; k < 4; k++) {
+			int &v = q[k];
+			if (remap[v] < 0)
+				remap[v] = next++;
+			v = remap[v];
+		}
+	for (int &r : remap)
+		if (r < 0)
+			r = next++;
+}
+
+void RemapVertices(vector<vec3> &attribute, const vector<int> &remap) {
+	if (attribute.size() != remap.size())
+		return;
+	vector<vec3> copy(attribute);
+	for (size_t i = 0; i < remap.size(); i++)
+		attribute[remap[i]] = copy[i];
+}
+
+void RemapVertices(vector<vec2> &attribute, const vector<int> &remap) {
+	if (attribute.size() != remap.size())
+		return;
+	vector<vec2> copy(attribute);
+	for (size_t i = 0; i < remap.size(); i++)
+		attribute[remap[i]] = copy[i];
+}
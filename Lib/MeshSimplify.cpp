@@ -0,0 +1,249 @@
+// MeshSimplify.cpp - quadric error edge-collapse simplification, for levels of detail
+
+#include "MeshSimplify.h"
+#include "Trace.h"
+#include <algorithm>
+#include <math.h>
+#include <queue>
+
+using std::vector;
+
+namespace {
+
+struct Quadric {
+	// symmetric 4x4 matrix, upper triangle; error of p is sum of squared distances to added planes
+	double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+	void AddPlane(const vec3 &n, float d) {
+		// plane n.p+d = 0, n unit length
+		double a = n.x, b = n.y, c = n.z;
+		a2 += a*a; ab += a*b; ac += a*c; ad += a*d;
+		b2 += b*b; bc += b*c; bd += b*d;
+		c2 += c*c; cd += c*d;
+		d2 += (double) d*d;
+	}
+	void Add(const Quadric &q) {
+		a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+		b2 += q.b2; bc += q.bc; bd += q.bd;
+		c2 += q.c2; cd += q.cd;
+		d2 += q.d2;
+	}
+	double Error(const vec3 &p) const {
+		double x = p.x, y = p.y, z = p.z;
+		double e = a2*x*x+2*ab*x*y+2*ac*x*z+2*ad*x+b2*y*y+2*bc*y*z+2*bd*y+c2*z*z+2*cd*z+d2;
+		return e > 0? e : 0;
+	}
+};
+
+struct Collapse {
+	float cost;
+	int from, to, fromVersion, toVersion;	// versions invalidate entries when either end changes
+	bool operator < (const Collapse &c) const { return cost > c.cost; }	// cheapest on top
+};
+
+class Simplifier {
+public:
+	Simplifier(const vector<vec3> &points, vector<int3> &triangles);
+	float Run(int targetTriangles, float maxError, const std::atomic<bool> *cancel);
+private:
+	vector<int3> &triangles;				// vertex ids, updated by collapses
+	vector<int> position;					// vertex id to position id (vertices at one location share one)
+	vector<vec3> locations;					// per position
+	vector<vector<int>> incident;			// triangles of each position, dead ones pruned lazily
+	vector<Quadric> quadrics;
+	vector<int> versions;
+	vector<char> border, removed, alive;	// per position, position, triangle
+	vector<int2> pairs;						// for a collapse, vertex id at from to vertex id at to
+	std::priority_queue<Collapse> heap;
+	int nAlive = 0;
+	int At(int t, int k) const { return position[triangles[t][k]]; }
+	bool Has(int t, int p) const { return At(t, 0) == p || At(t, 1) == p || At(t, 2) == p; }
+	void Push(int from, int to);
+	bool CanCollapse(int from, int to);
+	void DoCollapse(int from, int to);
+};
+
+Simplifier::Simplifier(const vector<vec3> &points, vector<int3> &triangles) : triangles(triangles) {
+	int nVertices = points.size(), nTriangles = triangles.size();
+	// weld vertices by location
+	vector<int> order(nVertices);
+	for (int i = 0; i < nVertices; i++)
+		order[i] = i;
+	std::sort(order.begin(), order.end(), [&points](int a, int b) {
+		const vec3 &p = points[a], &q = points[b];
+		return p.x != q.x? p.x < q.x : p.y != q.y? p.y < q.y : p.z < q.z; });
+	position.resize(nVertices);
+	for (int i = 0; i < nVertices; i++) {
+		const vec3 &p = points[order[i]];
+		if (!i || p.x != locations.back().x || p.y != locations.back().y || p.z != locations.back().z)
+			locations.push_back(p);
+		position[order[i]] = locations.size()-1;
+	}
+	int nPositions = locations.size();
+	incident.resize(nPositions);
+	quadrics.resize(nPositions);
+	versions.assign(nPositions, 0);
+	border.assign(nPositions, 0);
+	removed.assign(nPositions, 0);
+	alive.assign(nTriangles, 1);
+	nAlive = nTriangles;
+	// plane quadrics, and edges keyed by (lesser, greater) position with their triangle
+	vector<std::pair<unsigned long long, int>> edges;
+	edges.reserve(3*nTriangles);
+	for (int t = 0; t < nTriangles; t++) {
+		int p[] = { At(t, 0), At(t, 1), At(t, 2) };
+		vec3 n = cross(locations[p[1]]-locations[p[0]], locations[p[2]]-locations[p[0]]);
+		float len = length(n);
+		for (int k = 0; k < 3; k++) {
+			if (k == 0 || (p[k] != p[0] && (k == 1 || p[k] != p[1]))) {
+				incident[p[k]].push_back(t);
+				if (len > 0)
+					quadrics[p[k]].AddPlane(n/len, -dot(n/len, locations[p[0]]));
+			}
+			int a = p[k], b = p[(k+1)%3];
+			if (a != b)
+				edges.push_back({ a < b? ((unsigned long long) a << 32) | (unsigned) b : ((unsigned long long) b << 32) | (unsigned) a, t });
+		}
+	}
+	std::sort(edges.begin(), edges.end());
+	for (size_t i = 0; i < edges.size(); ) {
+		size_t j = i+1;
+		while (j < edges.size() && edges[j].first == edges[i].first)
+			j++;
+		int a = (int) (edges[i].first >> 32), b = (int) (edges[i].first & 0xffffffff);
+		if (j == i+1) {
+			// border edge: add plane through edge, perpendicular to its triangle, to keep border in place
+			int t = edges[i].second;
+			vec3 n = cross(locations[At(t, 1)]-locations[At(t, 0)], locations[At(t, 2)]-locations[At(t, 0)]);
+			vec3 e = locations[b]-locations[a], bn = cross(e, n);
+			float len = length(bn);
+			if (len > 0)
+				for (int p : { a, b })
+					quadrics[p].AddPlane(bn/len, -dot(bn/len, locations[a]));
+			border[a] = border[b] = 1;
+		}
+		Push(a, b);
+		Push(b, a);
+		i = j;
+	}
+}
+
+void Simplifier::Push(int from, int to) {
+	Quadric q = quadrics[from];
+	q.Add(quadrics[to]);
+	heap.push({ (float) q.Error(locations[to]), from, to, versions[from], versions[to] });
+}
+
+bool Simplifier::CanCollapse(int from, int to) {
+	// every vertex id at from must pair with one vertex id at to, across a triangle on the edge:
+	// so a seam (or border) vertex moves only along its seam (or border), and its attributes stay split
+	pairs.resize(0);
+	int nShared = 0;
+	for (int t : incident[from]) {
+		if (!alive[t] || !Has(t, to))
+			continue;
+		nShared++;
+		int idFrom = -1, idTo = -1;
+		for (int k = 0; k < 3; k++) {
+			if (At(t, k) == from) idFrom = triangles[t][k];
+			if (At(t, k) == to) idTo = triangles[t][k];
+		}
+		for (int2 &p : pairs)
+			if (p.i1 == idFrom && p.i2 != idTo)
+				return false;
+		pairs.push_back(int2(idFrom, idTo));
+	}
+	if (!nShared || (border[from] && nShared != 1))
+		return false;
+	for (int t : incident[from]) {
+		if (!alive[t] || Has(t, to))
+			continue;
+		vec3 p[3], q[3];
+		for (int k = 0; k < 3; k++) {
+			int pos = At(t, k);
+			if (pos == from) {
+				int id = triangles[t][k];
+				if (std::find_if(pairs.begin(), pairs.end(), [id](const int2 &p) { return p.i1 == id; }) == pairs.end())
+					return false;
+			}
+			p[k] = locations[pos];
+			q[k] = pos == from? locations[to] : p[k];
+		}
+		// reject if triangle would flip, degenerate or turn more than about 75 degrees
+		vec3 n = cross(p[1]-p[0], p[2]-p[0]), m = cross(q[1]-q[0], q[2]-q[0]);
+		if (dot(n, m) <= .25f*length(n)*length(m))
+			return false;
+	}
+	return true;
+}
+
+void Simplifier::DoCollapse(int from, int to) {
+	for (int t : incident[from]) {
+		if (!alive[t])
+			continue;
+		if (Has(t, to)) {
+			alive[t] = 0;
+			nAlive--;
+			continue;
+		}
+		for (int k = 0; k < 3; k++)
+			if (At(t, k) == from)
+				for (int2 &p : pairs)
+					if (p.i1 == triangles[t][k]) {
+						triangles[t][k] = p.i2;
+						break;
+					}
+		incident[to].push_back(t);
+	}
+	vector<int>().swap(incident[from]);
+	quadrics[to].Add(quadrics[from]);
+	removed[from] = 1;
+	versions[to]++;
+	// prune dead triangles of to, requeue its edges
+	vector<int> &ts = incident[to];
+	ts.erase(std::remove_if(ts.begin(), ts.end(), [this](int t) { return !alive[t]; }), ts.end());
+	vector<int> neighbors;
+	for (int t : ts)
+		for (int k = 0; k < 3; k++)
+			if (At(t, k) != to)
+				neighbors.push_back(At(t, k));
+	std::sort(neighbors.begin(), neighbors.end());
+	neighbors.erase(std::unique(neighbors.begin(), neighbors.end()), neighbors.end());
+	for (int n : neighbors) {
+		Push(to, n);
+		Push(n, to);
+	}
+}
+
+float Simplifier::Run(int targetTriangles, float maxError, const std::atomic<bool> *cancel) {
+	double maxCost = maxError < FLT_MAX? (double) maxError*maxError : DBL_MAX, error = 0;
+	for (int i = 0; nAlive > targetTriangles && !heap.empty(); i++) {
+		if (cancel && (i & 1023) == 0 && cancel->load(std::memory_order_relaxed))
+			break;
+		Collapse c = heap.top();
+		heap.pop();
+		if (removed[c.from] || removed[c.to] || versions[c.from] != c.fromVersion || versions[c.to] != c.toVersion)
+			continue;
+		if (c.cost > maxCost)
+			break;
+		if (!CanCollapse(c.from, c.to))
+			continue;
+		DoCollapse(c.from, c.to);
+		error = std::max(error, (double) c.cost);
+	}
+	int n = 0;
+	for (size_t t = 0; t < triangles.size(); t++)
+		if (alive[t])
+			triangles[n++] = triangles[t];
+	triangles.resize(n);
+	return (float) sqrt(error);
+}
+
+} // end namespace
+
+float Simplify(const vector<vec3> &points, vector<int3> &triangles, int targetTriangles, float maxError, const std::atomic<bool> *cancel) {
+	TRACE_ZONE("Simplify");
+	if ((int) triangles.size() <= targetTriangles)
+		return 0;
+	Simplifier s(points, triangles);
+	return s.Run(targetTriangles, maxError, cancel);
+}
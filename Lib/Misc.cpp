@@ -6,7 +6,13 @@
 #include <stdlib.h>
 #include "Draw.h"
 #include "Misc.h"
+#include "Trace.h"
 #include <sys/stat.h>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STB_IMAGE_WRITE_IMPLEMENTATION
@@ -39,7 +45,78 @@ time_t FileModified(const char *name) {
 }
 
 bool FileExists(const char *name) {
-	return fopen(name, "r") != NULL;
+	FILE *f = fopen(name, "r");
+	if (f)
+		fclose(f);
+	return f != NULL;
+}
+
+// Memory-mapped File
+
+bool MappedFile::Open(const char *filename) {
+	Close();
+#ifdef _WIN32
+	HANDLE f = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (f == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(f, &fileSize)) {
+		CloseHandle(f);
+		return false;
+	}
+	file = f;
+	size = (size_t) fileSize.QuadPart;
+	if (!size) {
+		data = "";							// can't map empty file
+		return true;
+	}
+	mapping = CreateFileMappingA(f, NULL, PAGE_READONLY, 0, 0, NULL);
+	data = mapping? (const char *) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+#else
+	int f = open(filename, O_RDONLY);
+	if (f < 0)
+		return false;
+	struct stat info;
+	if (fstat(f, &info) != 0) {
+		close(f);
+		return false;
+	}
+	file = (void *) (size_t) (f+1);			// offset so descriptor 0 is non-null
+	size = (size_t) info.st_size;
+	if (!size) {
+		data = "";
+		return true;
+	}
+	void *m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, f, 0);
+	data = m != MAP_FAILED? (const char *) m : NULL;
+	if (data)
+		madvise(m, size, MADV_SEQUENTIAL);
+#endif
+	if (!data) {
+		printf("can't map %s\n", filename);
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MappedFile::Close() {
+#ifdef _WIN32
+	if (data && size)
+		UnmapViewOfFile(data);
+	if (mapping)
+		CloseHandle((HANDLE) mapping);
+	if (file)
+		CloseHandle((HANDLE) file);
+#else
+	if (data && size)
+		munmap((void *) data, size);
+	if (file)
+		close((int) (size_t) file-1);
+#endif
+	data = NULL;
+	size = 0;
+	file = mapping = NULL;
 }
 
 // Sphere
@@ -221,6 +298,7 @@ unsigned char *MergeFiles(const char *imageName, const char *matteName, int &ima
 // Texture
 
 void LoadTexture(unsigned char *pixels, int width, int height, int bpp, GLuint textureName, bool bgr, bool mipmap) {
+	TRACE_ZONE("LoadTexture (upload)");
 	unsigned char *temp = pixels;
 	if (false && bpp == 4) {
 		int bytesPerImage = 3*width*height;
@@ -251,6 +329,7 @@ void LoadTexture(unsigned char *pixels, int width, int height, int bpp, GLuint t
 }
 
 GLuint LoadTexture(const char *filename, bool mipmap, int *n) {
+	TRACE_ZONE("LoadTexture");
 	int width, height, nChannels;
 	stbi_set_flip_vertically_on_load(true);
 	unsigned char *data = stbi_load(filename, &width, &height, &nChannels, 0);
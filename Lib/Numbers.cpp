@@ -6,6 +6,7 @@
 #include "GLXtras.h" // LinkProgramViaCode, VertexAttribPointer, SetUniform
 #include "Misc.h"    // LoadTexture
 #include "Numbers.h" // Number
+#include "VertexLayout.h" // VertexLayout, GetVertexArray
 #include <stdio.h>   // printf
 
 namespace {
@@ -48,7 +49,11 @@ const char *pixelShader = R"(
 	}
 )";
 
-GLuint shaderProgram = 0, vertexBuffer = 0, textureName = 0;
+GLuint shaderProgram = 0, vertexBuffer = 0, vao = 0, textureName = 0;
+
+const VertexLayout layout = { { "point", 4, GL_FLOAT, false, 0, 4*sizeof(float) } };
+	// each vertex is 4 floats: x, y, u, v
+
 int numbersTextureUnit = 0;
 
 } // end namespace
@@ -77,10 +82,10 @@ void Number(int x, int y, unsigned int n, vec3 color, float ptSize) {
 		glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
 		glBufferData(GL_ARRAY_BUFFER, sizeof(float)*4*6, NULL, GL_DYNAMIC_DRAW);
 			// need 4 vertices for quad, but 6 if triangles
+		vao = GetVertexArray(vertexBuffer, layout, shaderProgram);
 	}
+	glBindVertexArray(vao);
 	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-	VertexAttribPointer(shaderProgram, "point", 4, 4*sizeof(float), 0);
-		// each vertex is 4 floats, stride is 4 floats
 	glActiveTexture(GL_TEXTURE0+numbersTextureUnit);
 	glBindTexture(GL_TEXTURE_2D, textureName);
 	// set screen-mode
@@ -4,13 +4,17 @@
 #include "GLXtras.h"
 #include "Misc.h"
 #include "Sprite.h"
+#include "Trace.h"
 #include <iostream>
+#include <stdio.h>
 
 using namespace std;
 
 namespace {
 
-GLuint spriteShader = 0;
+struct SpriteUniforms {
+	int view, z, uvTransform, textureImage, textureMat;
+};
 
 vec2 PtTransform(vec2 p, mat4 &m) {
 	vec4 x = m*vec4(p, 0, 1);
@@ -125,88 +129,127 @@ void Sprite::SetPtTransform(mat4 m) { ptTransform = m; }
 
 void Sprite::SetUvTransform(mat4 m) { uvTransform = m; }
 
-int GetSpriteShader() {
-	if (!spriteShader)
-		BuildShader();
-	return spriteShader;
-}
+namespace {
+
+// sprite shaders: a quad, or two triangles if GL_QUADS unsupported
 
-void BuildShader() {
-	const char *vShaderQ = R"(
-		#version 330
-		uniform mat4 view;
-		uniform float z = 0;
-		out vec2 uv;
-		void main() {
-			vec2 pts[] = vec2[4](vec2(-1,-1), vec2(-1,1), vec2(1,1), vec2(1,-1));
-			uv = (vec2(1,1)+pts[gl_VertexID])/2;
-			gl_Position = view*vec4(pts[gl_VertexID], z, 1);
-		}
-	)";
-	const char *vShaderT = R"(
-		#version 330
-		uniform mat4 view;
-		uniform float z = 0;
-		out vec2 uv;
-		void main() {
-			vec2 pts[] = vec2[6](vec2(-1,-1), vec2(-1,1), vec2(1,1), vec2(-1,-1), vec2(1,1), vec2(1,-1));
-			uv = (vec2(1,1)+pts[gl_VertexID])/2;
-			gl_Position = view*vec4(pts[gl_VertexID], z, 1);
-		}
-	)";
-	const char *pShader = R"(
-		#version 330
-		in vec2 uv;
-		out vec4 pColor;
-		uniform mat4 uvTransform;
-		uniform sampler2D textureImage;
-		uniform sampler2D textureMat;
-		uniform bool useMat;
-		uniform int nTexChannels = 3;
-		void main() {
-			vec2 st = (uvTransform*vec4(uv, 0, 1)).xy;
-			if (nTexChannels == 4)
-				pColor = texture(textureImage, st);
-			else {
-				pColor.rgb = texture(textureImage, st).rgb;
-				pColor.a = useMat? texture(textureMat, st).r : 1;
-			}
-			if (pColor.a < .02) // if nearly full matte,
-				discard;		// don't tag z-buffer
-		}
-	)";
 #ifdef GL_QUADS
-	spriteShader = LinkProgramViaCode(&vShaderQ, &pShader);
+const char *spriteVShader = R"(
+	#version 330
+	uniform mat4 view;
+	uniform float z = 0;
+	out vec2 uv;
+	void main() {
+		vec2 pts[] = vec2[4](vec2(-1,-1), vec2(-1,1), vec2(1,1), vec2(1,-1));
+		uv = (vec2(1,1)+pts[gl_VertexID])/2;
+		gl_Position = view*vec4(pts[gl_VertexID], z, 1);
+	}
+)";
 #else
-	spriteShader = LinkProgramViaCode(&vShaderT, &pShader);
+const char *spriteVShader = R"(
+	#version 330
+	uniform mat4 view;
+	uniform float z = 0;
+	out vec2 uv;
+	void main() {
+		vec2 pts[] = vec2[6](vec2(-1,-1), vec2(-1,1), vec2(1,1), vec2(-1,-1), vec2(1,1), vec2(1,-1));
+		uv = (vec2(1,1)+pts[gl_VertexID])/2;
+		gl_Position = view*vec4(pts[gl_VertexID], z, 1);
+	}
+)";
 #endif
+
+const char *spritePShader = R"(
+	#version 330
+	in vec2 uv;
+	out vec4 pColor;
+	uniform mat4 uvTransform;
+	uniform sampler2D textureImage;
+	uniform sampler2D textureMat;
+	#ifndef VARIANTS
+	uniform bool useMat;
+	uniform int nTexChannels = 3;
+	#define rgba (nTexChannels == 4)
+	#endif
+	void main() {
+		vec2 st = (uvTransform*vec4(uv, 0, 1)).xy;
+		if (rgba)
+			pColor = texture(textureImage, st);
+		else {
+			pColor.rgb = texture(textureImage, st).rgb;
+			pColor.a = useMat? texture(textureMat, st).r : 1;
+		}
+		if (pColor.a < .02) // if nearly full matte,
+			discard;		// don't tag z-buffer
+	}
+)";
+
+const int SpriteMat = 1, SpriteRGBA = 2;	// feature bits
+
+ShaderVariants spriteVariants(spriteVShader, spritePShader, { "useMat", "rgba" });
+
+struct SpriteVariant {
+	Program *program = NULL;
+	SpriteUniforms u;
+} spriteVariantUniforms[4];
+
+SpriteUniforms FindSpriteUniforms(Program &p) {
+	return { p.Uniform("view"), p.Uniform("z"), p.Uniform("uvTransform"), p.Uniform("textureImage"), p.Uniform("textureMat") };
+}
+
+} // end namespace
+
+int GetSpriteShader() {
+	return GetSpriteProgram().id;
+}
+
+Program &GetSpriteProgram() {
+	return spriteVariants.Generic();
+}
+
+void BuildShader() {
+	// start compiling all variants; they finish while textures load
+	for (int features = 0; features < 4; features++) {
+		char label[100];
+		sprintf(label, "sprite shader, features %i", features);
+		LabelObject(GL_PROGRAM, spriteVariants.Prepare(features), label);
+	}
 }
 
 void Sprite::Display(mat4 *fullview, int textureUnit) {
-	if (!spriteShader)
-		BuildShader();
-	glUseProgram(spriteShader);
-	glActiveTexture(GL_TEXTURE0+textureUnit);
+	TRACE_ZONE("Sprite::Display");
 	if (nFrames) { // animation
 		time_t now = clock();
 		if (now > change) {
 			frame = (frame+1)%nFrames;
 			change = now+(time_t)(frameDuration*CLOCKS_PER_SEC);
 		}
-		glBindTexture(GL_TEXTURE_2D, textureNames[frame]);
+		DisplayTexture(textureNames[frame], textureUnit, fullview);
 	}
-	else glBindTexture(GL_TEXTURE_2D, textureName);
-	SetUniform(spriteShader, "textureImage", (int) textureUnit);
-	SetUniform(spriteShader, "useMat", matName > 0);
-	SetUniform(spriteShader, "nTexChannels", nTexChannels);
-	SetUniform(spriteShader, "z", z);
+	else DisplayTexture(textureName, textureUnit, fullview);
+}
+
+void Sprite::DisplayTexture(GLuint texName, int textureUnit, mat4 *fullview) {
+	// use shader specialized for matte and channel count
+	int features = (matName > 0? SpriteMat : 0) | (nTexChannels == 4? SpriteRGBA : 0);
+	SpriteVariant &v = spriteVariantUniforms[features];
+	if (!v.program) {
+		v.program = &spriteVariants.Get(features);
+		v.u = FindSpriteUniforms(*v.program);
+	}
+	Program &p = *v.program;
+	glUseProgram(p.id);
+	glActiveTexture(GL_TEXTURE0+textureUnit);
+	glBindTexture(GL_TEXTURE_2D, texName);
+	p.Set(v.u.textureImage, (int) textureUnit);
+	p.Set(v.u.z, z);
 	if (matName > 0) {
 		glActiveTexture(GL_TEXTURE0+textureUnit+1);
 		glBindTexture(GL_TEXTURE_2D, matName);
-		SetUniform(spriteShader, "textureMat", (int) textureUnit+1);
+		p.Set(v.u.textureMat, (int) textureUnit+1);
 	}
-	SetUniform(spriteShader, "view", fullview? *fullview*ptTransform : ptTransform);
-	SetUniform(spriteShader, "uvTransform", uvTransform);
+	p.Set(v.u.view, fullview? *fullview*ptTransform : ptTransform);
+	p.Set(v.u.uvTransform, uvTransform);
 #ifdef GL_QUADS
 	glDrawArrays(GL_QUADS, 0, 4);
 #else
@@ -7,6 +7,8 @@
 #include "GLXtras.h"
 #include "Letters.h"
 #include "Text.h"
+#include "Trace.h"
+#include "VertexLayout.h"
 #include <map>
 #include <stdio.h>
 
@@ -23,6 +25,9 @@
 // if FreeType not linked, comment next line:
 // #define FREETYPE_OK
 
+const VertexLayout textLayout = { { "point", 4, GL_FLOAT, false, 0, 4*sizeof(float) } };
+	// each vertex is x, y, u, v
+
 #ifndef FREETYPE_OK
 float scaleAdj = .5f;
 void Text(int x, int y, vec3 color, float scale, const char *format, ...) {
@@ -54,7 +59,7 @@ CharacterSet *SetFont(const char *fontName, int charRes, int pixelRes, bool forc
 
 using std::string;
 
-static GLuint textShaderProgram = 0, textVertexBuffer = 0;
+static GLuint textShaderProgram = 0, textVertexBuffer = 0, textVao = 0;
 
 CharacterSet *currentFont = NULL;
 
@@ -101,6 +106,7 @@ void SetCharacterSet(CharacterSet &cs, const char *fontName, int charRes, int pi
 }
 
 CharacterSet *SetFont(const char *fontName, int charRes, int pixelRes, bool forceInit) {
+	TRACE_ZONE("SetFont");
 	CharacterSets::iterator it = fonts.find(fontName);
 	if (it == fonts.end() || forceInit) {
 		CharacterSet cs;
@@ -133,9 +139,15 @@ static const char *textPixelShader = "\
 		pColor = vec4(color, a);                    \n\
 	}                                               \n";
 
-void RenderText(const char *text, float x, float y, vec3 color, float scale, mat4 view, bool vertical) {
+void BuildTextShader() {
 	if (!textShaderProgram)
-		textShaderProgram = LinkProgramViaCode(&textVertexShader, &textPixelShader);
+		textShaderProgram = LinkProgramDeferred(&textVertexShader, &textPixelShader);
+}
+
+void RenderText(const char *text, float x, float y, vec3 color, float scale, mat4 view, bool vertical) {
+	BuildTextShader();
+	if (ProgramPending(textShaderProgram))
+		FinishProgram(textShaderProgram);
 	glUseProgram(textShaderProgram);
 	if (!currentFont) {
 		SetFont("C:/Fonts/OpenSans/OpenSans-Regular.ttf", 64, 100);  // unsure exact effect of charRes, pixelRes
@@ -143,11 +155,13 @@ void RenderText(const char *text, float x, float y, vec3 color, float scale, mat
 	}
 	scale /= (float) currentFont->charRes;
 	// create quad vertex buffer and build characters
-	if (textVertexBuffer == 0)
+	if (textVertexBuffer == 0) {
 		glGenBuffers(1, &textVertexBuffer);
+		textVao = GetVertexArray(textVertexBuffer, textLayout, textShaderProgram);
+	}
+	glBindVertexArray(textVao);
 	glBindBuffer(GL_ARRAY_BUFFER, textVertexBuffer);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(float)*6*4, NULL, GL_DYNAMIC_DRAW);
-	VertexAttribPointer(textShaderProgram, "point", 4, 4*sizeof(float), 0);
 	SetUniform(textShaderProgram, "view", view);
 	SetUniform(textShaderProgram, "color", color);
 	// SetUniform(textShaderProgram, "textureImage", (int) textureID); // not needed? (defaults to 0?)
@@ -218,3 +232,19 @@ void Text(float x, float y, vec3 color, float scale, const char *format, ...) {
 }
 
 #endif
+
+// Frame Statistics
+
+void TextGLFrameStats(int x, int y, vec3 color, float scale) {
+#ifdef GL_STATS
+	GLFrameStats s = GetGLFrameStats();
+	int dy = (int) (15*scale);
+	Text(x, y, color, scale, "draws: %i, triangles: %lli", s.draws, s.triangles);
+	Text(x, y -= dy, color, scale, "binds: program %i, texture %i, buffer %i, vao %i",
+		 s.programBinds, s.textureBinds, s.bufferBinds, s.vertexArrayBinds);
+	Text(x, y -= dy, color, scale, "uploads: %i (%.1f KB)", s.uploads, s.uploadBytes/1024.);
+	Text(x, y -= dy, color, scale, "read pixels: %i", s.readPixels);
+#else
+	Text(x, y, color, scale, "GL stats: define GL_STATS");
+#endif
+}
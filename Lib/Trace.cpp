@@ -0,0 +1,157 @@
+// Trace.cpp - scoped CPU trace zones, written as Chrome trace-event JSON
+
+#include "Trace.h"
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct TraceEvent {
+	const char *name;
+	long long start, duration;				// ns since trace origin
+};
+
+const int BlockSize = 1 << 10;				// events per block, allocated as needed
+const int NBlocks = 64;
+const int ThreadCapacity = BlockSize*NBlocks;	// events per thread; later events dropped
+
+struct ThreadTrace {
+	// a thread that records few zones holds one small block, not a full-capacity buffer
+	// blocks are not moved, and a block is set before nEvents is released past its start,
+	// so a writer may read events [0, nEvents) while the owning thread appends
+	int tid = 0;
+	std::atomic<int> nEvents{0};			// written only by owning thread
+	std::atomic<int> nDropped{0};			// read while owning thread may be counting
+	TraceEvent *blocks[NBlocks] = { };
+	TraceEvent &Event(int i) { return blocks[i/BlockSize][i%BlockSize]; }
+};
+
+std::atomic<bool> tracing{false};
+std::mutex threadsMutex;					// held only when a thread records its first zone
+std::vector<ThreadTrace *> threads;			// not freed: a thread may exit before the trace is written
+std::string traceFilename = "trace.json";
+bool atExitSet = false;
+std::atomic<bool> written{false};			// set by whichever thread writes the trace
+thread_local ThreadTrace *threadTrace = NULL;
+
+long long Clock() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+long long origin = Clock();
+
+ThreadTrace *GetThreadTrace() {
+	if (!threadTrace) {
+		ThreadTrace *t = new ThreadTrace;
+		std::lock_guard<std::mutex> lock(threadsMutex);
+		t->tid = (int) threads.size()+1;
+		threads.push_back(t);
+		threadTrace = t;
+	}
+	return threadTrace;
+}
+
+void WriteName(FILE *out, const char *name) {
+	// JSON string, escaping quote and backslash
+	fputc('"', out);
+	for (const char *c = name; *c; c++) {
+		if (*c == '"' || *c == '\\')
+			fputc('\\', out);
+		fputc(*c, out);
+	}
+	fputc('"', out);
+}
+
+void WriteAtExit() {
+	if (!written.load())
+		TraceWrite();
+}
+
+} // end namespace
+
+// Zones
+
+TraceZone::TraceZone(const char *name) : name(name) {
+	start = tracing.load(std::memory_order_relaxed)? Clock()-origin : -1;
+}
+
+TraceZone::~TraceZone() {
+	if (start < 0)
+		return;
+	long long end = Clock()-origin;
+	ThreadTrace *t = GetThreadTrace();
+	int n = t->nEvents.load(std::memory_order_relaxed);
+	if (n >= ThreadCapacity) {
+		t->nDropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	if (n%BlockSize == 0 && !t->blocks[n/BlockSize])
+		t->blocks[n/BlockSize] = new TraceEvent[BlockSize];
+	t->Event(n) = { name, start, end-start };
+	t->nEvents.store(n+1, std::memory_order_release);
+}
+
+// Control
+
+void TraceStart(const char *filename) {
+	if (filename)
+		traceFilename = filename;
+	if (!atExitSet) {
+		atexit(WriteAtExit);
+		atExitSet = true;
+	}
+	written.store(false);
+	tracing.store(true);
+}
+
+void TraceStop() {
+	tracing.store(false);
+}
+
+bool Tracing() {
+	return tracing.load(std::memory_order_relaxed);
+}
+
+bool TraceWrite(const char *filename) {
+	const char *f = filename? filename : traceFilename.c_str();
+	FILE *out = fopen(f, "w");
+	if (!out) {
+		printf("can't write trace %s\n", f);
+		return false;
+	}
+	std::vector<ThreadTrace *> ts;
+	{
+		std::lock_guard<std::mutex> lock(threadsMutex);
+		ts = threads;
+	}
+	int nEvents = 0, nDropped = 0;
+	fprintf(out, "{\"traceEvents\":[\n");
+	bool first = true;
+	for (ThreadTrace *t : ts) {
+		fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%i,\"args\":{\"name\":\"thread %i\"}}",
+			first? "" : ",\n", t->tid, t->tid);
+		first = false;
+		int n = t->nEvents.load(std::memory_order_acquire);
+		for (int i = 0; i < n; i++) {
+			TraceEvent &e = t->Event(i);
+			fprintf(out, ",\n{\"name\":");
+			WriteName(out, e.name);
+			fprintf(out, ",\"ph\":\"X\",\"pid\":1,\"tid\":%i,\"ts\":%.3f,\"dur\":%.3f}", t->tid, e.start/1000., e.duration/1000.);
+		}
+		nEvents += n;
+		nDropped += t->nDropped.load(std::memory_order_relaxed);
+	}
+	fprintf(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	fclose(out);
+	written.store(true);
+	printf("trace: %i events from %i threads written to %s", nEvents, (int) ts.size(), f);
+	if (nDropped)
+		printf(" (%i dropped)", nDropped);
+	printf("\n");
+	return true;
+}
@@ -0,0 +1,221 @@
+// Unprojector.cpp - map screen points to 3D, replaces gluUnProject
+
+#include "GLState.h"
+#include "Unprojector.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define UNPROJECT_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace {
+
+bool InvertD(double m[4][4], double out[4][4]) {
+	// Gauss-Jordan elimination with partial pivoting
+	double a[4][8];
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++) {
+			a[i][j] = m[i][j];
+			a[i][j+4] = i == j? 1 : 0;
+		}
+	for (int c = 0; c < 4; c++) {
+		int p = c;
+		for (int r = c+1; r < 4; r++)
+			if (fabs(a[r][c]) > fabs(a[p][c]))
+				p = r;
+		if (a[p][c] == 0)
+			return false;
+		if (p != c)
+			for (int j = 0; j < 8; j++) {
+				double t = a[c][j]; a[c][j] = a[p][j]; a[p][j] = t;
+			}
+		double s = 1/a[c][c];
+		for (int j = 0; j < 8; j++)
+			a[c][j] *= s;
+		for (int r = 0; r < 4; r++)
+			if (r != c && a[r][c] != 0) {
+				double f = a[r][c];
+				for (int j = 0; j < 8; j++)
+					a[r][j] -= f*a[c][j];
+			}
+	}
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++)
+			out[i][j] = a[i][j+4];
+	return true;
+}
+
+} // end namespace
+
+bool Unprojector::Set(mat4 mv, mat4 p, const int *viewport) {
+	modelview = mv;
+	persp = p;
+	if (viewport)
+		memcpy(vp, viewport, sizeof(vp));
+	else
+		GetGLViewport(vp);
+	origin = vec3(mv[0][3], mv[1][3], mv[2][3]);
+	double m[4][4];
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++) {
+			m[i][j] = 0;
+			for (int k = 0; k < 4; k++)
+				m[i][j] += (double) p[i][k]*(double) mv[k][j];
+		}
+	valid = InvertD(m, dinv);
+	for (int i = 0; i < 4; i++)
+		for (int j = 0; j < 4; j++)
+			inv[i][j] = (float) dinv[i][j];
+	return valid;
+}
+
+bool Unprojector::Update(mat4 mv, mat4 p, const int *viewport) {
+	int v[4];
+	if (viewport)
+		memcpy(v, viewport, sizeof(v));
+	else
+		GetGLViewport(v);
+	if (!valid || memcmp(v, vp, sizeof(v)) || memcmp(&mv, &modelview, sizeof(mat4)) || memcmp(&p, &persp, sizeof(mat4)))
+		Set(mv, p, v);
+	return valid;
+}
+
+// Single Points
+
+vec3 Unprojector::Unproject(float xscreen, float yscreen, float zWindow) const {
+	double in[4] = { 2.*(xscreen-vp[0])/vp[2]-1, 2.*(yscreen-vp[1])/vp[3]-1, 2.*zWindow-1, 1 }, out[4];
+	for (int i = 0; i < 4; i++)
+		out[i] = dinv[i][0]*in[0]+dinv[i][1]*in[1]+dinv[i][2]*in[2]+dinv[i][3];
+	double w = out[3] != 0? 1/out[3] : 0;
+	return vec3((float) (w*out[0]), (float) (w*out[1]), (float) (w*out[2]));
+}
+
+void Unprojector::Line(float xscreen, float yscreen, vec3 &p1, vec3 &p2) const {
+	p1 = Unproject(xscreen, yscreen, .25f);
+	p2 = Unproject(xscreen, yscreen, .50f);
+}
+
+void Unprojector::Ray(float xscreen, float yscreen, vec3 &p, vec3 &v) const {
+	vec3 a, b;
+	Line(xscreen, yscreen, a, b);
+	p = origin;
+	v = normalize(b-a);
+}
+
+// Batches
+
+#ifdef UNPROJECT_SSE
+
+namespace {
+
+struct SSEMatrix {
+	__m128 m[4][4];							// each element splatted across four lanes
+	SSEMatrix(const float inv[4][4]) {
+		for (int i = 0; i < 4; i++)
+			for (int j = 0; j < 4; j++)
+				m[i][j] = _mm_set1_ps(inv[i][j]);
+	}
+	void Transform(__m128 x, __m128 y, __m128 z, __m128 out[3]) const {
+		// transform four NDC points, divide by w
+		__m128 r[4];
+		for (int i = 0; i < 4; i++)
+			r[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(m[i][0], x), _mm_mul_ps(m[i][1], y)),
+							  _mm_add_ps(_mm_mul_ps(m[i][2], z), m[i][3]));
+		__m128 w = _mm_div_ps(_mm_set1_ps(1), r[3]);
+		for (int i = 0; i < 3; i++)
+			out[i] = _mm_mul_ps(r[i], w);
+	}
+	void Directions(__m128 x, __m128 y, __m128 d[3]) const {
+		// unit direction between unprojections at window depth .25, .5 (NDC -.5, 0)
+		__m128 a[3], b[3];
+		Transform(x, y, _mm_set1_ps(-.5f), a);
+		Transform(x, y, _mm_setzero_ps(), b);
+		for (int i = 0; i < 3; i++)
+			d[i] = _mm_sub_ps(b[i], a[i]);
+		__m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(d[0], d[0]), _mm_mul_ps(d[1], d[1])), _mm_mul_ps(d[2], d[2])));
+		for (int i = 0; i < 3; i++)
+			d[i] = _mm_div_ps(d[i], len);
+	}
+};
+
+void Store(__m128 v[3], vec3 *out, int n) {
+	// transpose four SoA results to n (<= 4) vec3s
+	float t[3][4];
+	for (int i = 0; i < 3; i++)
+		_mm_storeu_ps(t[i], v[i]);
+	for (int k = 0; k < n; k++)
+		out[k] = vec3(t[0][k], t[1][k], t[2][k]);
+}
+
+} // end namespace
+
+void Unprojector::Unproject(int n, const vec2 *screen, float zWindow, vec3 *points) const {
+	SSEMatrix m(inv);
+	float sx = 2.f/vp[2], sy = 2.f/vp[3], ox = -1-sx*vp[0], oy = -1-sy*vp[1];
+	__m128 z = _mm_set1_ps(2*zWindow-1), r[3];
+	for (int i = 0; i < n; i += 4) {
+		int k = n-i < 4? n-i : 4;
+		float x[4] = { 0, 0, 0, 0 }, y[4] = { 0, 0, 0, 0 };
+		for (int j = 0; j < k; j++) {
+			x[j] = ox+sx*screen[i+j].x;
+			y[j] = oy+sy*screen[i+j].y;
+		}
+		m.Transform(_mm_loadu_ps(x), _mm_loadu_ps(y), z, r);
+		Store(r, points+i, k);
+	}
+}
+
+void Unprojector::Rays(int n, const vec2 *screen, vec3 *dirs) const {
+	SSEMatrix m(inv);
+	float sx = 2.f/vp[2], sy = 2.f/vp[3], ox = -1-sx*vp[0], oy = -1-sy*vp[1];
+	__m128 d[3];
+	for (int i = 0; i < n; i += 4) {
+		int k = n-i < 4? n-i : 4;
+		float x[4] = { 0, 0, 0, 0 }, y[4] = { 0, 0, 0, 0 };
+		for (int j = 0; j < k; j++) {
+			x[j] = ox+sx*screen[i+j].x;
+			y[j] = oy+sy*screen[i+j].y;
+		}
+		m.Directions(_mm_loadu_ps(x), _mm_loadu_ps(y), d);
+		Store(d, dirs+i, k);
+	}
+}
+
+void Unprojector::GridRays(int x, int y, int nx, int ny, vec3 *dirs, int step) const {
+	SSEMatrix m(inv);
+	float sx = 2.f/vp[2], sy = 2.f/vp[3], ox = -1-sx*vp[0], oy = -1-sy*vp[1];
+	__m128 lanes = _mm_mul_ps(_mm_set_ps(3, 2, 1, 0), _mm_set1_ps(sx*step)), d[3];
+	for (int j = 0; j < ny; j++) {
+		__m128 ndcY = _mm_set1_ps(oy+sy*(y+j*step));
+		for (int i = 0; i < nx; i += 4) {
+			int k = nx-i < 4? nx-i : 4;
+			__m128 ndcX = _mm_add_ps(_mm_set1_ps(ox+sx*(x+i*step)), lanes);
+			m.Directions(ndcX, ndcY, d);
+			Store(d, dirs+j*nx+i, k);
+		}
+	}
+}
+
+#else
+
+void Unprojector::Unproject(int n, const vec2 *screen, float zWindow, vec3 *points) const {
+	for (int i = 0; i < n; i++)
+		points[i] = Unproject(screen[i].x, screen[i].y, zWindow);
+}
+
+void Unprojector::Rays(int n, const vec2 *screen, vec3 *dirs) const {
+	vec3 p;
+	for (int i = 0; i < n; i++)
+		Ray(screen[i].x, screen[i].y, p, dirs[i]);
+}
+
+void Unprojector::GridRays(int x, int y, int nx, int ny, vec3 *dirs, int step) const {
+	vec3 p;
+	for (int j = 0; j < ny; j++)
+		for (int i = 0; i < nx; i++)
+			Ray((float) (x+i*step), (float) (y+j*step), p, dirs[j*nx+i]);
+}
+
+#endif
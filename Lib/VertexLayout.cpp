@@ -0,0 +1,57 @@
+// VertexLayout.cpp - declarative vertex formats, built once into cached vertex array objects
+
+#include <glad.h>
+#include "VertexLayout.h"
+#include <stdio.h>
+
+namespace {
+
+struct VertexArrayEntry {
+	GLuint buffer, program, indexBuffer, vao;
+	const VertexLayout *layout;
+};
+
+std::vector<VertexArrayEntry> vertexArrays;
+
+} // end namespace
+
+GLuint VertexLayout::Build(GLuint buffer, GLuint program, GLuint indexBuffer) const {
+	GLuint vao = 0;
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	for (const VertexAttrib &a : attribs) {
+		GLint location = a.location;
+		if (location < 0 && a.name && program)
+			location = glGetAttribLocation(program, a.name);
+		if (location < 0)
+			continue;
+		glEnableVertexAttribArray(location);
+		glVertexAttribPointer(location, a.components, a.type, a.normalized? GL_TRUE : GL_FALSE, a.stride, (void *) (size_t) a.offset);
+		if (a.divisor)
+			glVertexAttribDivisor(location, a.divisor);
+	}
+	if (indexBuffer)
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);	// recorded in VAO
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return vao;
+}
+
+GLuint GetVertexArray(GLuint buffer, const VertexLayout &layout, GLuint program, GLuint indexBuffer) {
+	for (VertexArrayEntry &e : vertexArrays)
+		if (e.buffer == buffer && e.layout == &layout && e.program == program && e.indexBuffer == indexBuffer)
+			return e.vao;
+	GLuint vao = layout.Build(buffer, program, indexBuffer);
+	vertexArrays.push_back({ buffer, program, indexBuffer, vao, &layout });
+	return vao;
+}
+
+void ForgetVertexArrays(GLuint buffer) {
+	for (size_t i = 0; i < vertexArrays.size(); )
+		if (vertexArrays[i].buffer == buffer) {
+			glDeleteVertexArrays(1, &vertexArrays[i].vao);
+			vertexArrays.erase(vertexArrays.begin()+i);
+		}
+		else i++;
+}
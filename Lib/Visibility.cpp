@@ -0,0 +1,122 @@
+// Visibility.cpp - batched, asynchronous point visibility via depth-buffer readback
+
+#include <glad.h>
+#include "GLState.h"
+#include "Visibility.h"
+#include <float.h>
+#include <limits.h>
+
+void VisibilityQuery::Clear() {
+	for (Slot &s : slots) {
+		if (s.fence)
+			glDeleteSync(s.fence);
+		if (s.pbo)
+			glDeleteBuffers(1, &s.pbo);
+		s = Slot();
+	}
+	next = nPending = latency = 0;
+	visible.resize(0);
+	depths.resize(0);
+	screens.resize(0);
+}
+
+void VisibilityQuery::Submit(vector<vec3> &points, mat4 fullview, float fudge) {
+	Submit(points.data(), (int) points.size(), fullview, fudge);
+}
+
+void VisibilityQuery::Submit(vec3 *points, int nPoints, mat4 fullview, float fudge) {
+	int nSlots = (int) slots.size();
+	Slot &s = slots[next];
+	if (s.fence) {
+		// all slots pending: discard oldest
+		glDeleteSync(s.fence);
+		s.fence = 0;
+		nPending--;
+	}
+	int vp[4];
+	GetGLViewport(vp);
+	s.serial = ++serial;
+	s.fudge = fudge;
+	s.points.resize(nPoints);
+	s.onScreen.resize(nPoints);
+	// project points, find bounding rectangle of those on-screen
+	int xmin = INT_MAX, ymin = INT_MAX, xmax = INT_MIN, ymax = INT_MIN;
+	for (int i = 0; i < nPoints; i++) {
+		vec4 xp = fullview*vec4(points[i], 1);
+		bool front = xp.w > FLT_EPSILON;
+		float w = front? xp.w : 1;
+		vec3 &sp = s.points[i];
+		sp = vec3(vp[0]+.5f*(1+xp.x/w)*vp[2], vp[1]+.5f*(1+xp.y/w)*vp[3], xp.z/w);
+		int x = (int) sp.x, y = (int) sp.y;
+		bool on = front && sp.x >= vp[0] && sp.y >= vp[1] && x < vp[0]+vp[2] && y < vp[1]+vp[3];
+		s.onScreen[i] = on;
+		if (on) {
+			xmin = x < xmin? x : xmin; xmax = x > xmax? x : xmax;
+			ymin = y < ymin? y : ymin; ymax = y > ymax? y : ymax;
+		}
+	}
+	bool any = xmin <= xmax;
+	s.x = any? xmin : 0;
+	s.y = any? ymin : 0;
+	s.w = any? xmax-xmin+1 : 0;
+	s.h = any? ymax-ymin+1 : 0;
+	if (any) {
+		int size = s.w*s.h*sizeof(float);
+		if (!s.pbo)
+			glGenBuffers(1, &s.pbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+		if (size > s.bufferSize) {
+			glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+			s.bufferSize = size;
+		}
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glReadPixels(s.x, s.y, s.w, s.h, GL_DEPTH_COMPONENT, GL_FLOAT, (void *) 0);
+			// with pack buffer bound, returns immediately; copy proceeds on GPU
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+	s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	nPending++;
+	next = (next+1)%nSlots;
+}
+
+bool VisibilityQuery::Update(bool wait) {
+	if (!nPending)
+		return false;
+	int nSlots = (int) slots.size();
+	Slot &s = slots[(next-nPending+nSlots)%nSlots];
+	GLenum status = glClientWaitSync(s.fence, wait? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait? 1000000000 : 0);
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		return false;
+	glDeleteSync(s.fence);
+	s.fence = 0;
+	nPending--;
+	Resolve(s);
+	latency = serial-s.serial;
+	return true;
+}
+
+void VisibilityQuery::Resolve(Slot &s) {
+	int n = (int) s.points.size();
+	visible.resize(n);
+	depths.resize(n);
+	screens.resize(n);
+	float *zbuf = NULL;
+	if (s.w > 0) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo);
+		zbuf = (float *) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, s.w*s.h*sizeof(float), GL_MAP_READ_BIT);
+	}
+	for (int i = 0; i < n; i++) {
+		vec3 &sp = s.points[i];
+		screens[i] = vec2(sp.x, sp.y);
+		float z = 1;
+		if (zbuf && s.onScreen[i])
+			z = 2*zbuf[((int) sp.y-s.y)*s.w+(int) sp.x-s.x]-1; // as IsVisible: clip range +/-1, zbuffer 0-1
+		depths[i] = z;
+		visible[i] = s.onScreen[i] && zbuf && sp.z < z+s.fudge;
+	}
+	if (s.w > 0) {
+		if (zbuf)
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+}
@@ -4,9 +4,12 @@
 #include <GLFW/glfw3.h>
 #include <stdio.h>
 #include <time.h>
+#include <vector>
 #include "Camera.h"
+#include "Curves.h"
 #include "Draw.h"
 #include "GLXtras.h"
+#include "GpuTimer.h"
 #include "Text.h"
 #include "VecMat.h"
 #include "Widgets.h"
@@ -39,6 +42,7 @@ Toggler         zfightTog(&zfight, "z-fight", 20, 125, 12),
 Toggler		   *togs[] = { &outlineTog, &zfightTog, &useLodTog, &viewMeshTog, &magnifyTog };
 int             res = 25, ntogs = sizeof(togs)/sizeof(Toggler *);
 float           outlineWidth = 1, outlineTransition = 1;
+bool            showStats = false;
 time_t          tEvent = clock();
 
 // vertex shader
@@ -226,22 +230,22 @@ vec3 BezPoint(float t, vec3 b1, vec3 b2, vec3 b3, vec3 b4) {
     return T3*b1+(3*t*T2)*b2+(3*t2*T)*b3+t3*b4;
 }
 
-void DrawCurve(vec3 b1, vec3 b2, vec3 b3, vec3 b4, vec3 color, float width) {
-    for (int i = 0; i < res; i++)
-        Line(BezPoint((float)i/res, b1, b2, b3, b4), BezPoint((float)(i+1)/res, b1, b2, b3, b4), width, color, 1);
-}
+BezierCurves gridCurves;
 
 void DrawGrid(vec3 color, float width) {
-	for (int i = 0; i <= res; i++) {
-		float a = (float)i/res;
-		vec3 spts[4], tpts[4];
-		for (int i = 0; i < 4; i++) {
-			spts[i] = BezPoint(a, ctrlPts[i][0], ctrlPts[i][1], ctrlPts[i][2], ctrlPts[i][3]);
-			tpts[i] = BezPoint(a, ctrlPts[0][i], ctrlPts[1][i], ctrlPts[2][i], ctrlPts[3][i]);
-		}
-		DrawCurve(spts[0], spts[1], spts[2], spts[3], color, width);
-		DrawCurve(tpts[0], tpts[1], tpts[2], tpts[3], color, width);
-	}
+    // isoparametric curves in s and t, evaluated and drawn on GPU in one call
+    std::vector<vec3> pts(8*(res+1));
+    int nCurves = 0;
+    for (int i = 0; i <= res; i++) {
+        float a = (float)i/res;
+        vec3 *spts = &pts[4*nCurves++], *tpts = &pts[4*nCurves++];
+        for (int i = 0; i < 4; i++) {
+            spts[i] = BezPoint(a, ctrlPts[i][0], ctrlPts[i][1], ctrlPts[i][2], ctrlPts[i][3]);
+            tpts[i] = BezPoint(a, ctrlPts[0][i], ctrlPts[1][i], ctrlPts[2][i], ctrlPts[3][i]);
+        }
+    }
+    gridCurves.Set(nCurves, pts.data(), NULL, color);
+    gridCurves.Display(camera.fullview, width, 1, useLod? 5.f : 0.f, useLod? 100 : res);
 }
 
 void Display() {
@@ -274,15 +278,21 @@ void Display() {
     SetUniform(shader, "outlineWidth", outlineWidth);
     SetUniform(shader, "transition", outlineTransition);
     // tessellate and render patch
-    glPatchParameteri(GL_PATCH_VERTICES, 4);
-    glDrawArrays(GL_PATCHES, 0, 4);
+    {
+        GpuTimer t("patch (tess+shade)");
+        glPatchParameteri(GL_PATCH_VERTICES, 4);
+        glDrawArrays(GL_PATCHES, 0, 4);
+    }
     // mesh and buttons without z-test
     UseDrawShader(camera.fullview);
-	if (zfight)
-		DrawGrid(vec3(0, 0, 0), 2*outlineWidth);
+    if (zfight) {
+        GpuTimer t("grid curves");
+        DrawGrid(vec3(0, 0, 0), 2*outlineWidth);
+    }
     glDisable(GL_DEPTH_TEST);
     // control mesh (disks and dashed lines)
     if (viewMesh) {
+        GpuTimer t("control mesh");
         for (int i = 0; i < 4; i++)
             for (int j = 0; j < 3; j++) {
                 LineDash(ctrlPts[i][j], ctrlPts[i][j+1], camera.fullview, 1.25f, vec3(1,1,0), vec3(1,1,0));
@@ -298,6 +308,13 @@ void Display() {
 	for (int i = 0; i < ntogs; i++)
 		togs[i]->Draw(NULL, 10);
     Text(20, 20, vec3(0, 0, 0), 1, "res = %i", res);
+    int vpWidth, vpHeight;
+    GetViewportSize(vpWidth, vpHeight);
+    std::vector<GpuTimerStat> stats = GpuTimerStats();
+    for (size_t i = 0; i < stats.size(); i++)
+        Text(20, vpHeight-20-15*(int)i, vec3(0, 0, 0), 1, "%s: %.3f ms", stats[i].name, stats[i].avgMs);
+    if (showStats)
+        TextGLFrameStats(20, vpHeight-80);
     if (magnify)
         magnifier.Display(int2(10, 490));
     glFlush();
@@ -395,6 +412,8 @@ void Keyboard(GLFWwindow *w, int c, int scancode, int action, int mods) {
     if (action == GLFW_PRESS)
         switch (c) {
             case GLFW_KEY_ESCAPE: glfwSetWindowShouldClose(w, GLFW_TRUE); break;
+            case 'G': PrintGpuTimers(); break;
+            case 'S': showStats = !showStats; break;
             case 'B': magnifier.blockSize += shift? -1 : 1; break;
             case 'R': res += shift? -1 : 1; res = res < 1? 1 : res; break;
             case 'T': outlineTransition *= (shift? .8f : 1.2f); break;
@@ -404,6 +423,8 @@ void Keyboard(GLFWwindow *w, int c, int scancode, int action, int mods) {
 
 const char *usage = "\
     b/B: +/- magnifier block size\n\
+    g: print GPU times\n\
+    s: toggle GL call statistics (if compiled with GL_STATS)\n\
     t/T: +/- outline transition\n\
     w/W: +/- lineWidth\n\
     r/R: +/- patch res\n\
@@ -422,6 +443,7 @@ int main(int ac, char **av) {
     glfwMakeContextCurrent(w);
     // init OpenGL
     gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
+    InitGLStats();
     PrintGLErrors();
     glViewport(0, 0, winWidth, winHeight);
     // init shader programs
@@ -446,6 +468,8 @@ int main(int ac, char **av) {
         Display();
         glfwPollEvents();
         glfwSwapBuffers(w);
+        GpuTimerFrame();
+        GLStatsFrame();
     }
     glfwDestroyWindow(w);
     glfwTerminate();
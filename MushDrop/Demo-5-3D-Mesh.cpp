@@ -18,7 +18,8 @@ void Display(GLFWwindow *w) {
 	glClearColor(.5f, .5f, .5f, 1);						// set background color
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);	// clear background and z-buffer
 	glEnable(GL_DEPTH_TEST);							// see only nearest surface
-	SetUniform(UseMeshShader(), "useLight", false);		// disable shading
+	UpdateFrameBlock(camera.modelview, camera.persp);	// camera for all library shaders this frame
+	SetMeshFeatures(GetMeshFeatures() & ~MeshLight);		// disable shading
 	cube.Display(camera);								// draw mesh with camera transform
 	glFlush();											// finish
 }
@@ -4,14 +4,17 @@
 #include <GLFW/glfw3.h>
 #include <stdio.h>
 #include <time.h>
+#include "GLState.h"
 #include "GLXtras.h"
 #include "Misc.h"
 #include "Sprite.h"
 #include "Widgets.h"
 #include "Draw.h"
 #include "Text.h"
+#include "Trace.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 using namespace std;
 
@@ -128,21 +131,7 @@ public:
 		if (dt > .2f && costume == Injured) {
 			SetCostume(Floating); 
 		}
-		int spriteShader = GetSpriteShader();
-		glUseProgram(spriteShader);
-		glActiveTexture(GL_TEXTURE0 + textureUnit + costume);
-		glBindTexture(GL_TEXTURE_2D, costumeTextureNames[costume]);
-		SetUniform(spriteShader, "textureImage", (int)textureUnit + costume);
-		SetUniform(spriteShader, "useMat", false);
-		SetUniform(spriteShader, "nTexChannels", nTexChannels);
-		SetUniform(spriteShader, "z", z);
-		SetUniform(spriteShader, "view", ptTransform);
-		SetUniform(spriteShader, "uvTransform", uvTransform);
-#ifdef GL_QUADS
-		glDrawArrays(GL_QUADS, 0, 4);
-#else
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-#endif
+		DisplayTexture(costumeTextureNames[costume], textureUnit + costume);
 	}
 };
 PlayerSprite mushroomPlayer;
@@ -163,21 +152,7 @@ public:
 	}
 	void SetCostume(Lives c) { costume = c; }
 	void Display(int textureUnit = 0) {
-		int spriteShader = GetSpriteShader();
-		glUseProgram(spriteShader);
-		glActiveTexture(GL_TEXTURE0 + textureUnit + costume);
-		glBindTexture(GL_TEXTURE_2D, costumeTextureNames[costume]);
-		SetUniform(spriteShader, "textureImage", (int)textureUnit + costume);
-		SetUniform(spriteShader, "useMat", false);
-		SetUniform(spriteShader, "nTexChannels", nTexChannels);
-		SetUniform(spriteShader, "z", z);
-		SetUniform(spriteShader, "view", ptTransform);
-		SetUniform(spriteShader, "uvTransform", uvTransform);
-#ifdef GL_QUADS
-		glDrawArrays(GL_QUADS, 0, 4);
-#else
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-#endif
+		DisplayTexture(costumeTextureNames[costume], textureUnit + costume);
 	}
 };
 HealthSprite healthSprite;
@@ -672,15 +647,29 @@ void initializeSprites()
 #pragma endregion
 
 int main(int ac, char **av) {
+	// optional trace of startup and frames, see Trace.h
+	if (ac > 1 && !strcmp(av[1], "-trace"))
+		TraceStart("MushZoom-trace.json");
 	// init app window and GL context
 	glfwInit();
+#ifndef NDEBUG
+	glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GLFW_TRUE);
+#endif
 	GLFWwindow *w = glfwCreateWindow(winWidth, winHeight, "MushZoom", NULL, NULL);
 	glfwSetWindowPos(w, 100, 100);
 	glfwMakeContextCurrent(w);
 	gladLoadGLLoader((GLADloadproc) glfwGetProcAddress);
+	InitGLState();
+	InitGLDebug();
 	glfwSetKeyCallback(w, Keyboard);
 
-	initializeSprites();
+	{
+		TRACE_ZONE("startup");
+		BuildShader();			// compile while sprite textures load
+		BuildDrawShaders();
+		BuildTextShader();
+		initializeSprites();
+	}
 	srand(clock());
 
 	// callbacks
@@ -690,6 +679,7 @@ int main(int ac, char **av) {
 	// event loop
 	glfwSwapInterval(1);
 	while (!glfwWindowShouldClose(w)) {
+		TRACE_ZONE("frame");
 		Display();
 		glfwSwapBuffers(w);
 		glfwPollEvents();